@@ -0,0 +1,240 @@
+#include "binary_search_tree.h"
+#include "d_ary_heap.h"
+#include "pairing_heap.h"
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// a timer queue on each structure, every round expires the earliest timer, rearms it and pulls another one in,
+// the order (deadline, id) is total so all three expire the same timers and print the same checksum,
+// usage: [timer count] [rounds]
+
+#define BENCH_DEFAULT_TIMERS ((size_t) 1 << 16)
+#define BENCH_DEFAULT_ROUNDS ((size_t) 1 << 22)
+#define BENCH_SPAN           ((uint64_t) 1 << 20) // rearmed timers land up to this far past now
+
+typedef struct bench_timer bench_timer_t;
+typedef struct bench_run   bench_run_t;
+
+struct bench_timer {
+    uint64_t deadline;
+    uint64_t id;
+};
+
+// the state every queue replays, deadlines mirrors what each queue holds per id
+struct bench_run {
+    size_t    timer_count;
+    size_t    rounds;
+    uint64_t *deadlines;
+    uint64_t  rand_state;
+    uint64_t  now;
+    uint64_t  checksum;
+};
+
+static int  bench_timer_cmp(const void *a, const void *b);
+static void bench_run_reset(bench_run_t *run);
+static void bench_run_expire(bench_run_t *run, const bench_timer_t *expired, bench_timer_t *rearm_out);
+static void bench_run_pull(bench_run_t *run, bench_timer_t *pull_out, bench_timer_t *old_out);
+static void bench_report(const char *name, const bench_run_t *run, double sec);
+
+static jfs_mlg_memory_t *bench_memory_init(jfs_mlg_desc_t *descs, size_t desc_count, jfs_err_t *err);
+static uint64_t          bench_rand(uint64_t *state);
+static double            bench_now(void);
+
+static void bench_dheap(bench_run_t *run, jfs_err_t *err);
+static void bench_pheap(bench_run_t *run, jfs_err_t *err);
+static void bench_bst(bench_run_t *run, jfs_err_t *err);
+
+int main(int argc, char **argv) {
+    bench_run_t run = {
+        .timer_count = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_TIMERS,
+        .rounds = argc > 2 ? strtoull(argv[2], NULL, 10) : BENCH_DEFAULT_ROUNDS,
+    };
+    if (run.timer_count < 2) return EXIT_FAILURE;
+
+    run.deadlines = malloc(run.timer_count * sizeof(*run.deadlines));
+    if (run.deadlines == NULL) return EXIT_FAILURE;
+
+    jfs_err_t err = JFS_OK;
+    bench_dheap(&run, &err);
+    bench_pheap(&run, &err);
+    bench_bst(&run, &err);
+
+    free(run.deadlines);
+    return err == JFS_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void bench_dheap(bench_run_t *run, jfs_err_t *err) {
+    VOID_CHECK_ERR;
+
+    jfs_mlg_desc_t descs[2] = {
+        jfs_dheap_make_desc(sizeof(bench_timer_t), alignof(bench_timer_t), run->timer_count, err),
+        jfs_dheap_make_handle_desc(run->timer_count, err),
+    };
+    VOID_CHECK_ERR;
+    jfs_mlg_memory_t *const memory = bench_memory_init(descs, 2, err);
+    VOID_CHECK_ERR;
+
+    jfs_dheap_handle_t **const handles = jfs_malloc(run->timer_count * sizeof(*handles), err);
+    jfs_dheap_t                heap;
+    const jfs_dheap_conf_t     conf = {
+            .component = &memory->component_list[0],
+            .handle_component = &memory->component_list[1],
+            .cmp = bench_timer_cmp,
+            .value_size = sizeof(bench_timer_t),
+    };
+    GOTO_IF_ERR(cleanup);
+    jfs_dheap_init(&heap, &conf, err);
+    GOTO_IF_ERR(cleanup);
+
+    bench_run_reset(run);
+    for (size_t id = 0; id < run->timer_count && *err == JFS_OK; id++) {
+        handles[id] = jfs_dheap_push(&heap, &(bench_timer_t) {.deadline = run->deadlines[id], .id = id}, err);
+    }
+
+    const double start = bench_now();
+    for (size_t round = 0; round < run->rounds && *err == JFS_OK; round++) {
+        bench_timer_t expired, timer, old;
+        jfs_dheap_pop(&heap, &expired, err);
+        bench_run_expire(run, &expired, &timer);
+        handles[timer.id] = jfs_dheap_push(&heap, &timer, err);
+
+        bench_run_pull(run, &timer, &old);
+        jfs_dheap_update(&heap, handles[timer.id], &timer);
+    }
+    bench_report("dheap", run, bench_now() - start);
+
+cleanup:
+    free(handles);
+    jfs_mlg_memory_free(memory);
+}
+
+static void bench_pheap(bench_run_t *run, jfs_err_t *err) {
+    VOID_CHECK_ERR;
+
+    jfs_mlg_desc_t desc = jfs_pheap_make_desc(sizeof(bench_timer_t), alignof(bench_timer_t), run->timer_count, err);
+    VOID_CHECK_ERR;
+    jfs_mlg_memory_t *const memory = bench_memory_init(&desc, 1, err);
+    VOID_CHECK_ERR;
+
+    jfs_pheap_node_t **const nodes = jfs_malloc(run->timer_count * sizeof(*nodes), err);
+    jfs_pheap_t              heap;
+    const jfs_pheap_conf_t   conf = {.component = &memory->component_list[0], .cmp = bench_timer_cmp, .value_size = sizeof(bench_timer_t)};
+    GOTO_IF_ERR(cleanup);
+    jfs_pheap_init(&heap, &conf, err);
+    GOTO_IF_ERR(cleanup);
+
+    bench_run_reset(run);
+    for (size_t id = 0; id < run->timer_count && *err == JFS_OK; id++) {
+        nodes[id] = jfs_pheap_push(&heap, &(bench_timer_t) {.deadline = run->deadlines[id], .id = id}, err);
+    }
+
+    const double start = bench_now();
+    for (size_t round = 0; round < run->rounds && *err == JFS_OK; round++) {
+        bench_timer_t expired, timer, old;
+        jfs_pheap_pop(&heap, &expired, err);
+        bench_run_expire(run, &expired, &timer);
+        nodes[timer.id] = jfs_pheap_push(&heap, &timer, err);
+
+        bench_run_pull(run, &timer, &old);
+        jfs_pheap_update(&heap, nodes[timer.id], &timer);
+    }
+    bench_report("pheap", run, bench_now() - start);
+
+cleanup:
+    free(nodes);
+    jfs_mlg_memory_free(memory);
+}
+
+// there are no handles, a decrease is a take by the old key and a put under the new one
+static void bench_bst(bench_run_t *run, jfs_err_t *err) {
+    VOID_CHECK_ERR;
+
+    jfs_mlg_desc_t desc = jfs_bst_make_desc(sizeof(bench_timer_t), alignof(bench_timer_t), run->timer_count, err);
+    VOID_CHECK_ERR;
+    jfs_mlg_memory_t *const memory = bench_memory_init(&desc, 1, err);
+    VOID_CHECK_ERR;
+
+    jfs_bst_t            tree;
+    const jfs_bst_conf_t conf = {.component = &memory->component_list[0], .cmp = bench_timer_cmp, .value_size = sizeof(bench_timer_t)};
+    jfs_bst_init(&tree, &conf, err);
+    GOTO_IF_ERR(cleanup);
+
+    bench_run_reset(run);
+    for (size_t id = 0; id < run->timer_count && *err == JFS_OK; id++) {
+        const bench_timer_t timer = {.deadline = run->deadlines[id], .id = id};
+        jfs_bst_puts(&tree, &timer, &timer, err);
+    }
+
+    const double start = bench_now();
+    for (size_t round = 0; round < run->rounds && *err == JFS_OK; round++) {
+        bench_timer_t expired, timer, old;
+        jfs_bst_get_smallest(&tree, &expired, err);
+        bench_run_expire(run, &expired, &timer);
+        jfs_bst_puts(&tree, &timer, &timer, err);
+
+        bench_run_pull(run, &timer, &old);
+        jfs_bst_takes(&tree, &expired, &old, err);
+        jfs_bst_puts(&tree, &timer, &timer, err);
+    }
+    bench_report("bst", run, bench_now() - start);
+
+cleanup:
+    jfs_mlg_memory_free(memory);
+}
+
+static int bench_timer_cmp(const void *a, const void *b) {
+    const bench_timer_t *const timer_a = a;
+    const bench_timer_t *const timer_b = b;
+    if (timer_a->deadline != timer_b->deadline) return timer_a->deadline < timer_b->deadline ? -1 : 1;
+    return (timer_a->id > timer_b->id) - (timer_a->id < timer_b->id);
+}
+
+static void bench_run_reset(bench_run_t *run) {
+    run->rand_state = 0x9e3779b97f4a7c15;
+    run->now = 0;
+    run->checksum = 0;
+    for (size_t id = 0; id < run->timer_count; id++) {
+        run->deadlines[id] = bench_rand(&run->rand_state) % BENCH_SPAN;
+    }
+}
+
+static void bench_run_expire(bench_run_t *run, const bench_timer_t *expired, bench_timer_t *rearm_out) {
+    run->now = expired->deadline;
+    run->checksum = run->checksum * 31 + expired->id;
+
+    rearm_out->id = expired->id;
+    rearm_out->deadline = run->now + 1 + bench_rand(&run->rand_state) % BENCH_SPAN;
+    run->deadlines[rearm_out->id] = rearm_out->deadline;
+}
+
+// halves the wait of a random timer, old_out is how the queue holds it now
+static void bench_run_pull(bench_run_t *run, bench_timer_t *pull_out, bench_timer_t *old_out) {
+    const uint64_t id = bench_rand(&run->rand_state) % run->timer_count;
+    *old_out = (bench_timer_t) {.deadline = run->deadlines[id], .id = id};
+    *pull_out = (bench_timer_t) {.deadline = run->now + (old_out->deadline - run->now) / 2, .id = id};
+    run->deadlines[id] = pull_out->deadline;
+}
+
+static void bench_report(const char *name, const bench_run_t *run, double sec) {
+    printf("%-6s %7.1f ns per round  checksum %016llx\n", name, sec * 1e9 / (double) run->rounds, (unsigned long long) run->checksum);
+}
+
+static jfs_mlg_memory_t *bench_memory_init(jfs_mlg_desc_t *descs, size_t desc_count, jfs_err_t *err) {
+    const jfs_mlg_layout_t layout = {.descriptions = descs, .descriptions_count = desc_count, .header_desc = {.size = 8, .align = 8, .count = 1}};
+    return jfs_mlg_memory_init(&layout, err);
+}
+
+static uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
@@ -0,0 +1,181 @@
+#include "typed_binary_search_tree.h"
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// puts then looks up every key through the generic calls and through JFS_BST_DEFINE, usage: [count]
+
+#define BENCH_DEFAULT_COUNT ((size_t) 1 << 20)
+#define BENCH_KEY_BYTES     16
+
+typedef struct bench_int   bench_int_t;
+typedef struct bench_bytes bench_bytes_t;
+
+struct bench_int {
+    uint64_t key;
+    uint64_t payload;
+};
+
+struct bench_bytes {
+    uint8_t  key[BENCH_KEY_BYTES];
+    uint64_t payload;
+};
+
+JFS_BST_DEFINE_INT(bench_int_tree, bench_int_t, uint64_t, key)
+JFS_BST_DEFINE_BYTES(bench_bytes_tree, bench_bytes_t, key)
+
+static uint64_t          bench_rand(uint64_t *state);
+static double            bench_now(void);
+static jfs_mlg_memory_t *bench_tree_init(jfs_bst_t *tree_init, size_t obj_size, size_t obj_align, size_t count, jfs_bst_cmp_fn cmp, jfs_err_t *err);
+static void              bench_report(const char *name, double puts_sec, double lookup_sec, size_t count);
+
+static void bench_int_generic(const bench_int_t *values, size_t count, jfs_err_t *err);
+static void bench_int_typed(const bench_int_t *values, size_t count, jfs_err_t *err);
+static void bench_bytes_generic(const bench_bytes_t *values, size_t count, jfs_err_t *err);
+static void bench_bytes_typed(const bench_bytes_t *values, size_t count, jfs_err_t *err);
+
+static volatile uint64_t bench_sink; // keeps the lookups from being thrown away
+
+int main(int argc, char **argv) {
+    const size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_COUNT;
+    if (count == 0 || count > UINT32_MAX) return EXIT_FAILURE;
+
+    bench_int_t   *int_values = malloc(count * sizeof(*int_values));
+    bench_bytes_t *bytes_values = malloc(count * sizeof(*bytes_values));
+    if (int_values == NULL || bytes_values == NULL) return EXIT_FAILURE;
+
+    // distinct keys in random order, the bytes share a long prefix so memcmp has to look past the first word
+    uint64_t state = 0x9e3779b97f4a7c15;
+    for (size_t i = 0; i < count; i++) {
+        int_values[i] = (bench_int_t) {.key = bench_rand(&state) << 32 | i, .payload = i};
+
+        bytes_values[i] = (bench_bytes_t) {.payload = i};
+        memset(bytes_values[i].key, 0xab, BENCH_KEY_BYTES - sizeof(uint64_t));
+        for (size_t byte = 0; byte < sizeof(uint64_t); byte++) { // big endian so both trees hold the same order
+            bytes_values[i].key[BENCH_KEY_BYTES - 1 - byte] = (uint8_t) (int_values[i].key >> (byte * 8));
+        }
+    }
+
+    jfs_err_t err = JFS_OK;
+    bench_int_generic(int_values, count, &err);
+    bench_int_typed(int_values, count, &err);
+    bench_bytes_generic(bytes_values, count, &err);
+    bench_bytes_typed(bytes_values, count, &err);
+
+    free(int_values);
+    free(bytes_values);
+    return err == JFS_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void bench_int_generic(const bench_int_t *values, size_t count, jfs_err_t *err) {
+    jfs_bst_t               tree;
+    jfs_mlg_memory_t *const memory = bench_tree_init(&tree, sizeof(bench_int_t), alignof(bench_int_t), count, bench_int_tree_cmp, err);
+    VOID_CHECK_ERR;
+
+    const double start = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        jfs_bst_puts(&tree, &values[i], &values[i].key, err);
+    }
+    const double middle = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        const bench_int_t *const found = jfs_bst_lookup(&tree, &values[count - 1 - i].key);
+        bench_sink += found->payload;
+    }
+    bench_report("int generic", middle - start, bench_now() - middle, count);
+
+    jfs_mlg_memory_free(memory);
+}
+
+static void bench_int_typed(const bench_int_t *values, size_t count, jfs_err_t *err) {
+    jfs_bst_t               tree;
+    jfs_mlg_memory_t *const memory = bench_tree_init(&tree, sizeof(bench_int_t), alignof(bench_int_t), count, bench_int_tree_cmp, err);
+    VOID_CHECK_ERR;
+
+    const double start = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        bench_int_tree_puts(&tree, &values[i], err);
+    }
+    const double middle = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        const bench_int_t *const found = bench_int_tree_lookup(&tree, values[count - 1 - i].key);
+        bench_sink += found->payload;
+    }
+    bench_report("int typed", middle - start, bench_now() - middle, count);
+
+    jfs_mlg_memory_free(memory);
+}
+
+static void bench_bytes_generic(const bench_bytes_t *values, size_t count, jfs_err_t *err) {
+    jfs_bst_t               tree;
+    jfs_mlg_memory_t *const memory = bench_tree_init(&tree, sizeof(bench_bytes_t), alignof(bench_bytes_t), count, bench_bytes_tree_cmp, err);
+    VOID_CHECK_ERR;
+
+    const double start = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        const uint8_t *const key = values[i].key;
+        jfs_bst_puts(&tree, &values[i], &key, err);
+    }
+    const double middle = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        const uint8_t *const       key = values[count - 1 - i].key;
+        const bench_bytes_t *const found = jfs_bst_lookup(&tree, &key);
+        bench_sink += found->payload;
+    }
+    bench_report("bytes generic", middle - start, bench_now() - middle, count);
+
+    jfs_mlg_memory_free(memory);
+}
+
+static void bench_bytes_typed(const bench_bytes_t *values, size_t count, jfs_err_t *err) {
+    jfs_bst_t               tree;
+    jfs_mlg_memory_t *const memory = bench_tree_init(&tree, sizeof(bench_bytes_t), alignof(bench_bytes_t), count, bench_bytes_tree_cmp, err);
+    VOID_CHECK_ERR;
+
+    const double start = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        bench_bytes_tree_puts(&tree, &values[i], err);
+    }
+    const double middle = bench_now();
+    for (size_t i = 0; i < count && *err == JFS_OK; i++) {
+        const bench_bytes_t *const found = bench_bytes_tree_lookup(&tree, values[count - 1 - i].key);
+        bench_sink += found->payload;
+    }
+    bench_report("bytes typed", middle - start, bench_now() - middle, count);
+
+    jfs_mlg_memory_free(memory);
+}
+
+static jfs_mlg_memory_t *bench_tree_init(jfs_bst_t *tree_init, size_t obj_size, size_t obj_align, size_t count, jfs_bst_cmp_fn cmp, jfs_err_t *err) {
+    jfs_mlg_desc_t desc = jfs_bst_make_desc(obj_size, obj_align, count, err);
+    VAL_CHECK_ERR(NULL);
+
+    const jfs_mlg_layout_t layout = {.descriptions = &desc, .descriptions_count = 1, .header_desc = {.size = 8, .align = 8, .count = 1}};
+    jfs_mlg_memory_t *const memory = jfs_mlg_memory_init(&layout, err);
+    VAL_CHECK_ERR(NULL);
+
+    const jfs_bst_conf_t conf = {.component = &memory->component_list[0], .cmp = cmp, .value_size = obj_size};
+    jfs_bst_init(tree_init, &conf, err);
+    if (*err != JFS_OK) {
+        jfs_mlg_memory_free(memory);
+        return NULL;
+    }
+    return memory;
+}
+
+static void bench_report(const char *name, double puts_sec, double lookup_sec, size_t count) {
+    printf("%-14s puts %7.1f ns  lookup %7.1f ns\n", name, puts_sec * 1e9 / (double) count, lookup_sec * 1e9 / (double) count);
+}
+
+static uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
@@ -0,0 +1,69 @@
+#ifndef JFS_B_PLUS_TREE_H
+#define JFS_B_PLUS_TREE_H
+
+#include "free_list.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JFS_BPT_DEFAULT_NODE_SIZE ((size_t) 512) // eight cache lines
+
+typedef struct jfs_bpt      jfs_bpt_t;
+typedef struct jfs_bpt_node jfs_bpt_node_t;
+typedef struct jfs_bpt_conf jfs_bpt_conf_t;
+typedef struct jfs_bpt_iter jfs_bpt_iter_t;
+
+typedef int (*jfs_bpt_cmp_fn)(const void *key, const void *value);
+
+// values (leaf) or child pointers then separator values (inner) follow the header in the same node
+struct jfs_bpt_node {
+    jfs_bpt_node_t *parent;
+    jfs_bpt_node_t *prev; // leaf links, unused in inner nodes
+    jfs_bpt_node_t *next;
+    uint32_t        count; // values in a leaf, separators in an inner node
+    uint32_t        is_leaf;
+};
+
+struct jfs_bpt_conf {
+    jfs_mlg_component_t *component;
+    jfs_bpt_cmp_fn       cmp;
+    size_t               value_size; // the obj_size given to make_desc
+};
+
+struct jfs_bpt {
+    jfs_bpt_node_t *root; // NULL when empty
+    jfs_bpt_node_t *first_leaf;
+    jfs_bpt_node_t *last_leaf;
+    jfs_bpt_cmp_fn  cmp;
+    size_t          value_size;
+    size_t          value_stride;
+    uintptr_t       values_offset;
+    uintptr_t       children_offset;
+    uintptr_t       separators_offset;
+    size_t          leaf_capacity;
+    size_t          inner_capacity;
+    size_t          height;
+    size_t          count;
+    jfs_fl_t        free_list;
+};
+
+// walks the linked leaves, invalidated by any put/take on the tree
+struct jfs_bpt_iter {
+    const jfs_bpt_t *tree;
+    jfs_bpt_node_t  *leaf; // NULL when done
+    size_t           index;
+};
+
+jfs_mlg_desc_t jfs_bpt_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, size_t node_size, jfs_err_t *err); // zero node_size for default
+void           jfs_bpt_init(jfs_bpt_t *tree_init, const jfs_bpt_conf_t *conf, jfs_err_t *err);
+void           jfs_bpt_puts(jfs_bpt_t *tree, const void *value, const void *key, jfs_err_t *err);
+void           jfs_bpt_takes(jfs_bpt_t *tree, void *value_out, const void *key, jfs_err_t *err);
+void           jfs_bpt_get_largest(jfs_bpt_t *tree, void *value_out, jfs_err_t *err);
+void           jfs_bpt_get_smallest(jfs_bpt_t *tree, void *value_out, jfs_err_t *err);
+void          *jfs_bpt_lookup(const jfs_bpt_t *tree, const void *key) WUR; // NULL when missing, the value stays in the tree
+
+void  jfs_bpt_iter_init(jfs_bpt_iter_t *iter_init, const jfs_bpt_t *tree);
+void  jfs_bpt_iter_lower_bound(jfs_bpt_iter_t *iter_init, const jfs_bpt_t *tree, const void *key); // first value >= key
+void *jfs_bpt_iter_next(jfs_bpt_iter_t *iter) WUR;                                                 // NULL at the end
+
+#endif
@@ -2,17 +2,28 @@
 #define JFS_BINARY_SEARCH_TREE_H
 
 #include "free_list.h"
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-typedef struct jfs_bst       jfs_bst_t;
-typedef struct jfs_bst_node  jfs_bst_node_t;
-typedef struct jfs_bst_fns   jfs_bst_fns_t;
-typedef struct jfs_bst_conf  jfs_bst_conf_t;
-typedef struct jfs_bst_cache jfs_bst_cache_t;
+typedef struct jfs_bst          jfs_bst_t;
+typedef struct jfs_bst_node     jfs_bst_node_t;
+typedef struct jfs_bst_fns      jfs_bst_fns_t;
+typedef struct jfs_bst_conf     jfs_bst_conf_t;
+typedef struct jfs_bst_cache    jfs_bst_cache_t;
+typedef struct jfs_bst_iter     jfs_bst_iter_t;
+typedef struct jfs_bst_location jfs_bst_location_t;
+typedef struct jfs_bst_reader   jfs_bst_reader_t;
+typedef struct jfs_bst_pool     jfs_bst_pool_t;
+typedef struct jfs_bst_chunk    jfs_bst_chunk_t;
 
 typedef int (*jfs_bst_cmp_fn)(const void *key, const void *value);
+typedef bool (*jfs_bst_visit_fn)(void *value, void *ctx); // return false to stop the visit
+typedef void (*jfs_bst_take_fn)(void *value, void *ctx);  // value is only valid during the call
+typedef void *(*jfs_bst_chunk_alloc_fn)(size_t size, size_t align, void *ctx); // NULL when the parent is out of memory, a misaligned chunk is freed and fails with JFS_ERR_BAD_CONF
+typedef void (*jfs_bst_chunk_free_fn)(void *chunk_move, size_t size, void *ctx);
 
 struct jfs_bst_node {
     uintptr_t       parent_color;
@@ -21,9 +32,27 @@ struct jfs_bst_node {
     jfs_bst_node_t *list;
 };
 
+// one per reader thread, zero it before init, padded so readers don't share lines
+struct jfs_bst_reader {
+    alignas(64) atomic_uint_fast64_t active; // tree seq + 1 seen on entry, 0 when outside a read
+};
+
+// parent allocator the tree pulls node chunks from once its component runs out, chunks go back as they drain
+struct jfs_bst_pool {
+    jfs_bst_chunk_alloc_fn alloc;
+    jfs_bst_chunk_free_fn  free;
+    void                  *ctx;
+    size_t                 chunk_size; // power of two and the alignment asked for, zero for the default
+};
+
 struct jfs_bst_conf {
     jfs_mlg_component_t *component;
     jfs_bst_cmp_fn       cmp;
+    size_t               value_size; // zero for the whole padded slot, otherwise the obj_size given to make_desc
+    bool                 ranked;     // keeps subtree sizes for select/rank, needs jfs_bst_make_ranked_desc and a value_size
+    jfs_bst_reader_t    *readers;    // can null, enables jfs_bst_read_lookup from other threads
+    size_t               reader_count;
+    const jfs_bst_pool_t *pool; // can null, grows past the component instead of failing with JFS_ERR_FULL
 };
 
 struct jfs_bst_cache {
@@ -40,14 +69,74 @@ struct jfs_bst {
     jfs_bst_cmp_fn  cmp;
     uintptr_t       value_offset;
     size_t          value_size;
+    uintptr_t       size_offset; // subtree size stored after the node links, 0 when not ranked
     jfs_fl_t        free_list;
+
+    // nodes past the component, a node finds its chunk by masking its address with the chunk size
+    jfs_bst_pool_t   pool; // alloc is NULL when the tree can't grow
+    const uint8_t   *component_begin;
+    const uint8_t   *component_end;
+    jfs_mlg_desc_t   chunk_desc; // the nodes of one chunk
+    uintptr_t        chunk_offset;
+    jfs_bst_chunk_t *open_chunks; // chunks with free nodes
+    jfs_bst_chunk_t *full_chunks;
+    jfs_bst_chunk_t *spare_chunk; // one drained chunk is held back so a tree sitting at a chunk boundary doesn't thrash the parent
+    size_t           chunk_free_count;
+
+    // single writer/multi reader seqlock, only kept up when there are readers
+    jfs_bst_reader_t    *readers;
+    size_t               reader_count;
+    atomic_uint_fast64_t seq; // odd while the writer is changing the tree
+    size_t               write_depth;
+    jfs_bst_node_t      *retired; // deleted nodes a reader may still be on, oldest first
+    jfs_bst_node_t      *retired_tail;
+};
+
+// where a search for a key ended, node is the match or nil with parent/parent_cmp saying where it would hang
+struct jfs_bst_location {
+    jfs_bst_node_t *node;
+    jfs_bst_node_t *parent;
+    int             parent_cmp;
+};
+
+// in order walk using the parent links, invalidated by any put/take on the tree
+struct jfs_bst_iter {
+    const jfs_bst_t *tree;
+    jfs_bst_node_t  *node;    // tree node whose dupes are being walked
+    jfs_bst_node_t  *current; // next node to hand out, NULL when done
 };
 
 jfs_mlg_desc_t jfs_bst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
+jfs_mlg_desc_t jfs_bst_make_ranked_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
 void           jfs_bst_init(jfs_bst_t *tree_init, const jfs_bst_conf_t *conf, jfs_err_t *err);
+void           jfs_bst_release_pool(jfs_bst_t *tree_move); // hands every chunk back to the pool, the tree can't be used after
 void           jfs_bst_puts(jfs_bst_t *tree, const void *value, const void *key, jfs_err_t *err);
 void           jfs_bst_takes(jfs_bst_t *tree, void *value_out, const void *key, jfs_err_t *err);
 void           jfs_bst_get_largest(jfs_bst_t *tree, void *value_out, jfs_err_t *err);
 void           jfs_bst_get_smallest(jfs_bst_t *tree, void *value_out, jfs_err_t *err);
+void           jfs_bst_build(jfs_bst_t *tree, const void *values, const void *const *keys, size_t count, jfs_err_t *err); // empty tree, values sorted
+void           jfs_bst_merge(jfs_bst_t *tree, const void *values, const void *const *keys, size_t count, jfs_err_t *err); // values sorted, cheapest past the largest
+void          *jfs_bst_lookup(const jfs_bst_t *tree, const void *key) WUR; // NULL when missing, the value stays in the tree
+size_t         jfs_bst_count(const jfs_bst_t *tree, const void *key);           // values stored under key, O(log n)
+size_t         jfs_bst_take_all(jfs_bst_t *tree, const void *key, jfs_bst_take_fn take, void *ctx); // one search and one delete, returns how many were taken
+
+// for callers that did their own search like JFS_BST_DEFINE, location must be from the current tree state
+void jfs_bst_puts_at(jfs_bst_t *tree, const void *value, const jfs_bst_location_t *location, jfs_err_t *err);
+void jfs_bst_takes_node(jfs_bst_t *tree, void *value_out, jfs_bst_node_t *node);
+
+// safe from any thread holding its own reader slot while the single writer uses the calls above,
+// retries until it sees a consistent tree and copies the matching value out, false when missing
+bool jfs_bst_read_lookup(const jfs_bst_t *tree, jfs_bst_reader_t *reader, const void *key, void *value_out);
+
+// ranked trees only, positions count every value including dupes in iteration order
+size_t jfs_bst_size(const jfs_bst_t *tree);
+void  *jfs_bst_select(const jfs_bst_t *tree, size_t index) WUR; // NULL when index >= size, the value stays in the tree
+size_t jfs_bst_rank(const jfs_bst_t *tree, const void *key);   // values < key
+
+void  jfs_bst_iter_init(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree);
+void  jfs_bst_iter_lower_bound(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree, const void *key); // first value >= key
+void  jfs_bst_iter_upper_bound(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree, const void *key); // first value > key
+void *jfs_bst_iter_next(jfs_bst_iter_t *iter) WUR;                                                 // NULL at the end
+void  jfs_bst_visit_range(const jfs_bst_t *tree, const void *low_key, const void *high_key, jfs_bst_visit_fn visit, void *ctx); // inclusive, NULL keys are unbounded
 
 #endif
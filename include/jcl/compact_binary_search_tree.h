@@ -0,0 +1,69 @@
+#ifndef JFS_COMPACT_BINARY_SEARCH_TREE_H
+#define JFS_COMPACT_BINARY_SEARCH_TREE_H
+
+#include "free_list.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JFS_CBST_MAX_COUNT ((size_t) INT32_MAX - 1) // parent keeps a color bit and slot 0 is the nil node
+
+typedef struct jfs_cbst       jfs_cbst_t;
+typedef struct jfs_cbst_node  jfs_cbst_node_t;
+typedef struct jfs_cbst_conf  jfs_cbst_conf_t;
+typedef struct jfs_cbst_cache jfs_cbst_cache_t;
+typedef struct jfs_cbst_iter  jfs_cbst_iter_t;
+
+typedef int (*jfs_cbst_cmp_fn)(const void *key, const void *value);
+
+// links are slot indices into the component instead of pointers, 16 bytes against 32 for jfs_bst_node_t
+struct jfs_cbst_node {
+    uint32_t parent_color; // parent index << 1 | color
+    uint32_t right;
+    uint32_t left;
+    uint32_t list; // next dupe, 0 ends the list
+};
+
+struct jfs_cbst_conf {
+    jfs_mlg_component_t *component; // from jfs_cbst_make_desc
+    jfs_cbst_cmp_fn      cmp;
+    size_t               value_size; // zero for the whole padded slot, otherwise the obj_size given to make_desc
+};
+
+struct jfs_cbst_cache {
+    uint32_t smallest;
+    uint32_t largest;
+    uint32_t previous;
+};
+
+struct jfs_cbst {
+    uint8_t         *slots; // slot 0 is the nil node
+    size_t           slot_size;
+    uint32_t         root;
+    jfs_cbst_cache_t cache;
+    jfs_cbst_cmp_fn  cmp;
+    uintptr_t        value_offset;
+    size_t           value_size;
+    jfs_fl_t         free_list;
+};
+
+// in order walk using the parent links, invalidated by any put/take on the tree
+struct jfs_cbst_iter {
+    const jfs_cbst_t *tree;
+    uint32_t          node;    // tree node whose dupes are being walked
+    uint32_t          current; // next node to hand out, 0 when done
+};
+
+jfs_mlg_desc_t jfs_cbst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
+void           jfs_cbst_init(jfs_cbst_t *tree_init, const jfs_cbst_conf_t *conf, jfs_err_t *err);
+void           jfs_cbst_puts(jfs_cbst_t *tree, const void *value, const void *key, jfs_err_t *err);
+void           jfs_cbst_takes(jfs_cbst_t *tree, void *value_out, const void *key, jfs_err_t *err);
+void           jfs_cbst_get_largest(jfs_cbst_t *tree, void *value_out, jfs_err_t *err);
+void           jfs_cbst_get_smallest(jfs_cbst_t *tree, void *value_out, jfs_err_t *err);
+void          *jfs_cbst_lookup(const jfs_cbst_t *tree, const void *key) WUR; // NULL when missing, the value stays in the tree
+
+void  jfs_cbst_iter_init(jfs_cbst_iter_t *iter_init, const jfs_cbst_t *tree);
+void  jfs_cbst_iter_lower_bound(jfs_cbst_iter_t *iter_init, const jfs_cbst_t *tree, const void *key); // first value >= key
+void *jfs_cbst_iter_next(jfs_cbst_iter_t *iter) WUR;                                                  // NULL at the end
+
+#endif
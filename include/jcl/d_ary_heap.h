@@ -0,0 +1,57 @@
+#ifndef JFS_D_ARY_HEAP_H
+#define JFS_D_ARY_HEAP_H
+
+#include "free_list.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define JFS_DHEAP_ARITY 4 // the children of a slot sit next to each other, usually in one or two cache lines
+
+typedef struct jfs_dheap        jfs_dheap_t;
+typedef struct jfs_dheap_conf   jfs_dheap_conf_t;
+typedef struct jfs_dheap_slot   jfs_dheap_slot_t;
+typedef struct jfs_dheap_handle jfs_dheap_handle_t;
+
+typedef int (*jfs_dheap_cmp_fn)(const void *a, const void *b); // < 0 when a comes out first
+
+// stays put while its value moves around the heap array, valid until the value is popped or removed
+struct jfs_dheap_handle {
+    size_t index;
+};
+
+// header in front of every value in the heap array
+struct jfs_dheap_slot {
+    jfs_dheap_handle_t *handle;
+};
+
+struct jfs_dheap_conf {
+    jfs_mlg_component_t *component;        // heap array, from jfs_dheap_make_desc
+    jfs_mlg_component_t *handle_component; // from jfs_dheap_make_handle_desc with the same obj_count
+    jfs_dheap_cmp_fn     cmp;
+    size_t               value_size; // zero for the whole padded slot, otherwise the obj_size given to make_desc
+};
+
+struct jfs_dheap {
+    uint8_t         *slots;
+    uint8_t         *scratch; // one slot past capacity, holds the slot being sifted
+    size_t           slot_size;
+    uintptr_t        value_offset;
+    size_t           value_size;
+    size_t           count;
+    size_t           capacity;
+    jfs_dheap_cmp_fn cmp;
+    jfs_fl_t         handles;
+};
+
+jfs_mlg_desc_t jfs_dheap_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err); // count is obj_count + 1 for the scratch slot
+jfs_mlg_desc_t jfs_dheap_make_handle_desc(size_t obj_count, jfs_err_t *err);
+void           jfs_dheap_init(jfs_dheap_t *heap_init, const jfs_dheap_conf_t *conf, jfs_err_t *err);
+
+jfs_dheap_handle_t *jfs_dheap_push(jfs_dheap_t *heap, const void *value, jfs_err_t *err) WUR;
+void                jfs_dheap_pop(jfs_dheap_t *heap, void *value_out, jfs_err_t *err);
+void               *jfs_dheap_peek(const jfs_dheap_t *heap) WUR; // NULL when empty, the value stays in the heap
+void               *jfs_dheap_value(const jfs_dheap_t *heap, const jfs_dheap_handle_t *handle) WUR;
+void                jfs_dheap_update(jfs_dheap_t *heap, jfs_dheap_handle_t *handle, const void *value); // decrease or increase
+void                jfs_dheap_remove(jfs_dheap_t *heap, jfs_dheap_handle_t *handle_move, void *value_out);
+
+#endif
@@ -4,6 +4,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <netdb.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
 
@@ -113,10 +114,21 @@ typedef enum {
     JCL_ERR_COND_TIMED_OUT,
 } jcl_err_t;
 
+struct statx;
+struct io_uring_params;
+
 void            *jcl_malloc(size_t size, jcl_err_t *err) WUR;
 void            *jcl_realloc(void *ptr, size_t size, jcl_err_t *err) WUR;
 void             jcl_lstat(const char *path, struct stat *stat_init, jcl_err_t *err);
 DIR             *jcl_opendir(const char *path, jcl_err_t *err) WUR;
+int              jcl_openat(int dir_fd, const char *path, int flags, jcl_err_t *err) WUR;
+size_t           jcl_getdents64(int dir_fd, void *buf, size_t size, jcl_err_t *err) WUR; // 0 at the end of the dir
+void             jcl_statx(int dir_fd, const char *path, int flags, unsigned int mask, struct statx *statx_init, jcl_err_t *err);
+int              jcl_io_uring_setup(unsigned int entries, struct io_uring_params *params, jcl_err_t *err) WUR;
+unsigned int     jcl_io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, jcl_err_t *err) WUR; // submitted count
+int              jcl_inotify_init1(int flags, jcl_err_t *err) WUR;
+int              jcl_inotify_add_watch(int inotify_fd, const char *path, uint32_t mask, jcl_err_t *err) WUR; // JCL_ERR_FULL at the watch limit
+void             jcl_inotify_rm_watch(int inotify_fd, int wd, jcl_err_t *err);
 void             jcl_shutdown(int sock_fd, int how, jcl_err_t *err);
 struct addrinfo *jcl_getaddrinfo(const char *name, const char *port_str, const struct addrinfo *hints, jcl_err_t *err) WUR;
 void             jcl_bind(int sock_fd, const struct sockaddr *addr, socklen_t addrlen, jcl_err_t *err);
@@ -130,6 +142,7 @@ void             jcl_close(int close_fd, jcl_err_t *err);
 void             jcl_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr, jcl_err_t *err);
 void             jcl_mutex_destroy(pthread_mutex_t *mutex, jcl_err_t *err);
 void             jcl_mutex_trylock(pthread_mutex_t *mutex, jcl_err_t *err);
+void             jcl_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr, jcl_err_t *err);
 void             jcl_cond_destroy(pthread_cond_t *cond, jcl_err_t *err);
 void             jcl_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *time, jcl_err_t *err);
 int              jcl_eventfd(unsigned int initval, int flags, jcl_err_t *err) WUR;
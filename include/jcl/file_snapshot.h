@@ -0,0 +1,62 @@
+#ifndef JFS_FILE_SNAPSHOT_H
+#define JFS_FILE_SNAPSHOT_H
+
+#include "file_walk.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define JFS_FWS_NONE UINT64_MAX
+
+typedef struct jfs_fws      jfs_fws_t;
+typedef struct jfs_fws_dir  jfs_fws_dir_t;
+typedef struct jfs_fws_file jfs_fws_file_t;
+
+// the tables are read straight out of the mapping, every reference is an index or an offset so nothing needs fixing up
+struct jfs_fws_dir {
+    uint64_t parent;     // JFS_FWS_NONE for the start dir
+    uint64_t entry;      // its file in the parent's listing, JFS_FWS_NONE for the start dir
+    uint64_t first_file; // files first_file up to first_file + file_count, sorted by name
+    uint64_t file_count;
+    uint64_t inode;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+};
+
+// size, mtime and mode are zero unless the record was walked with conf stat
+struct jfs_fws_file {
+    uint64_t inode;
+    uint64_t size;
+    int64_t  mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint64_t dir;  // the dir it is for JFS_FW_DIR files, JFS_FWS_NONE otherwise
+    uint64_t name; // offset of its front coded name, only readable through jfs_fws_file_name
+    uint32_t type; // jfs_fw_types_t
+    uint32_t reserved;
+};
+
+// a mapped snapshot, init only checks the header and table bounds so loading costs the same at any size
+struct jfs_fws {
+    uint8_t              *map;
+    size_t                map_size;
+    const char           *start_path; // nul terminated, start_path_len long
+    size_t                start_path_len;
+    struct timespec       started;
+    size_t                dir_count;
+    const jfs_fws_dir_t  *dir_array;
+    size_t                file_count;
+    const jfs_fws_file_t *file_array;
+    const uint8_t        *names;
+    size_t                names_size;
+};
+
+void jfs_fws_save(const jfs_fw_record_t *record, int fd, jfs_err_t *err);
+void jfs_fws_init(jfs_fws_t *snapshot_init, int fd, jfs_err_t *err); // JFS_ERR_FWS_SNAPSHOT when fd isn't a snapshot
+void jfs_fws_free(jfs_fws_t *snapshot_free);
+
+// buf holds NAME_MAX + 1, returns the length
+size_t jfs_fws_file_name(const jfs_fws_t *snapshot, size_t file_index, char *buf, jfs_err_t *err);
+size_t jfs_fws_find(const jfs_fws_t *snapshot, size_t dir_index, const char *name, jfs_err_t *err); // file index, JFS_FWS_NONE when missing
+void   jfs_fws_dir_path(const jfs_fws_t *snapshot, size_t dir_index, jfs_fio_path_buf_t *buf, jfs_err_t *err);
+
+#endif
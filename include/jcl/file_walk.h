@@ -4,39 +4,74 @@
 #include "file_io.h"
 #include <dirent.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
+
+#define JFS_FW_NO_PARENT SIZE_MAX
 
 typedef struct jfs_fw_file jfs_fw_file_t;
 typedef struct jfs_fw_dir  jfs_fw_dir_t;
 
 typedef struct jfs_fw_state  jfs_fw_state_t; // defined in c file
+typedef struct jfs_fw_block  jfs_fw_block_t; // defined in c file
 typedef struct jfs_fw_record jfs_fw_record_t;
+typedef struct jfs_fw_conf   jfs_fw_conf_t;
 
 typedef enum { JFS_FW_REG, JFS_FW_DIR } jfs_fw_types_t;
+typedef enum { JFS_FW_DESCEND, JFS_FW_PRUNE, JFS_FW_STOP } jfs_fw_action_t;
+
+// what a caller watching the tree already knows about a dir of the previous record
+typedef enum {
+    JFS_FW_TRUST_NONE, // checked against its inode and mtime like any other dir
+    JFS_FW_TRUST_DIR,  // listing unchanged, its subdirs still get looked at
+    JFS_FW_TRUST_TREE, // nothing below it changed, copied without touching the filesystem
+} jfs_fw_trust_t;
+
+// dir and path are only valid during the call, dir->parent is the visit number of the parent dir (the start dir is 0)
+typedef jfs_fw_action_t (*jfs_fw_visit_fn)(const jfs_fio_path_buf_t *path, const jfs_fw_dir_t *dir, size_t depth, void *ctx);
 
 struct jfs_fw_state;
 
+// names and file arrays live in the record's blocks, nothing in a dir or file is freed on its own
 struct jfs_fw_file {
-    jfs_fw_types_t type;
-    jfs_fio_name_t name;
-    ino_t          inode;
+    jfs_fw_types_t  type;
+    jfs_fio_name_t  name;
+    ino_t           inode;
+    uint64_t        size;  // size, mtime and mode are only filled in with conf stat
+    struct timespec mtime;
+    mode_t          mode; // zero when the file couldn't be stat'd, e.g. it was removed mid walk
 };
 
+// only the last component is kept, jfs_fw_record_dir_path builds the full path when it's needed
 struct jfs_fw_dir {
-    jfs_fio_path_t path;
-    jfs_fw_file_t *files;
-    size_t         file_count;
+    jfs_fio_name_t  name;   // empty for the start dir
+    size_t          parent; // index into the record's dir_array, JFS_FW_NO_PARENT for the start dir
+    jfs_fw_file_t  *files;
+    size_t          file_count;
+    dev_t           device; // the walk crosses mounts, so a dir is only named by device and inode together
+    ino_t           inode;  // of the dir itself, an incremental walk reuses the listing while all three still match
+    struct timespec mtime;
 };
 
 struct jfs_fw_record {
-    size_t        dir_count;
-    jfs_fw_dir_t *dir_array;
+    jfs_fio_path_t  start_path;
+    struct timespec started; // realtime when the walk began
+    size_t          dir_count;
+    jfs_fw_dir_t   *dir_array;
+    jfs_fw_block_t *blocks; // append only storage for every name and file array
 };
 
-void jfs_fw_file_free(jfs_fw_file_t *file_free);
-void jfs_fw_file_transfer(jfs_fw_file_t *file_init, jfs_fw_file_t *file_free);
+struct jfs_fw_conf {
+    size_t thread_count; // zero for one per online cpu
+    bool   stat;         // statx every file, batched per dir through io_uring when the kernel allows it
 
-void jfs_fw_dir_free(jfs_fw_dir_t *dir_free);
+    const jfs_fw_record_t *previous; // an earlier walk of the same start path, unchanged dirs are copied from it without a readdir
+    const jfs_fw_trust_t  *trust;    // optional, one per dir of previous, a TREE dir must only have TREE subdirs
+};
+
+void jfs_fw_file_transfer(jfs_fw_file_t *file_init, jfs_fw_file_t *file_free);
 void jfs_fw_dir_transfer(jfs_fw_dir_t *dir_init, jfs_fw_dir_t *dir_free);
 
 jfs_fw_state_t *jfs_fw_state_create(const jfs_fio_path_t *start_path, jfs_err_t *err) WUR;
@@ -44,6 +79,15 @@ void            jfs_fw_state_destroy(jfs_fw_state_t *state_move);
 int             jfs_fw_state_step(jfs_fw_state_t *state, jfs_err_t *err) WUR;
 
 void jfs_fw_record_init(jfs_fw_record_t *record_init, jfs_fw_state_t *state_move, jfs_err_t *err);
+// a dir's fd stays open until its last subdir is opened, so each thread holds about one fd per level of the dir it is in,
+// thread_count times the tree depth has to fit under RLIMIT_NOFILE or the walk fails with JFS_ERR_SYS (EMFILE)
+void jfs_fw_walk(jfs_fw_record_t *record_init, const jfs_fio_path_t *start_path, const jfs_fw_conf_t *conf, jfs_err_t *err); // conf can null
+
+// depth first on the calling thread, memory stays around the size of the dirs on the current descent,
+// it holds one fd per level of that descent the same way jfs_fw_walk does
+void jfs_fw_visit(const jfs_fio_path_t *start_path, jfs_fw_visit_fn visit, void *ctx, jfs_err_t *err);
+
+void jfs_fw_record_dir_path(const jfs_fw_record_t *record, size_t dir_index, jfs_fio_path_buf_t *buf, jfs_err_t *err);
 void jfs_fw_record_free(jfs_fw_record_t *record_free);
 
 #endif
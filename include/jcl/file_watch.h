@@ -0,0 +1,31 @@
+#ifndef JFS_FILE_WATCH_H
+#define JFS_FILE_WATCH_H
+
+#include "file_walk.h"
+
+typedef struct jfs_fwt       jfs_fwt_t; // defined in c file
+typedef struct jfs_fwt_event jfs_fwt_event_t;
+
+typedef enum { JFS_FWT_CREATE, JFS_FWT_DELETE, JFS_FWT_MODIFY } jfs_fwt_event_types_t;
+
+// a moved or removed dir reports every entry under its old path as deleted and under its new one as created,
+// modify needs conf stat and is reported when size, mtime or mode changed
+struct jfs_fwt_event {
+    jfs_fwt_event_types_t     type;
+    jfs_fw_types_t            file_type;
+    const jfs_fio_path_buf_t *path; // only valid during the callback
+};
+
+typedef void (*jfs_fwt_event_fn)(const jfs_fwt_event_t *event, void *ctx);
+
+// walks start_path and puts an inotify watch on every dir, conf can null and its previous and trust are ignored
+jfs_fwt_t *jfs_fwt_create(const jfs_fio_path_t *start_path, const jfs_fw_conf_t *conf, jfs_err_t *err) WUR;
+void       jfs_fwt_destroy(jfs_fwt_t *watch_move);
+
+int                    jfs_fwt_fd(const jfs_fwt_t *watch) WUR;     // readable once there are changes, for poll or epoll
+const jfs_fw_record_t *jfs_fwt_record(const jfs_fwt_t *watch) WUR; // valid until the next update
+
+// rescans only the dirs events came in for, plus the ones without a working watch, on_event can null
+void jfs_fwt_update(jfs_fwt_t *watch, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err);
+
+#endif
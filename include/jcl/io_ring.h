@@ -0,0 +1,39 @@
+#ifndef JFS_IO_RING_H
+#define JFS_IO_RING_H
+
+#include "error.h"
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct jfs_ior jfs_ior_t;
+
+// a raw io_uring driven by a single thread, fill sqes, submit them and pop the completions
+struct jfs_ior {
+    int                  fd;
+    unsigned int         entries;
+    unsigned int        *sq_head;
+    unsigned int        *sq_tail;
+    unsigned int        *sq_array;
+    unsigned int         sq_mask;
+    unsigned int         sq_local_tail; // ahead of *sq_tail by the sqes handed out since the last submit
+    unsigned int        *cq_head;
+    unsigned int        *cq_tail;
+    unsigned int         cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_map;
+    size_t               sq_map_size;
+    void                *cq_map;
+    size_t               cq_map_size;
+    size_t               sqes_size;
+};
+
+void jfs_ior_init(jfs_ior_t *ring_init, unsigned int entries, jfs_err_t *err); // JFS_ERR_SYS when the kernel has io_uring off
+void jfs_ior_free(jfs_ior_t *ring_free);
+
+struct io_uring_sqe *jfs_ior_get_sqe(jfs_ior_t *ring) WUR; // zeroed, NULL when the submission queue is full
+void                 jfs_ior_submit_and_wait(jfs_ior_t *ring, unsigned int wait_count, jfs_err_t *err);
+bool                 jfs_ior_pop_cqe(jfs_ior_t *ring, struct io_uring_cqe *cqe_out) WUR; // false when none are ready
+
+#endif
@@ -8,35 +8,109 @@
 #include <stddef.h>
 #include <stdint.h>
 
-typedef struct jfs_lru_conf jfs_lru_conf_t;
-typedef struct jfs_lru_fn   jfs_lru_fn_t;
-typedef struct jfs_lru      jfs_lru_t;
+#define JFS_LRU_MRC_MODULUS ((uint64_t) 1 << 24) // sampling space of the miss ratio curve tracker
+
+typedef struct jfs_lru_conf     jfs_lru_conf_t;
+typedef struct jfs_lru_fn       jfs_lru_fn_t;
+typedef struct jfs_lru_entry    jfs_lru_entry_t;
+typedef struct jfs_lru_stats    jfs_lru_stats_t;
+typedef struct jfs_lru_mrc_conf jfs_lru_mrc_conf_t;
+typedef struct jfs_lru_mrc      jfs_lru_mrc_t;
+typedef struct jfs_lru          jfs_lru_t;
 typedef int (*jfs_lru_cmp_fn)(const void *key, void *slot);
+typedef uint64_t (*jfs_lru_hash_fn)(const void *key);
 typedef void (*jfs_lru_slot_fn)(void *slot, void *ctx);
+typedef size_t (*jfs_lru_save_fn)(const void *slot, void *buf, size_t buf_size, void *ctx); // returns bytes written, 0 skips the slot
+typedef bool (*jfs_lru_load_fn)(void *slot, const void *buf, size_t size, void *ctx);       // false skips the record
 
 struct jfs_lru_fn {
     jfs_lru_cmp_fn  cmp;
     jfs_lru_slot_fn hit;
     jfs_lru_slot_fn miss;
     jfs_lru_slot_fn evict;
+    jfs_lru_hash_fn hash; // can null, filters cmp calls when set
+};
+
+// SHARDS style sampled reuse distances, needs fn.hash and should be given a well distributed one
+struct jfs_lru_mrc_conf {
+    jfs_mlg_component_t *component;    // can null to disable, from jfs_lru_mrc_make_desc
+    uint64_t             threshold;    // key sampled when its hash % JFS_LRU_MRC_MODULUS < threshold
+    size_t               bucket_count; // must match jfs_lru_mrc_make_desc
+    size_t               bucket_width; // cache entries covered by one histogram bucket
 };
 
 struct jfs_lru_conf {
     jfs_mlg_component_t *component;
     jfs_lru_fn_t         fn;
-    void                *evict_ctx; // can null
+    void                *evict_ctx;   // can null
+    uint64_t             cost_budget; // zero for no budget, otherwise bounds the sum of jfs_lru_set_cost
+    jfs_lru_mrc_conf_t   mrc;
+};
+
+// header stored in front of every user slot
+struct jfs_lru_entry {
+    uint64_t expires; // CLOCK_MONOTONIC ns, 0 never expires
+    uint64_t hash;    // fn.hash of the key that filled the slot, 0 without fn.hash
+    uint64_t cost;    // caller supplied through jfs_lru_set_cost
+};
+
+struct jfs_lru_stats {
+    uint64_t hits;
+    uint64_t misses; // includes expired hits
+    uint64_t evictions;
+    uint64_t promotions; // hits that moved an entry to the front
+};
+
+// sampled keys get a stamp per use, the live stamps newer than a key's last one are its reuse distance,
+// counted in O(log sample_capacity) through a fenwick tree over the stamps
+struct jfs_lru_mrc {
+    uint64_t *keys;        // open addressed table of sampled key hashes, table_size slots, NULL when disabled
+    uint64_t *slot_stamps; // per slot, stamp + 1 of the key's last use, 0 when the slot is empty
+    uint64_t *stamp_slots; // per stamp, slot + 1 of the key using it, 0 once the key moved on or was dropped
+    uint64_t *tree;        // fenwick tree over the stamps, 1 for each live one
+    size_t    table_size;  // also the number of stamps, twice the capacity so renumbering is rare
+    size_t    next_stamp;
+    size_t    sample_count;
+    size_t    sample_capacity;
+    uint64_t *buckets; // histogram of reuse distances, distances scaled up by the sample rate
+    size_t    bucket_count;
+    size_t    bucket_width;
+    uint64_t  threshold;
+    uint64_t  cold;  // sampled accesses with no tracked reuse or a distance past the last bucket
+    uint64_t  total; // sampled accesses
 };
 
 struct jfs_lru {
-    jfs_mb_t     mb;
-    size_t       count;
-    jfs_lru_fn_t fn;
-    void        *evict_ctx;
+    jfs_mb_t        mb;
+    size_t          count;
+    jfs_lru_fn_t    fn;
+    void           *evict_ctx;
+    uintptr_t       value_offset;
+    size_t          ttl_count;    // slots with an expiry, sweep is skipped when 0
+    size_t          sweep_cursor; // where the next amortized sweep picks up
+    uint64_t        total_cost;
+    uint64_t        cost_budget;
+    jfs_lru_stats_t stats;
+    jfs_lru_mrc_t   mrc;
 };
 
 jfs_mlg_desc_t jfs_lru_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
 void jfs_lru_init(jfs_lru_t *lru_init, const jfs_lru_conf_t *conf, jfs_err_t *err);
 void jfs_lru_free(jfs_lru_t *lru_move);
 void jfs_lru_access(jfs_lru_t *lru, const void *key, void *user_ctx);
+// hits, misses and recency order match jfs_lru_access per key in order, but the expiry sweep runs and the clock is read
+// once per batch of up to 64 keys, so ttl entries can be evicted by the sweep later than with single accesses
+void jfs_lru_access_many(jfs_lru_t *lru, const void *const *keys, size_t key_count, void *const *user_ctxs);
+void jfs_lru_set_ttl(jfs_lru_t *lru, void *slot, uint64_t ttl_ns); // call from hit/miss, 0 clears the expiry
+void jfs_lru_set_cost(jfs_lru_t *lru, void *slot, uint64_t cost);  // call from hit/miss, over budget entries are evicted after it returns
+
+jfs_mlg_desc_t jfs_lru_mrc_make_desc(size_t sample_capacity, size_t bucket_count, jfs_err_t *err);
+double         jfs_lru_mrc_miss_ratio(const jfs_lru_t *lru, size_t capacity); // estimated miss ratio of a cache holding capacity entries
+void           jfs_lru_reset_stats(jfs_lru_t *lru);
+
+// snapshots are written most recent first and loaded in that order into an empty cache, JFS_ERR_ARG otherwise,
+// the loading cache must use the same fn.hash as the one that saved
+void jfs_lru_save(const jfs_lru_t *lru, int fd, size_t record_max, jfs_lru_save_fn save, void *ctx, jfs_err_t *err);
+void jfs_lru_load(jfs_lru_t *lru, int fd, jfs_lru_load_fn load, void *ctx, jfs_err_t *err);
 
 #endif
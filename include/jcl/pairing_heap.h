@@ -0,0 +1,47 @@
+#ifndef JFS_PAIRING_HEAP_H
+#define JFS_PAIRING_HEAP_H
+
+#include "free_list.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct jfs_pheap      jfs_pheap_t;
+typedef struct jfs_pheap_node jfs_pheap_node_t;
+typedef struct jfs_pheap_conf jfs_pheap_conf_t;
+
+typedef int (*jfs_pheap_cmp_fn)(const void *a, const void *b); // < 0 when a comes out first
+
+// children hang off child as a sibling list, prev is the left sibling or the parent for the leftmost child
+struct jfs_pheap_node {
+    jfs_pheap_node_t *child;
+    jfs_pheap_node_t *next;
+    jfs_pheap_node_t *prev;
+};
+
+struct jfs_pheap_conf {
+    jfs_mlg_component_t *component; // from jfs_pheap_make_desc
+    jfs_pheap_cmp_fn     cmp;
+    size_t               value_size; // zero for the whole padded slot, otherwise the obj_size given to make_desc
+};
+
+struct jfs_pheap {
+    jfs_pheap_node_t *root; // NULL when empty
+    size_t            count;
+    jfs_pheap_cmp_fn  cmp;
+    uintptr_t         value_offset;
+    size_t            value_size;
+    jfs_fl_t          free_list;
+};
+
+jfs_mlg_desc_t jfs_pheap_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
+void           jfs_pheap_init(jfs_pheap_t *heap_init, const jfs_pheap_conf_t *conf, jfs_err_t *err);
+
+// the node doubles as the handle, valid until its value is popped or removed
+jfs_pheap_node_t *jfs_pheap_push(jfs_pheap_t *heap, const void *value, jfs_err_t *err) WUR; // O(1)
+void              jfs_pheap_pop(jfs_pheap_t *heap, void *value_out, jfs_err_t *err);       // O(log n) amortized
+void             *jfs_pheap_peek(const jfs_pheap_t *heap) WUR; // NULL when empty, the value stays in the heap
+void             *jfs_pheap_value(const jfs_pheap_t *heap, const jfs_pheap_node_t *node) WUR;
+void              jfs_pheap_update(jfs_pheap_t *heap, jfs_pheap_node_t *node, const void *value); // cheapest when the value decreases
+void              jfs_pheap_remove(jfs_pheap_t *heap, jfs_pheap_node_t *node_move, void *value_out);
+
+#endif
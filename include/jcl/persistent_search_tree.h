@@ -0,0 +1,67 @@
+#ifndef JFS_PERSISTENT_SEARCH_TREE_H
+#define JFS_PERSISTENT_SEARCH_TREE_H
+
+#include "free_list.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JFS_PST_MAX_HEIGHT 96 // an AVL tree of 2^64 nodes stays below 93 levels
+
+typedef struct jfs_pst          jfs_pst_t;
+typedef struct jfs_pst_node     jfs_pst_node_t;
+typedef struct jfs_pst_conf     jfs_pst_conf_t;
+typedef struct jfs_pst_snapshot jfs_pst_snapshot_t;
+typedef struct jfs_pst_iter     jfs_pst_iter_t;
+
+typedef int (*jfs_pst_cmp_fn)(const void *key, const void *value);
+
+// no parent links so a node can sit under any number of versions, writes copy shared nodes on the way down
+struct jfs_pst_node {
+    jfs_pst_node_t *left;
+    jfs_pst_node_t *right;
+    uint32_t        refs; // parents and roots pointing here, freed at 0
+    uint32_t        height;
+};
+
+struct jfs_pst_conf {
+    jfs_mlg_component_t *component; // from jfs_pst_make_desc, obj_count should cover what snapshots keep alive
+    jfs_pst_cmp_fn       cmp;
+    size_t               value_size; // zero for the whole padded slot, otherwise the obj_size given to make_desc
+};
+
+struct jfs_pst {
+    jfs_pst_node_t *root; // NULL when empty
+    size_t          count;
+    jfs_pst_cmp_fn  cmp;
+    uintptr_t       value_offset;
+    size_t          value_size;
+    jfs_fl_t        free_list;
+};
+
+// read only view of the tree when it was taken, later writes never show up in it
+struct jfs_pst_snapshot {
+    jfs_pst_node_t *root;
+    size_t          count;
+};
+
+// in order walk of the live tree or a snapshot, a live walk is invalidated by any put/take
+struct jfs_pst_iter {
+    const jfs_pst_t *tree;
+    jfs_pst_node_t  *stack[JFS_PST_MAX_HEIGHT];
+    size_t           depth;
+};
+
+jfs_mlg_desc_t jfs_pst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
+void           jfs_pst_init(jfs_pst_t *tree_init, const jfs_pst_conf_t *conf, jfs_err_t *err);
+void           jfs_pst_puts(jfs_pst_t *tree, const void *value, const void *key, jfs_err_t *err); // dupes go after equal keys
+void           jfs_pst_takes(jfs_pst_t *tree, void *value_out, const void *key, jfs_err_t *err);
+void          *jfs_pst_lookup(const jfs_pst_t *tree, const void *key) WUR; // NULL when missing, the value stays in the tree
+
+void jfs_pst_snapshot(jfs_pst_t *tree, jfs_pst_snapshot_t *snapshot_init); // O(1)
+void jfs_pst_snapshot_release(jfs_pst_t *tree, jfs_pst_snapshot_t *snapshot_move);
+
+void  jfs_pst_iter_init(jfs_pst_iter_t *iter_init, const jfs_pst_t *tree, const jfs_pst_snapshot_t *snapshot); // NULL snapshot walks the live tree
+void *jfs_pst_iter_next(jfs_pst_iter_t *iter) WUR;                                                              // NULL at the end
+
+#endif
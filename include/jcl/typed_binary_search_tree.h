@@ -0,0 +1,81 @@
+#ifndef JFS_TYPED_BINARY_SEARCH_TREE_H
+#define JFS_TYPED_BINARY_SEARCH_TREE_H
+
+#include "binary_search_tree.h"
+#include <stdint.h>
+#include <string.h>
+
+// comparisons for cmp_expr, byte keys should pass a constant size so memcmp is expanded inline
+#define JFS_BST_CMP_INT(a, b)         (((a) > (b)) - ((a) < (b)))
+#define JFS_BST_CMP_BYTES(a, b, size) memcmp((a), (b), (size))
+
+// emits name_puts/name_takes/name_lookup over a plain jfs_bst_t with the search and comparison inlined,
+// key_expr reads a key_type out of `const type *value` and cmp_expr compares key_types `a` and `b` like a cmp fn,
+// init the tree with .cmp = name_cmp (key passed as const key_type *) so the generic calls still agree
+#define JFS_BST_DEFINE(name, type, key_type, key_expr, cmp_expr)                                                   \
+    static inline key_type name##_key(const type *value) {                                                         \
+        return (key_expr);                                                                                         \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline int name##_key_cmp(key_type a, key_type b) {                                                     \
+        return (cmp_expr);                                                                                         \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline int name##_cmp(const void *key, const void *value) {                                             \
+        return name##_key_cmp(*(const key_type *) key, name##_key(value));                                         \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline type *name##_value(const jfs_bst_t *tree, const jfs_bst_node_t *node) {                          \
+        return (type *) (((uint8_t *) node) + tree->value_offset);                                                 \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline jfs_bst_location_t name##_find(const jfs_bst_t *tree, key_type key) {                            \
+        jfs_bst_location_t location = {.node = tree->nil, .parent = tree->nil, .parent_cmp = 0};                   \
+                                                                                                                   \
+        /* same cache checks as jfs_bst_puts so both keep previous useful */                                       \
+        const jfs_bst_node_t *const cached[] = {tree->cache.previous, tree->cache.largest, tree->cache.smallest};   \
+        for (size_t i = 0; i < sizeof(cached) / sizeof(cached[0]); i++) {                                          \
+            if (cached[i] != tree->nil && name##_key_cmp(key, name##_key(name##_value(tree, cached[i]))) == 0) {   \
+                location.node = (jfs_bst_node_t *) cached[i];                                                      \
+                return location;                                                                                   \
+            }                                                                                                      \
+        }                                                                                                          \
+                                                                                                                   \
+        location.node = tree->root;                                                                                \
+        while (location.node != tree->nil) {                                                                       \
+            const int cmp_result = name##_key_cmp(key, name##_key(name##_value(tree, location.node)));             \
+            if (cmp_result == 0) return location;                                                                  \
+                                                                                                                   \
+            location.parent = location.node;                                                                       \
+            location.parent_cmp = cmp_result;                                                                      \
+            location.node = cmp_result < 0 ? location.node->left : location.node->right;                           \
+        }                                                                                                          \
+        return location;                                                                                           \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline void name##_puts(jfs_bst_t *tree, const type *value, jfs_err_t *err) {                           \
+        const jfs_bst_location_t location = name##_find(tree, name##_key(value));                                  \
+        jfs_bst_puts_at(tree, value, &location, err);                                                              \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline void name##_takes(jfs_bst_t *tree, type *value_out, key_type key, jfs_err_t *err) {              \
+        VOID_FAIL_IF(tree->root == tree->nil, JFS_ERR_EMPTY);                                                      \
+        const jfs_bst_location_t location = name##_find(tree, key);                                                \
+        VOID_FAIL_IF(location.node == tree->nil, JFS_ERR_BST_BAD_KEY);                                             \
+        jfs_bst_takes_node(tree, value_out, location.node);                                                        \
+    }                                                                                                              \
+                                                                                                                   \
+    static inline type *name##_lookup(const jfs_bst_t *tree, key_type key) {                                       \
+        const jfs_bst_location_t location = name##_find(tree, key);                                                \
+        return location.node != tree->nil ? name##_value(tree, location.node) : NULL;                              \
+    }
+
+// integer member keys
+#define JFS_BST_DEFINE_INT(name, type, key_type, member) \
+    JFS_BST_DEFINE(name, type, key_type, value->member, JFS_BST_CMP_INT(a, b))
+
+// fixed length byte array member keys, the key is a pointer to the first byte
+#define JFS_BST_DEFINE_BYTES(name, type, member) \
+    JFS_BST_DEFINE(name, type, const uint8_t *, value->member, JFS_BST_CMP_BYTES(a, b, sizeof(((type *) NULL)->member)))
+
+#endif
@@ -0,0 +1,560 @@
+#include "b_plus_tree.h"
+#include "memory_layout_generator.h"
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BPT_CACHE_LINE   ((size_t) 64)
+#define BPT_MIN_CAPACITY 4 // keeps every min fill at least 2 so borrow/merge always has something to work with
+
+typedef struct bpt_layout bpt_layout_t;
+
+struct bpt_layout {
+    size_t    value_stride;
+    uintptr_t values_offset;
+    uintptr_t children_offset;
+    uintptr_t separators_offset;
+    size_t    leaf_capacity;
+    size_t    inner_capacity;
+};
+
+static bool   bpt_layout_init(bpt_layout_t *layout_init, size_t value_size, size_t align, size_t node_size);
+static size_t bpt_node_estimate(const bpt_layout_t *layout, size_t obj_count);
+
+static jfs_bpt_node_t  *bpt_node_alloc(jfs_bpt_t *tree, bool is_leaf);
+static uint8_t         *bpt_values(const jfs_bpt_t *tree, const jfs_bpt_node_t *node);
+static uint8_t         *bpt_separators(const jfs_bpt_t *tree, const jfs_bpt_node_t *node);
+static jfs_bpt_node_t **bpt_children(const jfs_bpt_t *tree, const jfs_bpt_node_t *node);
+static size_t           bpt_min_count(const jfs_bpt_t *tree, const jfs_bpt_node_t *node);
+
+static size_t          bpt_search(const jfs_bpt_t *tree, const uint8_t *base, size_t count, const void *key, bool upper);
+static jfs_bpt_node_t *bpt_find_leaf(const jfs_bpt_t *tree, const void *key);
+static jfs_bpt_node_t *bpt_locate(const jfs_bpt_t *tree, const void *key, size_t *index_out);
+static size_t          bpt_child_index(const jfs_bpt_t *tree, const jfs_bpt_node_t *parent, const jfs_bpt_node_t *child);
+
+static void bpt_split_leaf(jfs_bpt_t *tree, jfs_bpt_node_t *leaf, size_t index, const void *value);
+static void bpt_insert_parent(jfs_bpt_t *tree, jfs_bpt_node_t *left, const void *separator, jfs_bpt_node_t *right);
+static void bpt_split_inner(jfs_bpt_t *tree, jfs_bpt_node_t *node, size_t index, const void *separator, jfs_bpt_node_t *right);
+static void bpt_copy_merged(uint8_t *dest, const uint8_t *src, size_t stride, size_t from, size_t to, size_t index, const void *item, size_t item_size);
+
+static void bpt_leaf_remove(jfs_bpt_t *tree, jfs_bpt_node_t *leaf, size_t index, void *value_out);
+static void bpt_rebalance(jfs_bpt_t *tree, jfs_bpt_node_t *node);
+static void bpt_borrow_left(jfs_bpt_t *tree, jfs_bpt_node_t *node, jfs_bpt_node_t *left, jfs_bpt_node_t *parent, size_t index);
+static void bpt_borrow_right(jfs_bpt_t *tree, jfs_bpt_node_t *node, jfs_bpt_node_t *right, jfs_bpt_node_t *parent, size_t index);
+static void bpt_merge(jfs_bpt_t *tree, jfs_bpt_node_t *left, jfs_bpt_node_t *right, jfs_bpt_node_t *parent, size_t separator_index);
+
+jfs_mlg_desc_t jfs_bpt_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, size_t node_size, jfs_err_t *err) {
+    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = obj_count};
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc), JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    const size_t align = obj_align > alignof(jfs_bpt_node_t) ? obj_align : alignof(jfs_bpt_node_t);
+    const size_t node_align = align > BPT_CACHE_LINE ? align : BPT_CACHE_LINE;
+    node_size = jfs_mlg_align_size(node_size != 0 ? node_size : JFS_BPT_DEFAULT_NODE_SIZE, node_align);
+
+    // big values can't fit BPT_MIN_CAPACITY in the requested size so the node grows to hold them
+    bpt_layout_t layout = {0};
+    while (!bpt_layout_init(&layout, obj_size, align, node_size)) {
+        node_size *= 2;
+    }
+
+    return (jfs_mlg_desc_t) {.align = align, .size = node_size, .count = bpt_node_estimate(&layout, obj_count)};
+}
+
+void jfs_bpt_init(jfs_bpt_t *tree_init, const jfs_bpt_conf_t *conf, jfs_err_t *err) {
+    assert(conf != NULL);
+    VOID_FAIL_IF(conf->cmp == NULL || conf->value_size == 0, JFS_ERR_BAD_CONF);
+
+    jfs_fl_init(&tree_init->free_list, conf->component, err);
+    VOID_CHECK_ERR;
+
+    bpt_layout_t layout = {0};
+    const bool   valid = bpt_layout_init(&layout, conf->value_size, conf->component->desc.align, conf->component->desc.size);
+    VOID_FAIL_IF(!valid, JFS_ERR_BAD_CONF);
+
+    tree_init->root = NULL;
+    tree_init->first_leaf = NULL;
+    tree_init->last_leaf = NULL;
+    tree_init->cmp = conf->cmp;
+    tree_init->value_size = conf->value_size;
+    tree_init->value_stride = layout.value_stride;
+    tree_init->values_offset = layout.values_offset;
+    tree_init->children_offset = layout.children_offset;
+    tree_init->separators_offset = layout.separators_offset;
+    tree_init->leaf_capacity = layout.leaf_capacity;
+    tree_init->inner_capacity = layout.inner_capacity;
+    tree_init->height = 0;
+    tree_init->count = 0;
+}
+
+void jfs_bpt_puts(jfs_bpt_t *tree, const void *value, const void *key, jfs_err_t *err) {
+    // worst case every level splits and a new root is added
+    VOID_FAIL_IF(tree->free_list.count < tree->height + 1, JFS_ERR_FULL);
+
+    if (tree->root == NULL) {
+        jfs_bpt_node_t *const leaf = bpt_node_alloc(tree, true);
+        tree->root = leaf;
+        tree->first_leaf = leaf;
+        tree->last_leaf = leaf;
+        tree->height = 1;
+    }
+
+    jfs_bpt_node_t *const leaf = bpt_find_leaf(tree, key);
+    const size_t          index = bpt_search(tree, bpt_values(tree, leaf), leaf->count, key, true); // after any dupes
+
+    if (leaf->count < tree->leaf_capacity) {
+        uint8_t *const slot = bpt_values(tree, leaf) + (index * tree->value_stride);
+        memmove(slot + tree->value_stride, slot, (leaf->count - index) * tree->value_stride);
+        memcpy(slot, value, tree->value_size);
+        leaf->count += 1;
+    } else {
+        bpt_split_leaf(tree, leaf, index, value);
+    }
+
+    tree->count += 1;
+}
+
+void jfs_bpt_takes(jfs_bpt_t *tree, void *value_out, const void *key, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->root == NULL, JFS_ERR_EMPTY);
+
+    size_t                index = 0;
+    jfs_bpt_node_t *const leaf = bpt_locate(tree, key, &index);
+    VOID_FAIL_IF(leaf == NULL, JFS_ERR_BPT_BAD_KEY);
+    VOID_FAIL_IF(tree->cmp(key, bpt_values(tree, leaf) + (index * tree->value_stride)) != 0, JFS_ERR_BPT_BAD_KEY);
+
+    bpt_leaf_remove(tree, leaf, index, value_out);
+}
+
+void jfs_bpt_get_largest(jfs_bpt_t *tree, void *value_out, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->root == NULL, JFS_ERR_EMPTY);
+    bpt_leaf_remove(tree, tree->last_leaf, tree->last_leaf->count - 1, value_out);
+}
+
+void jfs_bpt_get_smallest(jfs_bpt_t *tree, void *value_out, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->root == NULL, JFS_ERR_EMPTY);
+    bpt_leaf_remove(tree, tree->first_leaf, 0, value_out);
+}
+
+void *jfs_bpt_lookup(const jfs_bpt_t *tree, const void *key) {
+    if (tree->root == NULL) return NULL;
+
+    size_t                index = 0;
+    jfs_bpt_node_t *const leaf = bpt_locate(tree, key, &index);
+    if (leaf == NULL) return NULL;
+
+    uint8_t *const value = bpt_values(tree, leaf) + (index * tree->value_stride);
+    return tree->cmp(key, value) == 0 ? value : NULL;
+}
+
+void jfs_bpt_iter_init(jfs_bpt_iter_t *iter_init, const jfs_bpt_t *tree) {
+    iter_init->tree = tree;
+    iter_init->leaf = tree->first_leaf;
+    iter_init->index = 0;
+}
+
+void jfs_bpt_iter_lower_bound(jfs_bpt_iter_t *iter_init, const jfs_bpt_t *tree, const void *key) {
+    iter_init->tree = tree;
+    iter_init->index = 0;
+    iter_init->leaf = tree->root != NULL ? bpt_locate(tree, key, &iter_init->index) : NULL;
+}
+
+void *jfs_bpt_iter_next(jfs_bpt_iter_t *iter) {
+    if (iter->leaf == NULL) return NULL;
+
+    void *const value = bpt_values(iter->tree, iter->leaf) + (iter->index * iter->tree->value_stride);
+    iter->index += 1;
+    if (iter->index == iter->leaf->count) {
+        iter->leaf = iter->leaf->next;
+        iter->index = 0;
+    }
+
+    return value;
+}
+
+static bool bpt_layout_init(bpt_layout_t *layout_init, size_t value_size, size_t align, size_t node_size) {
+    const size_t header_size = jfs_mlg_align_size(sizeof(jfs_bpt_node_t), align);
+    if (node_size <= header_size + sizeof(jfs_bpt_node_t *)) return false;
+
+    layout_init->value_stride = jfs_mlg_align_size(value_size, align);
+    layout_init->values_offset = header_size;
+    layout_init->leaf_capacity = (node_size - header_size) / layout_init->value_stride;
+
+    // inner nodes hold capacity + 1 children and then capacity separators, aligned for the values
+    layout_init->children_offset = header_size;
+    size_t capacity = (node_size - header_size - sizeof(jfs_bpt_node_t *)) / (sizeof(jfs_bpt_node_t *) + layout_init->value_stride);
+    while (capacity > 0) {
+        const size_t separators_offset = jfs_mlg_align_size(header_size + ((capacity + 1) * sizeof(jfs_bpt_node_t *)), align);
+        if (separators_offset + (capacity * layout_init->value_stride) <= node_size) {
+            layout_init->separators_offset = separators_offset;
+            break;
+        }
+        capacity -= 1;
+    }
+    layout_init->inner_capacity = capacity;
+
+    return layout_init->leaf_capacity >= BPT_MIN_CAPACITY && layout_init->inner_capacity >= BPT_MIN_CAPACITY;
+}
+
+// sized for every node at its minimum fill plus the nodes a put may need up front
+static size_t bpt_node_estimate(const bpt_layout_t *layout, size_t obj_count) {
+    const size_t leaf_min = layout->leaf_capacity / 2;
+    const size_t inner_min_children = (layout->inner_capacity / 2) + 1;
+
+    size_t level = (obj_count + leaf_min - 1) / leaf_min;
+    size_t total = level;
+    size_t height = 1;
+    while (level > 1) {
+        level = (level + inner_min_children - 1) / inner_min_children;
+        total += level;
+        height += 1;
+    }
+
+    return total + height + 1;
+}
+
+static jfs_bpt_node_t *bpt_node_alloc(jfs_bpt_t *tree, bool is_leaf) {
+    jfs_bpt_node_t *const node = jfs_fl_alloc(&tree->free_list);
+    assert(node != NULL); // callers check the free list count up front
+
+    node->parent = NULL;
+    node->prev = NULL;
+    node->next = NULL;
+    node->count = 0;
+    node->is_leaf = is_leaf;
+    return node;
+}
+
+static uint8_t *bpt_values(const jfs_bpt_t *tree, const jfs_bpt_node_t *node) {
+    assert(node->is_leaf);
+    return jfs_mlg_apply_offset((uint8_t *) node, tree->values_offset);
+}
+
+static uint8_t *bpt_separators(const jfs_bpt_t *tree, const jfs_bpt_node_t *node) {
+    assert(!node->is_leaf);
+    return jfs_mlg_apply_offset((uint8_t *) node, tree->separators_offset);
+}
+
+static jfs_bpt_node_t **bpt_children(const jfs_bpt_t *tree, const jfs_bpt_node_t *node) {
+    assert(!node->is_leaf);
+    return jfs_mlg_apply_offset((uint8_t *) node, tree->children_offset);
+}
+
+static size_t bpt_min_count(const jfs_bpt_t *tree, const jfs_bpt_node_t *node) {
+    return node->is_leaf ? tree->leaf_capacity / 2 : tree->inner_capacity / 2;
+}
+
+// upper finds the first entry > key, otherwise the first entry >= key
+static size_t bpt_search(const jfs_bpt_t *tree, const uint8_t *base, size_t count, const void *key, bool upper) {
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high) {
+        const size_t mid = low + ((high - low) / 2);
+        const int    cmp_result = tree->cmp(key, base + (mid * tree->value_stride));
+        if (cmp_result > 0 || (upper && cmp_result == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+// descends into the leftmost child that can hold key, dupes may continue into the leaves after it
+static jfs_bpt_node_t *bpt_find_leaf(const jfs_bpt_t *tree, const void *key) {
+    jfs_bpt_node_t *node = tree->root;
+
+    while (!node->is_leaf) {
+        const size_t index = bpt_search(tree, bpt_separators(tree, node), node->count, key, false);
+        node = bpt_children(tree, node)[index];
+    }
+
+    return node;
+}
+
+// first value >= key, NULL when every value is smaller
+static jfs_bpt_node_t *bpt_locate(const jfs_bpt_t *tree, const void *key, size_t *index_out) {
+    jfs_bpt_node_t *const leaf = bpt_find_leaf(tree, key);
+    const size_t          index = bpt_search(tree, bpt_values(tree, leaf), leaf->count, key, false);
+
+    if (index < leaf->count) {
+        *index_out = index;
+        return leaf;
+    }
+
+    *index_out = 0;
+    return leaf->next; // only the root leaf can be empty and it has no next
+}
+
+static size_t bpt_child_index(const jfs_bpt_t *tree, const jfs_bpt_node_t *parent, const jfs_bpt_node_t *child) {
+    jfs_bpt_node_t *const *const children = bpt_children(tree, parent);
+
+    size_t index = 0;
+    while (children[index] != child) {
+        index += 1;
+        assert(index <= parent->count);
+    }
+    return index;
+}
+
+// the split is done in place, the right half is copied out before the left one shifts to make room
+static void bpt_split_leaf(jfs_bpt_t *tree, jfs_bpt_node_t *leaf, size_t index, const void *value) {
+    const size_t stride = tree->value_stride;
+    const size_t total = tree->leaf_capacity + 1;
+    const size_t left_count = total / 2;
+
+    uint8_t *const        values = bpt_values(tree, leaf);
+    jfs_bpt_node_t *const right = bpt_node_alloc(tree, true);
+    bpt_copy_merged(bpt_values(tree, right), values, stride, left_count, total, index, value, tree->value_size);
+    if (index < left_count) {
+        memmove(values + ((index + 1) * stride), values + (index * stride), (left_count - 1 - index) * stride);
+        memcpy(values + (index * stride), value, tree->value_size);
+    }
+    leaf->count = left_count;
+    right->count = total - left_count;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != NULL) {
+        leaf->next->prev = right;
+    } else {
+        tree->last_leaf = right;
+    }
+    leaf->next = right;
+
+    bpt_insert_parent(tree, leaf, bpt_values(tree, right), right);
+}
+
+// separator is copied before anything it could point into is modified
+static void bpt_insert_parent(jfs_bpt_t *tree, jfs_bpt_node_t *left, const void *separator, jfs_bpt_node_t *right) {
+    jfs_bpt_node_t *const parent = left->parent;
+
+    if (parent == NULL) { // the root split so the tree grows a level
+        jfs_bpt_node_t *const root = bpt_node_alloc(tree, false);
+        bpt_children(tree, root)[0] = left;
+        bpt_children(tree, root)[1] = right;
+        memcpy(bpt_separators(tree, root), separator, tree->value_size);
+        root->count = 1;
+        left->parent = root;
+        right->parent = root;
+        tree->root = root;
+        tree->height += 1;
+        return;
+    }
+
+    right->parent = parent;
+    const size_t index = bpt_child_index(tree, parent, left);
+
+    if (parent->count == tree->inner_capacity) {
+        bpt_split_inner(tree, parent, index, separator, right);
+        return;
+    }
+
+    const size_t           stride = tree->value_stride;
+    uint8_t *const         separators = bpt_separators(tree, parent);
+    jfs_bpt_node_t **const children = bpt_children(tree, parent);
+    memmove(separators + ((index + 1) * stride), separators + (index * stride), (parent->count - index) * stride);
+    memmove(&children[index + 2], &children[index + 1], (parent->count - index) * sizeof(*children));
+    memcpy(separators + (index * stride), separator, tree->value_size);
+    children[index + 1] = right;
+    parent->count += 1;
+}
+
+// in place like the leaf split, the middle separator moves up instead of being kept in either half,
+// it waits in the sibling's first unused slot since both halves have room past their count
+static void bpt_split_inner(jfs_bpt_t *tree, jfs_bpt_node_t *node, size_t index, const void *separator, jfs_bpt_node_t *right) {
+    const size_t stride = tree->value_stride;
+    const size_t total = tree->inner_capacity + 1; // separators once the new one is in
+    const size_t middle = total / 2;
+    const size_t right_count = total - middle - 1;
+
+    uint8_t *const         separators = bpt_separators(tree, node);
+    jfs_bpt_node_t **const children = bpt_children(tree, node);
+    jfs_bpt_node_t *const  sibling = bpt_node_alloc(tree, false);
+    uint8_t *const         sibling_separators = bpt_separators(tree, sibling);
+    jfs_bpt_node_t **const sibling_children = bpt_children(tree, sibling);
+
+    bpt_copy_merged(sibling_separators, separators, stride, middle + 1, total, index, separator, tree->value_size);
+    bpt_copy_merged(sibling_separators + (right_count * stride), separators, stride, middle, middle + 1, index, separator, tree->value_size);
+    bpt_copy_merged((uint8_t *) sibling_children, (const uint8_t *) children, sizeof(*children), middle + 1, total + 1, index + 1, &right,
+                    sizeof(*children));
+
+    if (index < middle) {
+        memmove(separators + ((index + 1) * stride), separators + (index * stride), (middle - 1 - index) * stride);
+        memcpy(separators + (index * stride), separator, tree->value_size);
+        memmove(&children[index + 2], &children[index + 1], (middle - 1 - index) * sizeof(*children));
+        children[index + 1] = right;
+    }
+    node->count = middle;
+    sibling->count = right_count;
+
+    for (size_t i = 0; i <= middle; i++) {
+        children[i]->parent = node;
+    }
+    for (size_t i = 0; i <= right_count; i++) {
+        sibling_children[i]->parent = sibling;
+    }
+
+    bpt_insert_parent(tree, node, sibling_separators + (right_count * stride), sibling);
+}
+
+// dest gets entries from up to to of src with item inserted at index, dest can't overlap src
+static void bpt_copy_merged(uint8_t *dest, const uint8_t *src, size_t stride, size_t from, size_t to, size_t index, const void *item, size_t item_size) {
+    const size_t before_end = index < to ? index : to;
+    if (from < before_end) {
+        memcpy(dest, src + (from * stride), (before_end - from) * stride);
+        dest += (before_end - from) * stride;
+    }
+    if (from <= index && index < to) {
+        memcpy(dest, item, item_size);
+        dest += stride;
+    }
+    const size_t after_start = index + 1 > from ? index + 1 : from;
+    if (after_start < to) memcpy(dest, src + ((after_start - 1) * stride), (to - after_start) * stride);
+}
+
+static void bpt_leaf_remove(jfs_bpt_t *tree, jfs_bpt_node_t *leaf, size_t index, void *value_out) {
+    assert(index < leaf->count);
+
+    uint8_t *const slot = bpt_values(tree, leaf) + (index * tree->value_stride);
+    memcpy(value_out, slot, tree->value_size);
+    memmove(slot, slot + tree->value_stride, (leaf->count - index - 1) * tree->value_stride);
+    leaf->count -= 1;
+    tree->count -= 1;
+
+    bpt_rebalance(tree, leaf);
+}
+
+static void bpt_rebalance(jfs_bpt_t *tree, jfs_bpt_node_t *node) {
+    if (node == tree->root) {
+        if (node->count > 0) return;
+
+        if (node->is_leaf) { // last value is gone
+            tree->root = NULL;
+            tree->first_leaf = NULL;
+            tree->last_leaf = NULL;
+            tree->height = 0;
+        } else { // a root with one child gives the tree up to that child
+            tree->root = bpt_children(tree, node)[0];
+            tree->root->parent = NULL;
+            tree->height -= 1;
+        }
+        jfs_fl_free(&tree->free_list, node);
+        return;
+    }
+
+    const size_t min_count = bpt_min_count(tree, node);
+    if (node->count >= min_count) return;
+
+    jfs_bpt_node_t *const        parent = node->parent;
+    jfs_bpt_node_t *const *const children = bpt_children(tree, parent);
+    const size_t                 index = bpt_child_index(tree, parent, node);
+    jfs_bpt_node_t *const        left = index > 0 ? children[index - 1] : NULL;
+    jfs_bpt_node_t *const        right = index < parent->count ? children[index + 1] : NULL;
+
+    if (left != NULL && left->count > min_count) {
+        bpt_borrow_left(tree, node, left, parent, index);
+    } else if (right != NULL && right->count > min_count) {
+        bpt_borrow_right(tree, node, right, parent, index);
+    } else {
+        if (left != NULL) {
+            bpt_merge(tree, left, node, parent, index - 1);
+        } else {
+            bpt_merge(tree, node, right, parent, index);
+        }
+        bpt_rebalance(tree, parent);
+    }
+}
+
+static void bpt_borrow_left(jfs_bpt_t *tree, jfs_bpt_node_t *node, jfs_bpt_node_t *left, jfs_bpt_node_t *parent, size_t index) {
+    const size_t   stride = tree->value_stride;
+    uint8_t *const parent_separator = bpt_separators(tree, parent) + ((index - 1) * stride);
+
+    if (node->is_leaf) {
+        uint8_t *const values = bpt_values(tree, node);
+        memmove(values + stride, values, node->count * stride);
+        memcpy(values, bpt_values(tree, left) + ((left->count - 1) * stride), stride);
+        memcpy(parent_separator, values, tree->value_size);
+    } else {
+        uint8_t *const         separators = bpt_separators(tree, node);
+        jfs_bpt_node_t **const children = bpt_children(tree, node);
+        jfs_bpt_node_t *const  moved = bpt_children(tree, left)[left->count];
+
+        memmove(separators + stride, separators, node->count * stride);
+        memmove(&children[1], &children[0], (node->count + 1) * sizeof(*children));
+        memcpy(separators, parent_separator, tree->value_size);
+        children[0] = moved;
+        moved->parent = node;
+        memcpy(parent_separator, bpt_separators(tree, left) + ((left->count - 1) * stride), tree->value_size);
+    }
+
+    left->count -= 1;
+    node->count += 1;
+}
+
+static void bpt_borrow_right(jfs_bpt_t *tree, jfs_bpt_node_t *node, jfs_bpt_node_t *right, jfs_bpt_node_t *parent, size_t index) {
+    const size_t   stride = tree->value_stride;
+    uint8_t *const parent_separator = bpt_separators(tree, parent) + (index * stride);
+
+    if (node->is_leaf) {
+        uint8_t *const right_values = bpt_values(tree, right);
+        memcpy(bpt_values(tree, node) + (node->count * stride), right_values, stride);
+        memmove(right_values, right_values + stride, (right->count - 1) * stride);
+        memcpy(parent_separator, right_values, tree->value_size);
+    } else {
+        uint8_t *const         right_separators = bpt_separators(tree, right);
+        jfs_bpt_node_t **const right_children = bpt_children(tree, right);
+        jfs_bpt_node_t *const  moved = right_children[0];
+
+        memcpy(bpt_separators(tree, node) + (node->count * stride), parent_separator, tree->value_size);
+        bpt_children(tree, node)[node->count + 1] = moved;
+        moved->parent = node;
+        memcpy(parent_separator, right_separators, tree->value_size);
+        memmove(right_separators, right_separators + stride, (right->count - 1) * stride);
+        memmove(&right_children[0], &right_children[1], right->count * sizeof(*right_children));
+    }
+
+    right->count -= 1;
+    node->count += 1;
+}
+
+// right is folded into left and dropped from the parent along with the separator between them
+static void bpt_merge(jfs_bpt_t *tree, jfs_bpt_node_t *left, jfs_bpt_node_t *right, jfs_bpt_node_t *parent, size_t separator_index) {
+    const size_t stride = tree->value_stride;
+
+    if (left->is_leaf) {
+        memcpy(bpt_values(tree, left) + (left->count * stride), bpt_values(tree, right), right->count * stride);
+        left->count += right->count;
+
+        left->next = right->next;
+        if (right->next != NULL) {
+            right->next->prev = left;
+        } else {
+            tree->last_leaf = left;
+        }
+    } else {
+        uint8_t *const         separators = bpt_separators(tree, left);
+        jfs_bpt_node_t **const children = bpt_children(tree, left);
+        jfs_bpt_node_t **const right_children = bpt_children(tree, right);
+
+        memcpy(separators + (left->count * stride), bpt_separators(tree, parent) + (separator_index * stride), tree->value_size);
+        memcpy(separators + ((left->count + 1) * stride), bpt_separators(tree, right), right->count * stride);
+        memcpy(&children[left->count + 1], right_children, (right->count + 1) * sizeof(*children));
+        for (size_t i = 0; i <= right->count; i++) {
+            right_children[i]->parent = left;
+        }
+        left->count += right->count + 1;
+    }
+
+    uint8_t *const         parent_separators = bpt_separators(tree, parent);
+    jfs_bpt_node_t **const parent_children = bpt_children(tree, parent);
+    memmove(parent_separators + (separator_index * stride),
+            parent_separators + ((separator_index + 1) * stride),
+            (parent->count - separator_index - 1) * stride);
+    memmove(&parent_children[separator_index + 1], &parent_children[separator_index + 2], (parent->count - separator_index - 1) * sizeof(*parent_children));
+    parent->count -= 1;
+
+    jfs_fl_free(&tree->free_list, right);
+}
@@ -2,6 +2,7 @@
 #include "memory_layout_generator.h"
 #include <assert.h>
 #include <iso646.h>
+#include <sched.h>
 #include <stdalign.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -9,54 +10,111 @@
 #define BST_RED   0
 #define BST_BLACK 1
 
-typedef struct bst_location bst_location_t;
+#define BST_READ_MAX_STEPS 128 // deeper than any red-black tree in memory, past it a reader is on a torn path
+#define BST_READ_MAX_SPINS 10  // a reader waiting out a write doubles its pauses up to 1024, then yields the cpu
 
-struct bst_location {
-    jfs_bst_node_t *node;
-    jfs_bst_node_t *parent;
-    int             parent_cmp;
+#if defined(__x86_64__) || defined(__i386__)
+#define BST_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define BST_CPU_RELAX() __asm__ volatile("yield")
+#else
+#define BST_CPU_RELAX() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+#define BST_CHUNK_MIN_SIZE  ((size_t) 4096) // 4 kb
+#define BST_CHUNK_MIN_NODES 64              // default chunks grow until they hold this many nodes
+
+typedef struct bst_run bst_run_t;
+
+// header at the start of every chunk pulled from the pool, its nodes follow at chunk_offset
+struct jfs_bst_chunk {
+    jfs_bst_chunk_t *next;
+    jfs_bst_chunk_t *prev;
+    jfs_fl_t         free_list;
+};
+
+// sorted input consumed front to back by the bulk builder
+struct bst_run {
+    const uint8_t     *values;
+    const void *const *keys;
+    size_t             count;
+    size_t             index;
 };
 
+static jfs_mlg_desc_t bst_make_desc(size_t header_size, size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err);
+
 static void           *bst_container_value(const jfs_bst_t *tree, const jfs_bst_node_t *node) WUR;
-static jfs_bst_node_t *bst_container_node(const jfs_bst_t *tree, const void *value);
 static void           *bst_pack_node(const jfs_bst_t *tree, jfs_bst_node_t *node, const void *value);
 static void            bst_unpack_node(const jfs_bst_t *tree, const jfs_bst_node_t *node, void *value_out);
 static void            bst_attach_node(jfs_bst_node_t *base_node, jfs_bst_node_t *attach_node);
 static jfs_bst_node_t *bst_detach_node(jfs_bst_node_t *base_node);
+static size_t          bst_key_count(const jfs_bst_node_t *node);
 
 static jfs_bst_node_t *bst_check_cache(const jfs_bst_t *tree, const void *key) WUR;
-static bst_location_t  bst_find(const jfs_bst_t *tree, const void *key);
-static void            bst_insert(jfs_bst_t *tree, jfs_bst_node_t *node, const bst_location_t *location);
-static void            bst_delete(jfs_bst_t *tree, jfs_bst_node_t *node);
+static jfs_bst_location_t bst_find(const jfs_bst_t *tree, const void *key);
+static void            bst_insert(jfs_bst_t *tree, jfs_bst_node_t *node, const jfs_bst_location_t *location);
 static void            bst_detach_and_delete(jfs_bst_t *tree, void *value_out, jfs_bst_node_t *node);
 
-static void bst_update_cache_insert(jfs_bst_t *tree, const bst_location_t *location);
+static jfs_bst_node_t *bst_bound(const jfs_bst_t *tree, const void *key, bool inclusive);
+static void            bst_read_backoff(size_t *round);
+static void            bst_iter_start(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree, jfs_bst_node_t *node);
+
+static size_t          bst_run_validate(jfs_bst_t *tree, const bst_run_t *run, jfs_err_t *err);
+static jfs_bst_node_t *bst_run_next_group(jfs_bst_t *tree, bst_run_t *run);
+static jfs_bst_node_t *bst_build_subtree(jfs_bst_t *tree, bst_run_t *run, jfs_bst_node_t *parent, size_t count, size_t depth, size_t red_depth);
+
+static void bst_write_begin(jfs_bst_t *tree);
+static void bst_write_end(jfs_bst_t *tree);
+static void bst_retire(jfs_bst_t *tree, jfs_bst_node_t *node);
+static void bst_reclaim(jfs_bst_t *tree);
+
+static void            bst_pool_init(jfs_bst_t *tree_init, const jfs_bst_conf_t *conf, jfs_err_t *err);
+static void            bst_reserve(jfs_bst_t *tree, size_t count, jfs_err_t *err);
+static jfs_bst_node_t *bst_alloc_node(jfs_bst_t *tree);
+static void            bst_free_node(jfs_bst_t *tree, jfs_bst_node_t *node_move);
+static void            bst_chunk_grow(jfs_bst_t *tree, jfs_err_t *err);
+static void            bst_chunk_drain(jfs_bst_t *tree, jfs_bst_chunk_t *chunk_move);
+static void            bst_chunk_link(jfs_bst_chunk_t **list, jfs_bst_chunk_t *chunk);
+static void            bst_chunk_unlink(jfs_bst_chunk_t **list, jfs_bst_chunk_t *chunk);
+
+static void bst_update_cache_insert(jfs_bst_t *tree, const jfs_bst_node_t *node, const jfs_bst_location_t *location);
 static void bst_update_cache_delete(jfs_bst_t *tree, const jfs_bst_node_t *node);
 
-static void bst_fixup_insert(jfs_bst_t *tree, jfs_bst_node_t *node);
-static void bst_fixup_delete(jfs_bst_t *tree, jfs_bst_node_t *node);
-
-static void            bst_rotate_left(jfs_bst_t *tree, jfs_bst_node_t *x);
-static void            bst_rotate_right(jfs_bst_t *tree, jfs_bst_node_t *x);
-static void            bst_transplant(jfs_bst_t *tree, jfs_bst_node_t *old, jfs_bst_node_t *new);
-static jfs_bst_node_t *bst_local_minimum(const jfs_bst_t *tree, jfs_bst_node_t *start);
-static jfs_bst_node_t *bst_local_maximum(const jfs_bst_t *tree, jfs_bst_node_t *start);
-
 static jfs_bst_node_t *bst_parent(const jfs_bst_node_t *node);
 static void            bst_set_parent(jfs_bst_node_t *node, jfs_bst_node_t *parent);
 static uint64_t        bst_color(const jfs_bst_node_t *node);
 static void            bst_set_color(jfs_bst_node_t *node, uint64_t color);
 static void            bst_set_parent_color(jfs_bst_node_t *node, jfs_bst_node_t *parent, uint64_t color);
 
-jfs_mlg_desc_t jfs_bst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
-    jfs_mlg_desc_t node_desc = {.align = alignof(jfs_bst_node_t), .size = sizeof(jfs_bst_node_t), .count = 1};
-    assert(jfs_mlg_valid_desc(&node_desc));
+static size_t bst_size(const jfs_bst_t *tree, const jfs_bst_node_t *node);
+static void   bst_set_size(const jfs_bst_t *tree, jfs_bst_node_t *node, size_t size);
+static void   bst_resize_path(const jfs_bst_t *tree, jfs_bst_node_t *node, size_t delta);
+static void   bst_rotate_sizes(const jfs_bst_t *tree, jfs_bst_node_t *x, jfs_bst_node_t *y, jfs_bst_node_t *moved);
+static void   bst_lift_sizes(const jfs_bst_t *tree, jfs_bst_node_t *node, jfs_bst_node_t *next);
+
+#define RBT_PREFIX                     bst_
+#define RBT_TREE                       jfs_bst_t
+#define RBT_LINK                       jfs_bst_node_t *
+#define RBT_NIL(tree)                  ((tree)->nil)
+#define RBT_LEFT(tree, n)              ((n)->left)
+#define RBT_RIGHT(tree, n)             ((n)->right)
+#define RBT_PARENT(tree, n)            bst_parent(n)
+#define RBT_SET_PARENT(tree, n, p)     bst_set_parent((n), (p))
+#define RBT_COLOR(tree, n)             bst_color(n)
+#define RBT_SET_COLOR(tree, n, c)      bst_set_color((n), (c))
+#define RBT_RED                        BST_RED
+#define RBT_BLACK                      BST_BLACK
+#define RBT_ROTATED(tree, x, y, moved) bst_rotate_sizes((tree), (x), (y), (moved))
+#define RBT_DELETING(tree, node)       bst_resize_path((tree), (node), (size_t) -1) // node holds no dupes by now
+#define RBT_LIFTED(tree, node, next)   bst_lift_sizes((tree), (node), (next))
+#include "red_black_tree.inc"
 
-    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = obj_count};
-    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc), JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+jfs_mlg_desc_t jfs_bst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    return bst_make_desc(sizeof(jfs_bst_node_t), obj_size, obj_align, obj_count, err);
+}
 
-    jfs_mlg_append(&node_desc, &obj_desc); // we can reverse out the offset so we don't save it
-    return node_desc;
+jfs_mlg_desc_t jfs_bst_make_ranked_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    return bst_make_desc(sizeof(jfs_bst_node_t) + sizeof(size_t), obj_size, obj_align, obj_count, err);
 }
 
 void jfs_bst_init(jfs_bst_t *tree_init, const jfs_bst_conf_t *conf, jfs_err_t *err) {
@@ -75,37 +133,77 @@ void jfs_bst_init(jfs_bst_t *tree_init, const jfs_bst_conf_t *conf, jfs_err_t *e
     tree_init->cache.previous = tree_init->nil;
     tree_init->root = tree_init->nil;
 
-    tree_init->value_offset = jfs_mlg_align_size(sizeof(jfs_bst_node_t), conf->component->desc.align);
+    // a plain desc can be as big as a ranked one for a smaller object, only the value size tells them apart
+    VOID_FAIL_IF(conf->ranked && conf->value_size == 0, JFS_ERR_BAD_CONF);
+    const size_t header_size = sizeof(jfs_bst_node_t) + (conf->ranked ? sizeof(size_t) : 0);
+    tree_init->size_offset = conf->ranked ? sizeof(jfs_bst_node_t) : 0;
+    tree_init->value_offset = jfs_mlg_align_size(header_size, conf->component->desc.align);
+    VOID_FAIL_IF(tree_init->value_offset >= conf->component->desc.size, JFS_ERR_BAD_CONF);
     tree_init->value_size = conf->component->desc.size - tree_init->value_offset;
+    if (conf->value_size != 0) {
+        VOID_FAIL_IF(conf->value_size > tree_init->value_size, JFS_ERR_BAD_CONF);
+        tree_init->value_size = conf->value_size;
+    }
+
+    tree_init->readers = conf->readers;
+    tree_init->reader_count = conf->readers != NULL ? conf->reader_count : 0;
+    atomic_init(&tree_init->seq, 0);
+    tree_init->write_depth = 0;
+    tree_init->retired = NULL;
+    tree_init->retired_tail = NULL;
+
+    tree_init->component_begin = conf->component->ptr;
+    tree_init->component_end = tree_init->component_begin + (conf->component->desc.size * conf->component->desc.count);
+    bst_pool_init(tree_init, conf, err);
+    VOID_CHECK_ERR;
 
     tree_init->cmp = conf->cmp;
     VOID_FAIL_IF(tree_init->cmp == NULL, JFS_ERR_BAD_CONF);
 }
 
+void jfs_bst_release_pool(jfs_bst_t *tree_move) {
+    jfs_bst_chunk_t *const lists[] = {tree_move->open_chunks, tree_move->full_chunks, tree_move->spare_chunk};
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        for (jfs_bst_chunk_t *chunk = lists[i]; chunk != NULL;) {
+            jfs_bst_chunk_t *const next = chunk->next;
+            tree_move->pool.free(chunk, tree_move->pool.chunk_size, tree_move->pool.ctx);
+            chunk = next;
+        }
+    }
+
+    tree_move->open_chunks = NULL;
+    tree_move->full_chunks = NULL;
+    tree_move->spare_chunk = NULL;
+    tree_move->chunk_free_count = 0;
+}
+
 void jfs_bst_puts(jfs_bst_t *tree, const void *value, const void *key, jfs_err_t *err) {
-    VOID_FAIL_IF(tree->free_list.count == 0, JFS_ERR_FULL);
-    jfs_bst_node_t *const node = jfs_fl_alloc(&tree->free_list);
-    void *const           packed_value = bst_pack_node(tree, node, value);
+    // look to see if the key matches a node in the cache before searching the tree
+    jfs_bst_location_t location = {.node = bst_check_cache(tree, key), .parent = tree->nil, .parent_cmp = 0};
+    if (location.node == tree->nil) location = bst_find(tree, key);
+    jfs_bst_puts_at(tree, value, &location, err);
+}
 
-    // look to see if the key matches a node in the cache
-    jfs_bst_node_t *const cached_node = bst_check_cache(tree, key);
-    if (cached_node != tree->nil) {
-        tree->attach(bst_container_value(tree, cached_node), packed_value);
-        tree->cache.previous = cached_node;
-        return;
-    }
+void jfs_bst_puts_at(jfs_bst_t *tree, const void *value, const jfs_bst_location_t *location, jfs_err_t *err) {
+    bst_reserve(tree, 1, err);
+    VOID_CHECK_ERR;
+    jfs_bst_node_t *const node = bst_alloc_node(tree);
+    bst_pack_node(tree, node, value);
+    node->list = NULL;
 
-    // find the node in the tree
-    bst_location_t location = bst_find(tree, key);
+    bst_write_begin(tree);
 
-    if (location.node != tree->nil) { // key is a dupe
-        tree->attach(bst_container_value(tree, location.node), packed_value);
+    if (location->node != tree->nil) { // key is a dupe
+        bst_attach_node(location->node, node);
+        bst_resize_path(tree, location->node, 1);
+        tree->cache.previous = location->node;
     } else { // key is not a dupe
-        bst_insert(tree, node, &location);
-        bst_update_cache_insert(tree, &location);
+        bst_insert(tree, node, location);
+        bst_update_cache_insert(tree, node, location);
+        tree->cache.previous = node; // since it was a cache miss we update this cache
     }
 
-    tree->cache.previous = node; // since it was a cache miss we update this cache
+    bst_write_end(tree);
 }
 
 void jfs_bst_takes(jfs_bst_t *tree, void *value_out, const void *key, jfs_err_t *err) {
@@ -113,16 +211,253 @@ void jfs_bst_takes(jfs_bst_t *tree, void *value_out, const void *key, jfs_err_t
 
     jfs_bst_node_t *const cached_node = bst_check_cache(tree, key);
     if (cached_node != tree->nil) {
-        bst_unpack_node(tree, cached_node, value_out);
+        bst_detach_and_delete(tree, value_out, cached_node);
         return; // we found the node in the cache so we are done
     }
 
-    bst_location_t location = bst_find(tree, key);
+    jfs_bst_location_t location = bst_find(tree, key);
     VOID_FAIL_IF(location.node == tree->nil, JFS_ERR_BST_BAD_KEY);
 
     bst_detach_and_delete(tree, value_out, location.node);
 }
 
+void jfs_bst_takes_node(jfs_bst_t *tree, void *value_out, jfs_bst_node_t *node) {
+    assert(node != tree->nil);
+    bst_detach_and_delete(tree, value_out, node);
+}
+
+void jfs_bst_build(jfs_bst_t *tree, const void *values, const void *const *keys, size_t count, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->root != tree->nil, JFS_ERR_ARG);
+    if (count == 0) return;
+
+    bst_run_t    run = {.values = values, .keys = keys, .count = count, .index = 0};
+    const size_t group_count = bst_run_validate(tree, &run, err);
+    VOID_CHECK_ERR;
+
+    // every level above the deepest is full, so coloring only the deepest level red keeps the black heights equal
+    size_t full_depth = 0;
+    while (((size_t) 1 << (full_depth + 1)) - 1 <= group_count) {
+        full_depth += 1;
+    }
+    const size_t red_depth = (((size_t) 1 << full_depth) - 1 == group_count) ? 0 : full_depth + 1;
+
+    bst_write_begin(tree);
+    tree->root = bst_build_subtree(tree, &run, tree->nil, group_count, 1, red_depth);
+    assert(run.index == run.count);
+
+    tree->cache.smallest = bst_local_minimum(tree, tree->root);
+    tree->cache.largest = bst_local_maximum(tree, tree->root);
+    tree->cache.previous = tree->nil;
+    bst_write_end(tree);
+}
+
+void jfs_bst_merge(jfs_bst_t *tree, const void *values, const void *const *keys, size_t count, jfs_err_t *err) {
+    if (tree->root == tree->nil) {
+        jfs_bst_build(tree, values, keys, count, err);
+        return;
+    }
+
+    bst_run_t run = {.values = values, .keys = keys, .count = count, .index = 0};
+    (void) bst_run_validate(tree, &run, err);
+    VOID_CHECK_ERR;
+
+    bst_write_begin(tree); // one write for the whole merge, the puts below nest inside it
+    for (size_t i = 0; i < count; i++) {
+        const void *const value = run.values + (i * tree->value_size);
+        const int         largest_cmp = tree->cmp(keys[i], bst_container_value(tree, tree->cache.largest));
+
+        if (largest_cmp < 0) { // inside the existing range so it needs a real search
+            jfs_bst_puts(tree, value, keys[i], err);
+            assert(*err == JFS_OK); // validate reserved the nodes
+            continue;
+        }
+
+        jfs_bst_node_t *const node = bst_alloc_node(tree);
+        bst_pack_node(tree, node, value);
+        node->list = NULL;
+
+        if (largest_cmp == 0) {
+            bst_attach_node(tree->cache.largest, node);
+            bst_resize_path(tree, tree->cache.largest, 1);
+        } else { // past the end of the tree so it always hangs off the largest node
+            const jfs_bst_location_t location = {.node = tree->nil, .parent = tree->cache.largest, .parent_cmp = 1};
+            bst_insert(tree, node, &location);
+            tree->cache.largest = node;
+        }
+    }
+
+    tree->cache.previous = tree->nil;
+    bst_write_end(tree);
+}
+
+size_t jfs_bst_count(const jfs_bst_t *tree, const void *key) {
+    jfs_bst_location_t location = {.node = bst_check_cache(tree, key), .parent = tree->nil, .parent_cmp = 0};
+    if (location.node == tree->nil) location = bst_find(tree, key);
+    return location.node != tree->nil ? bst_key_count(location.node) : 0;
+}
+
+size_t jfs_bst_take_all(jfs_bst_t *tree, const void *key, jfs_bst_take_fn take, void *ctx) {
+    jfs_bst_location_t location = {.node = bst_check_cache(tree, key), .parent = tree->nil, .parent_cmp = 0};
+    if (location.node == tree->nil) location = bst_find(tree, key);
+    if (location.node == tree->nil) return 0;
+
+    jfs_bst_node_t *const node = location.node;
+    const size_t          count = bst_key_count(node);
+
+    // same order as the iterator, the tree node first then its dupes
+    bst_write_begin(tree);
+    take(bst_container_value(tree, node), ctx);
+    for (jfs_bst_node_t *dupe = node->list; dupe != NULL;) {
+        jfs_bst_node_t *const next = dupe->list;
+        take(bst_container_value(tree, dupe), ctx);
+        bst_free_node(tree, dupe);
+        dupe = next;
+    }
+    node->list = NULL;
+    bst_resize_path(tree, node, (size_t) 1 - count); // leaves the one value bst_delete takes off
+
+    bst_update_cache_delete(tree, node);
+    bst_delete(tree, node);
+    bst_retire(tree, node);
+    bst_write_end(tree);
+
+    return count;
+}
+
+void *jfs_bst_lookup(const jfs_bst_t *tree, const void *key) {
+    const jfs_bst_node_t *const cached_node = bst_check_cache(tree, key);
+    if (cached_node != tree->nil) return bst_container_value(tree, cached_node);
+
+    const jfs_bst_location_t location = bst_find(tree, key);
+    if (location.node == tree->nil) return NULL;
+    return bst_container_value(tree, location.node);
+}
+
+size_t jfs_bst_size(const jfs_bst_t *tree) {
+    assert(tree->size_offset != 0);
+    return bst_size(tree, tree->root);
+}
+
+void *jfs_bst_select(const jfs_bst_t *tree, size_t index) {
+    assert(tree->size_offset != 0);
+
+    jfs_bst_node_t *node = tree->root;
+    while (node != tree->nil) {
+        const size_t left_size = bst_size(tree, node->left);
+        const size_t own_size = bst_size(tree, node) - left_size - bst_size(tree, node->right);
+
+        if (index < left_size) {
+            node = node->left;
+        } else if (index < left_size + own_size) { // lands in this node or its dupe list
+            for (index -= left_size; index > 0; index--) {
+                node = node->list;
+            }
+            return bst_container_value(tree, node);
+        } else {
+            index -= left_size + own_size;
+            node = node->right;
+        }
+    }
+
+    return NULL;
+}
+
+size_t jfs_bst_rank(const jfs_bst_t *tree, const void *key) {
+    assert(tree->size_offset != 0);
+
+    size_t          rank = 0;
+    jfs_bst_node_t *node = tree->root;
+    while (node != tree->nil) {
+        const int cmp_result = tree->cmp(key, bst_container_value(tree, node));
+        if (cmp_result <= 0) {
+            if (cmp_result == 0) return rank + bst_size(tree, node->left);
+            node = node->left;
+        } else {
+            rank += bst_size(tree, node) - bst_size(tree, node->right);
+            node = node->right;
+        }
+    }
+
+    return rank;
+}
+
+bool jfs_bst_read_lookup(const jfs_bst_t *tree, jfs_bst_reader_t *reader, const void *key, void *value_out) {
+    jfs_bst_t *const seq_tree = (jfs_bst_t *) tree; // the atomics are the only thing touched through it
+    size_t           round = 0;
+
+    for (;;) {
+        // publish before rechecking so the writer either sees us or we see its seq move
+        const uint_fast64_t seq = atomic_load(&seq_tree->seq);
+        atomic_store(&reader->active, seq + 1);
+        if ((seq & 1) != 0 || atomic_load(&seq_tree->seq) != seq) {
+            // a write is in progress, step back instead of hammering its seq line, nothing is held so reclaim isn't blocked
+            atomic_store_explicit(&reader->active, 0, memory_order_release);
+            bst_read_backoff(&round);
+            continue;
+        }
+
+        bool            found = false;
+        jfs_bst_node_t *node = tree->root;
+        for (size_t steps = 0; node != tree->nil && steps < BST_READ_MAX_STEPS; steps++) {
+            const int cmp_result = tree->cmp(key, bst_container_value(tree, node));
+            if (cmp_result == 0) {
+                bst_unpack_node(tree, node, value_out); // may be torn, only trusted once seq checks out
+                found = true;
+                break;
+            }
+            node = cmp_result < 0 ? node->left : node->right;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&seq_tree->seq, memory_order_relaxed) == seq) {
+            atomic_store_explicit(&reader->active, 0, memory_order_release);
+            return found;
+        }
+    }
+}
+
+void jfs_bst_iter_init(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree) {
+    bst_iter_start(iter_init, tree, tree->cache.smallest);
+}
+
+void jfs_bst_iter_lower_bound(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree, const void *key) {
+    bst_iter_start(iter_init, tree, bst_bound(tree, key, true));
+}
+
+void jfs_bst_iter_upper_bound(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree, const void *key) {
+    bst_iter_start(iter_init, tree, bst_bound(tree, key, false));
+}
+
+void *jfs_bst_iter_next(jfs_bst_iter_t *iter) {
+    jfs_bst_node_t *const current = iter->current;
+    if (current == NULL) return NULL;
+
+    // walk the dupe list of a tree node before moving on to its successor
+    if (current->list != NULL) {
+        iter->current = current->list;
+    } else {
+        iter->node = bst_successor(iter->tree, iter->node);
+        iter->current = iter->node != iter->tree->nil ? iter->node : NULL;
+    }
+
+    return bst_container_value(iter->tree, current);
+}
+
+void jfs_bst_visit_range(const jfs_bst_t *tree, const void *low_key, const void *high_key, jfs_bst_visit_fn visit, void *ctx) {
+    jfs_bst_iter_t iter = {0};
+    if (low_key != NULL) {
+        jfs_bst_iter_lower_bound(&iter, tree, low_key);
+    } else {
+        jfs_bst_iter_init(&iter, tree);
+    }
+
+    void *value = NULL;
+    while ((value = jfs_bst_iter_next(&iter)) != NULL) {
+        if (high_key != NULL && tree->cmp(high_key, value) < 0) return;
+        if (!visit(value, ctx)) return;
+    }
+}
+
 void jfs_bst_get_largest(jfs_bst_t *tree, void *value_out, jfs_err_t *err) {
     VOID_FAIL_IF(tree->cache.largest == tree->nil, JFS_ERR_EMPTY);
     bst_detach_and_delete(tree, value_out, tree->cache.largest);
@@ -133,12 +468,33 @@ void jfs_bst_get_smallest(jfs_bst_t *tree, void *value_out, jfs_err_t *err) {
     bst_detach_and_delete(tree, value_out, tree->cache.smallest);
 }
 
-static void *bst_container_value(const jfs_bst_t *tree, const jfs_bst_node_t *node) {
-    return jfs_mlg_apply_offset((uint8_t *) node, tree->value_offset);
+// header_size covers the node links and the rank size when there is one
+static jfs_mlg_desc_t bst_make_desc(size_t header_size, size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    jfs_mlg_desc_t node_desc = {.align = alignof(jfs_bst_node_t), .size = header_size, .count = 1};
+    assert(jfs_mlg_valid_desc(&node_desc));
+
+    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = 1};
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc) || obj_count == 0, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    jfs_mlg_append(&node_desc, &obj_desc); // we can reverse out the offset so we don't save it
+    node_desc.size = jfs_mlg_align_size(node_desc.size, node_desc.align); // every node in the component stays aligned
+    node_desc.count = obj_count;
+    return node_desc;
 }
 
-static jfs_bst_node_t *bst_container_node(const jfs_bst_t *tree, const void *value) {
-    return (jfs_bst_node_t *) (((uint8_t *) value) - tree->value_offset);
+static void bst_read_backoff(size_t *round) {
+    if (*round >= BST_READ_MAX_SPINS) {
+        sched_yield();
+        return;
+    }
+    for (size_t i = 0; i < ((size_t) 1 << *round); i++) {
+        BST_CPU_RELAX();
+    }
+    *round += 1;
+}
+
+static void *bst_container_value(const jfs_bst_t *tree, const jfs_bst_node_t *node) {
+    return jfs_mlg_apply_offset((uint8_t *) node, tree->value_offset);
 }
 
 static void *bst_pack_node(const jfs_bst_t *tree, jfs_bst_node_t *node, const void *value) {
@@ -152,7 +508,9 @@ static void bst_unpack_node(const jfs_bst_t *tree, const jfs_bst_node_t *node, v
     memcpy(value_out, value_ptr, tree->value_size);
 }
 
+// dupes never use their tree links, the first dupe in a list keeps the list length in parent_color
 static void bst_attach_node(jfs_bst_node_t *base_node, jfs_bst_node_t *attach_node) {
+    attach_node->parent_color = base_node->list != NULL ? base_node->list->parent_color + 1 : 1;
     attach_node->list = base_node->list;
     base_node->list = attach_node;
 }
@@ -161,9 +519,92 @@ static jfs_bst_node_t *bst_detach_node(jfs_bst_node_t *base_node) {
 
     jfs_bst_node_t *ret = base_node->list;
     base_node->list = base_node->list->list;
+    if (base_node->list != NULL) base_node->list->parent_color = ret->parent_color - 1;
     return ret;
 }
 
+static size_t bst_key_count(const jfs_bst_node_t *node) {
+    return 1 + (node->list != NULL ? (size_t) node->list->parent_color : 0);
+}
+
+// checks the run is sorted and reserves a node for every value, returns how many distinct keys it holds
+static size_t bst_run_validate(jfs_bst_t *tree, const bst_run_t *run, jfs_err_t *err) {
+    size_t group_count = run->count > 0 ? 1 : 0;
+    for (size_t i = 1; i < run->count; i++) {
+        const int cmp_result = tree->cmp(run->keys[i], run->values + ((i - 1) * tree->value_size));
+        VAL_FAIL_IF(cmp_result < 0, JFS_ERR_ARG, 0);
+        if (cmp_result > 0) group_count += 1;
+    }
+
+    bst_reserve(tree, run->count, err);
+    VAL_CHECK_ERR(0);
+    return group_count;
+}
+
+// packs the next distinct key into a node and chains any equal values after it as dupes
+static jfs_bst_node_t *bst_run_next_group(jfs_bst_t *tree, bst_run_t *run) {
+    assert(run->index < run->count);
+
+    jfs_bst_node_t *const head = bst_alloc_node(tree);
+    bst_pack_node(tree, head, run->values + (run->index * tree->value_size));
+    head->list = NULL;
+    const void *const head_key = run->keys[run->index];
+    run->index += 1;
+
+    while (run->index < run->count && tree->cmp(head_key, run->values + (run->index * tree->value_size)) == 0) {
+        jfs_bst_node_t *const dupe = bst_alloc_node(tree);
+        bst_pack_node(tree, dupe, run->values + (run->index * tree->value_size));
+        bst_attach_node(head, dupe);
+        run->index += 1;
+    }
+
+    return head;
+}
+
+// in order construction so the run is read once, halves differ by at most one node at every level
+static jfs_bst_node_t *bst_build_subtree(jfs_bst_t *tree, bst_run_t *run, jfs_bst_node_t *parent, size_t count, size_t depth, size_t red_depth) {
+    if (count == 0) return tree->nil;
+
+    const size_t          left_count = count / 2;
+    jfs_bst_node_t *const left = bst_build_subtree(tree, run, tree->nil, left_count, depth + 1, red_depth);
+
+    const size_t          group_start = run->index;
+    jfs_bst_node_t *const node = bst_run_next_group(tree, run);
+    const size_t          group_size = run->index - group_start;
+    bst_set_parent_color(node, parent, depth == red_depth ? BST_RED : BST_BLACK);
+
+    node->left = left;
+    if (left != tree->nil) bst_set_parent(left, node);
+    node->right = bst_build_subtree(tree, run, node, count - left_count - 1, depth + 1, red_depth);
+    bst_set_size(tree, node, bst_size(tree, left) + group_size + bst_size(tree, node->right));
+
+    return node;
+}
+
+// inclusive finds the first node >= key (lower bound), otherwise the first node > key (upper bound)
+static jfs_bst_node_t *bst_bound(const jfs_bst_t *tree, const void *key, bool inclusive) {
+    jfs_bst_node_t *node = tree->root;
+    jfs_bst_node_t *bound = tree->nil;
+
+    while (node != tree->nil) {
+        const int cmp_result = tree->cmp(key, bst_container_value(tree, node));
+        if (cmp_result < 0 || (inclusive && cmp_result == 0)) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return bound;
+}
+
+static void bst_iter_start(jfs_bst_iter_t *iter_init, const jfs_bst_t *tree, jfs_bst_node_t *node) {
+    iter_init->tree = tree;
+    iter_init->node = node;
+    iter_init->current = node != tree->nil ? node : NULL;
+}
+
 static jfs_bst_node_t *bst_check_cache(const jfs_bst_t *tree, const void *key) {
     if (tree->cache.previous != tree->nil) {
         const void *const previous_value = bst_container_value(tree, tree->cache.previous);
@@ -183,11 +624,11 @@ static jfs_bst_node_t *bst_check_cache(const jfs_bst_t *tree, const void *key) {
     return tree->nil;
 }
 
-static bst_location_t bst_find(const jfs_bst_t *tree, const void *key) {
+static jfs_bst_location_t bst_find(const jfs_bst_t *tree, const void *key) {
     assert(tree != NULL);
     assert(key != NULL);
 
-    bst_location_t location = {.node = tree->root, .parent = tree->nil, .parent_cmp = 0};
+    jfs_bst_location_t location = {.node = tree->root, .parent = tree->nil, .parent_cmp = 0};
 
     while (location.node != tree->nil) {
         const void *node_value = bst_container_value(tree, location.node);
@@ -209,312 +650,261 @@ static bst_location_t bst_find(const jfs_bst_t *tree, const void *key) {
     return location;
 }
 
-static void bst_insert(jfs_bst_t *tree, jfs_bst_node_t *node, const bst_location_t *location) {
+static void bst_insert(jfs_bst_t *tree, jfs_bst_node_t *node, const jfs_bst_location_t *location) {
     assert(location->node == tree->nil); // we don't handle dupes here
 
     node->left = tree->nil;
     node->right = tree->nil;
     bst_set_parent_color(node, location->parent, BST_RED);
+    bst_set_size(tree, node, 1);
+    if (tree->reader_count != 0) atomic_thread_fence(memory_order_release); // readers that find the node see it filled in
 
     if (location->parent == tree->nil) {
         assert(tree->root == tree->nil);
         tree->root = node;
     } else {
         assert(location->parent_cmp != 0);
-        if (location->parent_cmp == -1) {
+        if (location->parent_cmp < 0) {
             location->parent->left = node;
         } else {
             location->parent->right = node;
         }
     }
 
+    bst_resize_path(tree, location->parent, 1);
     bst_fixup_insert(tree, node);
 }
 
-static void bst_delete(jfs_bst_t *tree, jfs_bst_node_t *node) {
-    assert(node != tree->nil); // must have something to delete
-
-    jfs_bst_node_t *replacement = tree->nil;
-    uint64_t        deleted_color = bst_color(node);
+static void bst_detach_and_delete(jfs_bst_t *tree, void *value_out, jfs_bst_node_t *node) {
+    assert(tree != NULL);
+    assert(tree->root != tree->nil); // tree can't be empty
 
-    if (node->left == tree->nil) {
-        replacement = node->right;
-        bst_transplant(tree, node, node->right);
-    } else if (node->right == tree->nil) {
-        replacement = node->left;
-        bst_transplant(tree, node, node->left);
-    } else {
-        jfs_bst_node_t *next_largest = bst_local_minimum(tree, node->right);
-        deleted_color = bst_color(next_largest);
-        replacement = next_largest->right;
-
-        if (next_largest != node->right) {
-            bst_transplant(tree, next_largest, next_largest->right);
-            next_largest->right = node->right;
-            bst_set_parent(next_largest->right, next_largest);
-        } else {
-            bst_set_parent(replacement, next_largest);
-        }
+    jfs_bst_node_t *const detach_node = bst_detach_node(node);
+    bst_unpack_node(tree, detach_node, value_out); // value_out has been loaded
 
-        bst_transplant(tree, node, next_largest);
-        next_largest->left = node->left;
-        bst_set_parent(next_largest->left, next_largest);
-        bst_set_color(next_largest, bst_color(node));
+    bst_write_begin(tree);
+    if (detach_node == node) { // the detach is detaching the node linked on the tree
+        bst_update_cache_delete(tree, node);
+        bst_delete(tree, node);
+        bst_retire(tree, node);
+    } else { // dupes are never reached by readers so they go straight back
+        bst_resize_path(tree, node, (size_t) -1);
+        bst_free_node(tree, detach_node);
     }
+    bst_write_end(tree);
+}
 
-    if (deleted_color == BST_BLACK) {
-        bst_fixup_delete(tree, replacement);
-    }
+static void bst_write_begin(jfs_bst_t *tree) {
+    if (tree->reader_count == 0) return;
+    if (tree->write_depth++ > 0) return;
+
+    atomic_store_explicit(&tree->seq, atomic_load_explicit(&tree->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release); // odd seq is visible before any change to the tree
 }
 
-static void bst_detach_and_delete(jfs_bst_t *tree, void *value_out, jfs_bst_node_t *node) {
-    assert(tree != NULL);
-    assert(tree->root != tree->nil); // tree can't be empty
+static void bst_write_end(jfs_bst_t *tree) {
+    if (tree->reader_count == 0) return;
+    if (--tree->write_depth > 0) return;
 
-    void *const       node_value = bst_container_value(tree, node);
-    const void *const detach_value = tree->detach(node_value);
-    memcpy(value_out, detach_value, tree->value_size); // value_out has been loaded
+    atomic_store(&tree->seq, atomic_load_explicit(&tree->seq, memory_order_relaxed) + 1);
+    bst_reclaim(tree);
+}
 
-    if (detach_value == node_value) { // the detach is detaching the node linked on the tree
-        bst_delete(tree, node);
-        bst_update_cache_delete(tree, node);
-        jfs_fl_free(&tree->free_list, node);
-    } else { // the detach got a node that wasn't linked on the tree
-        jfs_bst_node_t *const detach_node = bst_container_node(tree, detach_value);
-        jfs_fl_free(&tree->free_list, detach_node);
+// the seq the write started at is kept in parent_color and the retired list runs through list, readers use neither
+static void bst_retire(jfs_bst_t *tree, jfs_bst_node_t *node) {
+    if (tree->reader_count == 0) {
+        bst_free_node(tree, node);
+        return;
     }
-}
 
-static void bst_update_cache_insert(jfs_bst_t *tree, const bst_location_t *location) {
-    // we don't use location->node because this is assumed to be nil
-    if (location->parent_cmp == -1 && location->parent == tree->cache.smallest) {
-        tree->cache.smallest = location->parent->left;
-    } else if (location->parent_cmp == 1 && location->parent == tree->cache.largest) {
-        tree->cache.largest = location->parent->right;
-    } else if (tree->cache.largest == tree->nil) { // we can assume if largest is nil so is smallest
-        tree->cache.largest = tree->root;
-        tree->cache.smallest = tree->root;
+    node->parent_color = (uintptr_t) (atomic_load_explicit(&tree->seq, memory_order_relaxed) - 1);
+    node->list = NULL;
+    if (tree->retired_tail != NULL) {
+        tree->retired_tail->list = node;
+    } else {
+        tree->retired = node;
     }
+    tree->retired_tail = node;
 }
 
-static void bst_update_cache_delete(jfs_bst_t *tree, const jfs_bst_node_t *node) {
-    if (tree->cache.smallest == tree->cache.largest) { // only one node in tree
-        assert(node == tree->root);
-        tree->cache.smallest = tree->nil;
-        tree->cache.largest = tree->nil;
-    } else if (node == tree->cache.smallest) {
-        assert(tree->cache.smallest->left == tree->nil);
+// a node retired by the write starting at seq s is unreachable for readers that entered at s + 2 or later
+static void bst_reclaim(jfs_bst_t *tree) {
+    if (tree->retired == NULL) return;
 
-        if (tree->cache.smallest->right != tree->nil) {
-            tree->cache.smallest = bst_local_minimum(tree, tree->cache.smallest->right);
-        } else {
-            tree->cache.smallest = bst_parent(tree->cache.smallest);
-        }
-    } else if (node == tree->cache.largest) {
-        assert(tree->cache.largest->right == tree->nil);
+    uint_fast64_t oldest = UINT_FAST64_MAX;
+    for (size_t i = 0; i < tree->reader_count; i++) {
+        const uint_fast64_t active = atomic_load(&tree->readers[i].active);
+        if (active != 0 && active - 1 < oldest) oldest = active - 1;
+    }
 
-        if (tree->cache.largest->left != tree->nil) {
-            tree->cache.largest = bst_local_maximum(tree, tree->cache.largest->left);
-        } else {
-            tree->cache.largest = bst_parent(tree->cache.largest);
-        }
+    while (tree->retired != NULL && (uint_fast64_t) tree->retired->parent_color + 2 <= oldest) {
+        jfs_bst_node_t *const node = tree->retired;
+        tree->retired = node->list;
+        bst_free_node(tree, node);
     }
+    if (tree->retired == NULL) tree->retired_tail = NULL;
 }
 
-static void bst_fixup_insert(jfs_bst_t *tree, jfs_bst_node_t *node) {
-    assert(node != tree->nil);
-    assert(tree->root != tree->nil);    // after an insert the tree should never be empty
-    assert(bst_color(node) == BST_RED); // all new nodes should be red
-
-    while (bst_color(bst_parent(node)) == BST_RED) {
-        jfs_bst_node_t       *parent = bst_parent(node);
-        jfs_bst_node_t *const grandparent = bst_parent(parent);
-        assert(grandparent != tree->nil);
-
-        if (parent == grandparent->left) {
-            jfs_bst_node_t *const uncle = grandparent->right;
-
-            if (bst_color(uncle) == BST_RED) {
-                bst_set_color(parent, BST_BLACK);
-                bst_set_color(uncle, BST_BLACK);
-                bst_set_color(grandparent, BST_RED);
-                node = grandparent;
-                // loop continues
-            } else {
-                if (node == parent->right) {
-                    node = parent;
-                    bst_rotate_left(tree, parent);
-                    parent = bst_parent(node);
-                }
-
-                bst_set_color(parent, BST_BLACK);
-                bst_set_color(grandparent, BST_RED);
-                bst_rotate_right(tree, grandparent);
-                break; // tree is fixed
-            }
-        } else {
-            jfs_bst_node_t *const uncle = grandparent->left;
-
-            if (bst_color(uncle) == BST_RED) {
-                bst_set_color(parent, BST_BLACK);
-                bst_set_color(uncle, BST_BLACK);
-                bst_set_color(grandparent, BST_RED);
-                node = grandparent;
-                // loop continues
-            } else {
-                if (node == parent->left) {
-                    node = parent;
-                    bst_rotate_right(tree, parent);
-                    parent = bst_parent(node);
-                }
-
-                bst_set_color(parent, BST_BLACK);
-                bst_set_color(grandparent, BST_RED);
-                bst_rotate_left(tree, grandparent);
-                break; // tree is fixed
-            }
+// chunks hold the same padded node as the component, the default size fits BST_CHUNK_MIN_NODES of them
+static void bst_pool_init(jfs_bst_t *tree_init, const jfs_bst_conf_t *conf, jfs_err_t *err) {
+    tree_init->open_chunks = NULL;
+    tree_init->full_chunks = NULL;
+    tree_init->spare_chunk = NULL;
+    tree_init->chunk_free_count = 0;
+    tree_init->pool = conf->pool != NULL ? *conf->pool : (jfs_bst_pool_t) {0};
+    if (conf->pool == NULL) return;
+    VOID_FAIL_IF(conf->pool->alloc == NULL || conf->pool->free == NULL, JFS_ERR_BAD_CONF);
+
+    const jfs_mlg_desc_t *const node_desc = &conf->component->desc;
+    tree_init->chunk_offset = jfs_mlg_align_size(sizeof(jfs_bst_chunk_t), node_desc->align);
+
+    size_t chunk_size = conf->pool->chunk_size;
+    if (chunk_size == 0) {
+        chunk_size = BST_CHUNK_MIN_SIZE;
+        while (chunk_size < tree_init->chunk_offset + (BST_CHUNK_MIN_NODES * node_desc->size) && chunk_size <= SIZE_MAX / 2) {
+            chunk_size *= 2;
         }
     }
+    VOID_FAIL_IF(chunk_size & (chunk_size - 1), JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(chunk_size < tree_init->chunk_offset + node_desc->size, JFS_ERR_BAD_CONF);
 
-    bst_set_color(tree->root, BST_BLACK);
+    tree_init->pool.chunk_size = chunk_size;
+    tree_init->chunk_desc = (jfs_mlg_desc_t) {.align = node_desc->align, .size = node_desc->size, .count = (chunk_size - tree_init->chunk_offset) / node_desc->size};
+    VOID_FAIL_IF(!jfs_mlg_valid_desc(&tree_init->chunk_desc), JFS_ERR_BAD_CONF);
 }
 
-static void bst_fixup_delete(jfs_bst_t *tree, jfs_bst_node_t *node) {
-    while (node != tree->root && bst_color(node) == BST_BLACK) {
-        jfs_bst_node_t *const parent = bst_parent(node);
-        if (node == parent->left) {
-            jfs_bst_node_t *sibling = parent->right;
-            if (bst_color(sibling) == BST_RED) {
-                bst_set_color(sibling, BST_BLACK);
-                bst_set_color(parent, BST_RED);
-                bst_rotate_left(tree, parent);
-                sibling = parent->right;
-            }
+// after this count nodes can be allocated without failing, grows into the pool once the component runs out
+static void bst_reserve(jfs_bst_t *tree, size_t count, jfs_err_t *err) {
+    if (tree->free_list.count + tree->chunk_free_count < count) bst_reclaim(tree);
+    while (tree->free_list.count + tree->chunk_free_count < count) {
+        bst_chunk_grow(tree, err);
+        VOID_CHECK_ERR;
+    }
+}
 
-            if (bst_color(sibling->left) == BST_BLACK && bst_color(sibling->right) == BST_BLACK) {
-                bst_set_color(sibling, BST_RED);
-                node = parent;
-            } else {
-                if (bst_color(sibling->right) == BST_BLACK) {
-                    bst_set_color(sibling->left, BST_BLACK);
-                    bst_set_color(sibling, BST_RED);
-                    bst_rotate_right(tree, sibling);
-                    sibling = parent->right;
-                }
-
-                bst_set_color(sibling, bst_color(parent));
-                bst_set_color(parent, BST_BLACK);
-                bst_set_color(sibling->right, BST_BLACK);
-                bst_rotate_left(tree, parent);
-                node = tree->root;
-            }
-        } else {
-            jfs_bst_node_t *sibling = parent->left;
-            if (bst_color(sibling) == BST_RED) {
-                bst_set_color(sibling, BST_BLACK);
-                bst_set_color(parent, BST_RED);
-                bst_rotate_right(tree, parent);
-                sibling = parent->left;
-            }
+// the component is used up before any chunk so a tree that never grows never touches the pool
+static jfs_bst_node_t *bst_alloc_node(jfs_bst_t *tree) {
+    if (tree->free_list.count > 0) return jfs_fl_alloc(&tree->free_list);
+
+    jfs_bst_chunk_t *const chunk = tree->open_chunks;
+    assert(chunk != NULL); // callers reserve first
+    jfs_bst_node_t *const node = jfs_fl_alloc(&chunk->free_list);
+    tree->chunk_free_count -= 1;
+    if (chunk->free_list.count == 0) {
+        bst_chunk_unlink(&tree->open_chunks, chunk);
+        bst_chunk_link(&tree->full_chunks, chunk);
+    }
+    return node;
+}
 
-            if (bst_color(sibling->left) == BST_BLACK && bst_color(sibling->right) == BST_BLACK) {
-                bst_set_color(sibling, BST_RED);
-                node = parent;
-            } else {
-                if (bst_color(sibling->left) == BST_BLACK) {
-                    bst_set_color(sibling->right, BST_BLACK);
-                    bst_set_color(sibling, BST_RED);
-                    bst_rotate_left(tree, sibling);
-                    sibling = parent->left;
-                }
-
-                bst_set_color(sibling, bst_color(parent));
-                bst_set_color(parent, BST_BLACK);
-                bst_set_color(sibling->left, BST_BLACK);
-                bst_rotate_right(tree, parent);
-                node = tree->root;
-            }
-        }
+static void bst_free_node(jfs_bst_t *tree, jfs_bst_node_t *node_move) {
+    const uint8_t *const ptr = (const uint8_t *) node_move;
+    if (ptr >= tree->component_begin && ptr < tree->component_end) {
+        jfs_fl_free(&tree->free_list, node_move);
+        return;
     }
 
-    bst_set_color(node, BST_BLACK);
+    jfs_bst_chunk_t *const chunk = (jfs_bst_chunk_t *) ((uintptr_t) node_move & ~(tree->pool.chunk_size - 1)); // NOLINT
+    if (chunk->free_list.count == 0) {
+        bst_chunk_unlink(&tree->full_chunks, chunk);
+        bst_chunk_link(&tree->open_chunks, chunk);
+    }
+    jfs_fl_free(&chunk->free_list, node_move);
+    tree->chunk_free_count += 1;
+    if (chunk->free_list.count == tree->chunk_desc.count) bst_chunk_drain(tree, chunk);
 }
 
-static void bst_rotate_left(jfs_bst_t *tree, jfs_bst_node_t *x) {
-    assert(x != tree->nil);
-    assert(x->right != tree->nil);
+static void bst_chunk_grow(jfs_bst_t *tree, jfs_err_t *err) {
+    jfs_bst_chunk_t *chunk = tree->spare_chunk; // a drained chunk still has all its nodes linked
+    tree->spare_chunk = NULL;
 
-    jfs_bst_node_t *const y = x->right;
-    jfs_bst_node_t *const x_parent = bst_parent(x);
+    if (chunk == NULL) {
+        VOID_FAIL_IF(tree->pool.alloc == NULL, JFS_ERR_FULL);
+        chunk = tree->pool.alloc(tree->pool.chunk_size, tree->pool.chunk_size, tree->pool.ctx);
+        VOID_FAIL_IF(chunk == NULL, JFS_ERR_FULL);
 
-    x->right = y->left;
-    if (y->left != tree->nil) bst_set_parent(y->left, x);
+        // nodes find their chunk by masking their address, a misaligned chunk would send frees somewhere else
+        if ((uintptr_t) chunk % tree->pool.chunk_size != 0) {
+            tree->pool.free(chunk, tree->pool.chunk_size, tree->pool.ctx);
+            *err = JFS_ERR_BAD_CONF;
+            VOID_RETURN_ERR;
+        }
 
-    bst_set_parent(y, x_parent);
-    if (x_parent == tree->nil) {
-        tree->root = y;
-    } else if (x == x_parent->left) {
-        x_parent->left = y;
-    } else {
-        x_parent->right = y;
+        const jfs_mlg_component_t nodes = {.ptr = jfs_mlg_apply_offset(chunk, tree->chunk_offset), .desc = tree->chunk_desc};
+        jfs_fl_init(&chunk->free_list, &nodes, err);
+        assert(*err == JFS_OK); // chunk_desc was checked at init
     }
 
-    y->left = x;
-    bst_set_parent(x, y);
+    bst_chunk_link(&tree->open_chunks, chunk);
+    tree->chunk_free_count += chunk->free_list.count;
 }
 
-static void bst_rotate_right(jfs_bst_t *tree, jfs_bst_node_t *x) {
-    assert(x != tree->nil);
-    assert(x->left != tree->nil);
-
-    jfs_bst_node_t *const y = x->left;
-    jfs_bst_node_t *const x_parent = bst_parent(x);
+static void bst_chunk_drain(jfs_bst_t *tree, jfs_bst_chunk_t *chunk_move) {
+    bst_chunk_unlink(&tree->open_chunks, chunk_move);
+    tree->chunk_free_count -= chunk_move->free_list.count;
 
-    x->left = y->right;
-    if (y->right != tree->nil) bst_set_parent(y->right, x);
-
-    bst_set_parent(y, x_parent);
-    if (x_parent == tree->nil) {
-        tree->root = y;
-    } else if (x == x_parent->left) {
-        x_parent->left = y;
-    } else {
-        x_parent->right = y;
+    if (tree->spare_chunk == NULL) {
+        tree->spare_chunk = chunk_move;
+        return;
     }
-
-    y->right = x;
-    bst_set_parent(x, y);
+    tree->pool.free(chunk_move, tree->pool.chunk_size, tree->pool.ctx);
 }
 
-static void bst_transplant(jfs_bst_t *tree, jfs_bst_node_t *old, jfs_bst_node_t *new) { // NOLINT
-    assert(tree->root != tree->nil);
-    assert(old != new);
-
-    jfs_bst_node_t *const old_parent = bst_parent(old);
+static void bst_chunk_link(jfs_bst_chunk_t **list, jfs_bst_chunk_t *chunk) {
+    chunk->prev = NULL;
+    chunk->next = *list;
+    if (*list != NULL) (*list)->prev = chunk;
+    *list = chunk;
+}
 
-    if (old_parent == tree->nil) {
-        tree->root = new;
-    } else if (old_parent->left == old) {
-        old_parent->left = new;
+static void bst_chunk_unlink(jfs_bst_chunk_t **list, jfs_bst_chunk_t *chunk) {
+    if (chunk->prev != NULL) {
+        chunk->prev->next = chunk->next;
     } else {
-        old_parent->right = new;
+        *list = chunk->next;
     }
-
-    bst_set_parent(new, old_parent);
+    if (chunk->next != NULL) chunk->next->prev = chunk->prev;
+    chunk->next = NULL;
+    chunk->prev = NULL;
 }
 
-static jfs_bst_node_t *bst_local_minimum(const jfs_bst_t *tree, jfs_bst_node_t *start) {
-    while (start->left != tree->nil) {
-        start = start->left;
+static void bst_update_cache_insert(jfs_bst_t *tree, const jfs_bst_node_t *node, const jfs_bst_location_t *location) {
+    // a new smallest/largest can only hang directly off the old one, the fixup may have rotated it since
+    if (tree->cache.largest == tree->nil) { // we can assume if largest is nil so is smallest
+        tree->cache.largest = (jfs_bst_node_t *) node;
+        tree->cache.smallest = (jfs_bst_node_t *) node;
+    } else if (location->parent_cmp < 0 && location->parent == tree->cache.smallest) {
+        tree->cache.smallest = (jfs_bst_node_t *) node;
+    } else if (location->parent_cmp > 0 && location->parent == tree->cache.largest) {
+        tree->cache.largest = (jfs_bst_node_t *) node;
     }
-    return start;
 }
 
-static jfs_bst_node_t *bst_local_maximum(const jfs_bst_t *tree, jfs_bst_node_t *start) {
-    while (start->right != tree->nil) {
-        start = start->right;
+// must run before bst_delete while node still has its links
+static void bst_update_cache_delete(jfs_bst_t *tree, const jfs_bst_node_t *node) {
+    if (node == tree->cache.previous) tree->cache.previous = tree->nil;
+
+    if (tree->cache.smallest == tree->cache.largest) { // only one node in tree
+        assert(node == tree->root);
+        tree->cache.smallest = tree->nil;
+        tree->cache.largest = tree->nil;
+    } else if (node == tree->cache.smallest) {
+        assert(tree->cache.smallest->left == tree->nil);
+
+        if (tree->cache.smallest->right != tree->nil) {
+            tree->cache.smallest = bst_local_minimum(tree, tree->cache.smallest->right);
+        } else {
+            tree->cache.smallest = bst_parent(tree->cache.smallest);
+        }
+    } else if (node == tree->cache.largest) {
+        assert(tree->cache.largest->right == tree->nil);
+
+        if (tree->cache.largest->left != tree->nil) {
+            tree->cache.largest = bst_local_maximum(tree, tree->cache.largest->left);
+        } else {
+            tree->cache.largest = bst_parent(tree->cache.largest);
+        }
     }
-    return start;
 }
 
 static jfs_bst_node_t *bst_parent(const jfs_bst_node_t *node) {
@@ -545,3 +935,44 @@ static void bst_set_parent_color(jfs_bst_node_t *node, jfs_bst_node_t *parent, u
     assert(color == BST_RED || color == BST_BLACK);
     node->parent_color = (uintptr_t) parent | color;
 }
+
+// nil and unranked trees read as 0 so callers can use it without checking
+static size_t bst_size(const jfs_bst_t *tree, const jfs_bst_node_t *node) {
+    if (tree->size_offset == 0 || node == tree->nil) return 0;
+    return *(const size_t *) jfs_mlg_apply_offset((uint8_t *) node, tree->size_offset);
+}
+
+static void bst_set_size(const jfs_bst_t *tree, jfs_bst_node_t *node, size_t size) {
+    if (tree->size_offset == 0) return;
+    assert(node != tree->nil);
+    *(size_t *) jfs_mlg_apply_offset((uint8_t *) node, tree->size_offset) = size;
+}
+
+// adds delta to node and every ancestor, (size_t) -1 to subtract one
+static void bst_resize_path(const jfs_bst_t *tree, jfs_bst_node_t *node, size_t delta) {
+    if (tree->size_offset == 0) return;
+
+    for (; node != tree->nil; node = bst_parent(node)) {
+        bst_set_size(tree, node, bst_size(tree, node) + delta);
+    }
+}
+
+// y takes over x's whole subtree and x keeps everything but y and its outer side
+static void bst_rotate_sizes(const jfs_bst_t *tree, jfs_bst_node_t *x, jfs_bst_node_t *y, jfs_bst_node_t *moved) {
+    if (tree->size_offset == 0) return;
+
+    const size_t x_size = bst_size(tree, x);
+    bst_set_size(tree, x, x_size - bst_size(tree, y) + bst_size(tree, moved));
+    bst_set_size(tree, y, x_size);
+}
+
+// next and its dupes move up out of the subtrees between it and node
+static void bst_lift_sizes(const jfs_bst_t *tree, jfs_bst_node_t *node, jfs_bst_node_t *next) {
+    if (tree->size_offset == 0) return;
+
+    const size_t moved = bst_size(tree, next) - bst_size(tree, next->right);
+    for (jfs_bst_node_t *above = bst_parent(next); above != node; above = bst_parent(above)) {
+        bst_set_size(tree, above, bst_size(tree, above) - moved);
+    }
+    bst_set_size(tree, next, bst_size(tree, node));
+}
@@ -0,0 +1,358 @@
+#include "compact_binary_search_tree.h"
+#include "memory_layout_generator.h"
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CBST_NIL   ((uint32_t) 0)
+#define CBST_RED   0
+#define CBST_BLACK 1
+
+typedef struct cbst_location cbst_location_t;
+
+struct cbst_location {
+    uint32_t node;
+    uint32_t parent;
+    int      parent_cmp;
+};
+
+static jfs_cbst_node_t *cbst_at(const jfs_cbst_t *tree, uint32_t index);
+static uint32_t         cbst_index(const jfs_cbst_t *tree, const void *slot);
+static void            *cbst_value(const jfs_cbst_t *tree, uint32_t index) WUR;
+static uint32_t         cbst_alloc(jfs_cbst_t *tree, const void *value);
+static void             cbst_attach_node(jfs_cbst_t *tree, uint32_t base, uint32_t attach);
+static uint32_t         cbst_detach_node(jfs_cbst_t *tree, uint32_t base);
+
+static uint32_t        cbst_check_cache(const jfs_cbst_t *tree, const void *key);
+static cbst_location_t cbst_find(const jfs_cbst_t *tree, const void *key);
+static void            cbst_insert(jfs_cbst_t *tree, uint32_t node, const cbst_location_t *location);
+static void            cbst_detach_and_delete(jfs_cbst_t *tree, void *value_out, uint32_t node);
+
+static void cbst_update_cache_insert(jfs_cbst_t *tree, uint32_t node, const cbst_location_t *location);
+static void cbst_update_cache_delete(jfs_cbst_t *tree, uint32_t node);
+
+static uint32_t cbst_parent(const jfs_cbst_t *tree, uint32_t node);
+static void     cbst_set_parent(jfs_cbst_t *tree, uint32_t node, uint32_t parent);
+static uint32_t cbst_color(const jfs_cbst_t *tree, uint32_t node);
+static void     cbst_set_color(jfs_cbst_t *tree, uint32_t node, uint32_t color);
+static void     cbst_set_parent_color(jfs_cbst_t *tree, uint32_t node, uint32_t parent, uint32_t color);
+
+#define RBT_PREFIX                 cbst_
+#define RBT_TREE                   jfs_cbst_t
+#define RBT_LINK                   uint32_t
+#define RBT_NIL(tree)              CBST_NIL
+#define RBT_LEFT(tree, n)          (cbst_at((tree), (n))->left)
+#define RBT_RIGHT(tree, n)         (cbst_at((tree), (n))->right)
+#define RBT_PARENT(tree, n)        cbst_parent((tree), (n))
+#define RBT_SET_PARENT(tree, n, p) cbst_set_parent((tree), (n), (p))
+#define RBT_COLOR(tree, n)         cbst_color((tree), (n))
+#define RBT_SET_COLOR(tree, n, c)  cbst_set_color((tree), (n), (c))
+#define RBT_RED                    CBST_RED
+#define RBT_BLACK                  CBST_BLACK
+#include "red_black_tree.inc"
+
+jfs_mlg_desc_t jfs_cbst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    // free slots hold a jfs_fl_obj_t so they need its alignment even though the node only needs 4
+    jfs_mlg_desc_t node_desc = {.align = alignof(jfs_fl_obj_t), .size = sizeof(jfs_cbst_node_t), .count = 1};
+    assert(jfs_mlg_valid_desc(&node_desc));
+
+    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = 1};
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc) || obj_count == 0, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+    VAL_FAIL_IF(obj_count > JFS_CBST_MAX_COUNT, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    jfs_mlg_append(&node_desc, &obj_desc);
+    node_desc.size = jfs_mlg_align_size(node_desc.size, node_desc.align);
+    node_desc.count = obj_count + 1; // slot 0 is the nil node
+    return node_desc;
+}
+
+void jfs_cbst_init(jfs_cbst_t *tree_init, const jfs_cbst_conf_t *conf, jfs_err_t *err) {
+    assert(conf != NULL);
+    const jfs_mlg_component_t *const component = conf->component;
+    VOID_FAIL_IF(!jfs_mlg_valid_component(component), JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(component->desc.count < 2 || component->desc.count - 1 > JFS_CBST_MAX_COUNT, JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(component->desc.size < sizeof(jfs_fl_obj_t), JFS_ERR_BAD_CONF);
+
+    tree_init->slots = component->ptr;
+    tree_init->slot_size = component->desc.size;
+
+    // the free list only ever sees the slots after nil
+    const jfs_mlg_component_t free_slots = {
+        .ptr = tree_init->slots + tree_init->slot_size,
+        .desc = {.size = component->desc.size, .align = component->desc.align, .count = component->desc.count - 1},
+    };
+    jfs_fl_init(&tree_init->free_list, &free_slots, err);
+    VOID_CHECK_ERR;
+
+    jfs_cbst_node_t *const nil = cbst_at(tree_init, CBST_NIL);
+    nil->left = CBST_NIL;
+    nil->right = CBST_NIL;
+    nil->list = CBST_NIL;
+    cbst_set_parent_color(tree_init, CBST_NIL, CBST_NIL, CBST_BLACK);
+
+    tree_init->cache.largest = CBST_NIL;
+    tree_init->cache.smallest = CBST_NIL;
+    tree_init->cache.previous = CBST_NIL;
+    tree_init->root = CBST_NIL;
+
+    tree_init->value_offset = jfs_mlg_align_size(sizeof(jfs_cbst_node_t), component->desc.align);
+    VOID_FAIL_IF(tree_init->value_offset >= component->desc.size, JFS_ERR_BAD_CONF);
+    tree_init->value_size = component->desc.size - tree_init->value_offset;
+    if (conf->value_size != 0) {
+        VOID_FAIL_IF(conf->value_size > tree_init->value_size, JFS_ERR_BAD_CONF);
+        tree_init->value_size = conf->value_size;
+    }
+
+    tree_init->cmp = conf->cmp;
+    VOID_FAIL_IF(tree_init->cmp == NULL, JFS_ERR_BAD_CONF);
+}
+
+void jfs_cbst_puts(jfs_cbst_t *tree, const void *value, const void *key, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->free_list.count == 0, JFS_ERR_FULL);
+    const uint32_t node = cbst_alloc(tree, value);
+
+    const uint32_t cached_node = cbst_check_cache(tree, key);
+    if (cached_node != CBST_NIL) {
+        cbst_attach_node(tree, cached_node, node);
+        tree->cache.previous = cached_node;
+        return;
+    }
+
+    const cbst_location_t location = cbst_find(tree, key);
+
+    if (location.node != CBST_NIL) { // key is a dupe
+        cbst_attach_node(tree, location.node, node);
+        tree->cache.previous = location.node;
+    } else {
+        cbst_insert(tree, node, &location);
+        cbst_update_cache_insert(tree, node, &location);
+        tree->cache.previous = node;
+    }
+}
+
+void jfs_cbst_takes(jfs_cbst_t *tree, void *value_out, const void *key, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->root == CBST_NIL, JFS_ERR_EMPTY);
+
+    const uint32_t cached_node = cbst_check_cache(tree, key);
+    if (cached_node != CBST_NIL) {
+        cbst_detach_and_delete(tree, value_out, cached_node);
+        return;
+    }
+
+    const cbst_location_t location = cbst_find(tree, key);
+    VOID_FAIL_IF(location.node == CBST_NIL, JFS_ERR_BST_BAD_KEY);
+
+    cbst_detach_and_delete(tree, value_out, location.node);
+}
+
+void jfs_cbst_get_largest(jfs_cbst_t *tree, void *value_out, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->cache.largest == CBST_NIL, JFS_ERR_EMPTY);
+    cbst_detach_and_delete(tree, value_out, tree->cache.largest);
+}
+
+void jfs_cbst_get_smallest(jfs_cbst_t *tree, void *value_out, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->cache.smallest == CBST_NIL, JFS_ERR_EMPTY);
+    cbst_detach_and_delete(tree, value_out, tree->cache.smallest);
+}
+
+void *jfs_cbst_lookup(const jfs_cbst_t *tree, const void *key) {
+    const uint32_t cached_node = cbst_check_cache(tree, key);
+    if (cached_node != CBST_NIL) return cbst_value(tree, cached_node);
+
+    const cbst_location_t location = cbst_find(tree, key);
+    if (location.node == CBST_NIL) return NULL;
+    return cbst_value(tree, location.node);
+}
+
+void jfs_cbst_iter_init(jfs_cbst_iter_t *iter_init, const jfs_cbst_t *tree) {
+    iter_init->tree = tree;
+    iter_init->node = tree->cache.smallest;
+    iter_init->current = tree->cache.smallest;
+}
+
+void jfs_cbst_iter_lower_bound(jfs_cbst_iter_t *iter_init, const jfs_cbst_t *tree, const void *key) {
+    uint32_t node = tree->root;
+    uint32_t bound = CBST_NIL;
+
+    while (node != CBST_NIL) {
+        if (tree->cmp(key, cbst_value(tree, node)) <= 0) {
+            bound = node;
+            node = cbst_at(tree, node)->left;
+        } else {
+            node = cbst_at(tree, node)->right;
+        }
+    }
+
+    iter_init->tree = tree;
+    iter_init->node = bound;
+    iter_init->current = bound;
+}
+
+void *jfs_cbst_iter_next(jfs_cbst_iter_t *iter) {
+    const uint32_t current = iter->current;
+    if (current == CBST_NIL) return NULL;
+
+    // walk the dupe list of a tree node before moving on to its successor
+    const uint32_t next_dupe = cbst_at(iter->tree, current)->list;
+    if (next_dupe != CBST_NIL) {
+        iter->current = next_dupe;
+    } else {
+        iter->node = cbst_successor(iter->tree, iter->node);
+        iter->current = iter->node;
+    }
+
+    return cbst_value(iter->tree, current);
+}
+
+static jfs_cbst_node_t *cbst_at(const jfs_cbst_t *tree, uint32_t index) {
+    return (jfs_cbst_node_t *) (tree->slots + ((size_t) index * tree->slot_size));
+}
+
+static uint32_t cbst_index(const jfs_cbst_t *tree, const void *slot) {
+    const size_t offset = (size_t) ((const uint8_t *) slot - tree->slots);
+    assert(offset % tree->slot_size == 0);
+    return (uint32_t) (offset / tree->slot_size);
+}
+
+static void *cbst_value(const jfs_cbst_t *tree, uint32_t index) {
+    return jfs_mlg_apply_offset((uint8_t *) cbst_at(tree, index), tree->value_offset);
+}
+
+static uint32_t cbst_alloc(jfs_cbst_t *tree, const void *value) {
+    void *const slot = jfs_fl_alloc(&tree->free_list);
+    assert(slot != NULL);
+
+    const uint32_t node = cbst_index(tree, slot);
+    memcpy(cbst_value(tree, node), value, tree->value_size);
+    cbst_at(tree, node)->list = CBST_NIL;
+    return node;
+}
+
+static void cbst_attach_node(jfs_cbst_t *tree, uint32_t base, uint32_t attach) {
+    cbst_at(tree, attach)->list = cbst_at(tree, base)->list;
+    cbst_at(tree, base)->list = attach;
+}
+
+static uint32_t cbst_detach_node(jfs_cbst_t *tree, uint32_t base) {
+    jfs_cbst_node_t *const base_node = cbst_at(tree, base);
+    if (base_node->list == CBST_NIL) return base;
+
+    const uint32_t detached = base_node->list;
+    base_node->list = cbst_at(tree, detached)->list;
+    return detached;
+}
+
+static uint32_t cbst_check_cache(const jfs_cbst_t *tree, const void *key) {
+    if (tree->cache.previous != CBST_NIL && tree->cmp(key, cbst_value(tree, tree->cache.previous)) == 0) return tree->cache.previous;
+    if (tree->cache.largest != CBST_NIL && tree->cmp(key, cbst_value(tree, tree->cache.largest)) == 0) return tree->cache.largest;
+    if (tree->cache.smallest != CBST_NIL && tree->cmp(key, cbst_value(tree, tree->cache.smallest)) == 0) return tree->cache.smallest;
+    return CBST_NIL;
+}
+
+static cbst_location_t cbst_find(const jfs_cbst_t *tree, const void *key) {
+    assert(key != NULL);
+
+    cbst_location_t location = {.node = tree->root, .parent = CBST_NIL, .parent_cmp = 0};
+
+    while (location.node != CBST_NIL) {
+        const int cmp_result = tree->cmp(key, cbst_value(tree, location.node));
+        if (cmp_result == 0) return location;
+
+        location.parent = location.node;
+        location.parent_cmp = cmp_result;
+
+        const jfs_cbst_node_t *const node = cbst_at(tree, location.node);
+        location.node = cmp_result < 0 ? node->left : node->right;
+    }
+
+    return location;
+}
+
+static void cbst_insert(jfs_cbst_t *tree, uint32_t node, const cbst_location_t *location) {
+    assert(location->node == CBST_NIL); // we don't handle dupes here
+
+    cbst_at(tree, node)->left = CBST_NIL;
+    cbst_at(tree, node)->right = CBST_NIL;
+    cbst_set_parent_color(tree, node, location->parent, CBST_RED);
+
+    if (location->parent == CBST_NIL) {
+        assert(tree->root == CBST_NIL);
+        tree->root = node;
+    } else if (location->parent_cmp < 0) {
+        cbst_at(tree, location->parent)->left = node;
+    } else {
+        assert(location->parent_cmp > 0);
+        cbst_at(tree, location->parent)->right = node;
+    }
+
+    cbst_fixup_insert(tree, node);
+}
+
+static void cbst_detach_and_delete(jfs_cbst_t *tree, void *value_out, uint32_t node) {
+    assert(tree->root != CBST_NIL);
+
+    const uint32_t detached = cbst_detach_node(tree, node);
+    memcpy(value_out, cbst_value(tree, detached), tree->value_size);
+
+    if (detached == node) { // the last value for the key so the tree node goes
+        cbst_update_cache_delete(tree, node);
+        cbst_delete(tree, node);
+    }
+
+    jfs_fl_free(&tree->free_list, cbst_at(tree, detached));
+}
+
+static void cbst_update_cache_insert(jfs_cbst_t *tree, uint32_t node, const cbst_location_t *location) {
+    // a new smallest/largest can only hang directly off the old one
+    if (tree->cache.largest == CBST_NIL) {
+        tree->cache.largest = node;
+        tree->cache.smallest = node;
+    } else if (location->parent_cmp < 0 && location->parent == tree->cache.smallest) {
+        tree->cache.smallest = node;
+    } else if (location->parent_cmp > 0 && location->parent == tree->cache.largest) {
+        tree->cache.largest = node;
+    }
+}
+
+// must run before cbst_delete while node still has its links
+static void cbst_update_cache_delete(jfs_cbst_t *tree, uint32_t node) {
+    if (node == tree->cache.previous) tree->cache.previous = CBST_NIL;
+
+    if (tree->cache.smallest == tree->cache.largest) {
+        assert(node == tree->root);
+        tree->cache.smallest = CBST_NIL;
+        tree->cache.largest = CBST_NIL;
+    } else if (node == tree->cache.smallest) {
+        const uint32_t right = cbst_at(tree, node)->right;
+        tree->cache.smallest = right != CBST_NIL ? cbst_local_minimum(tree, right) : cbst_parent(tree, node);
+    } else if (node == tree->cache.largest) {
+        const uint32_t left = cbst_at(tree, node)->left;
+        tree->cache.largest = left != CBST_NIL ? cbst_local_maximum(tree, left) : cbst_parent(tree, node);
+    }
+}
+
+static uint32_t cbst_parent(const jfs_cbst_t *tree, uint32_t node) {
+    return cbst_at(tree, node)->parent_color >> 1;
+}
+
+static void cbst_set_parent(jfs_cbst_t *tree, uint32_t node, uint32_t parent) {
+    jfs_cbst_node_t *const node_ptr = cbst_at(tree, node);
+    node_ptr->parent_color = (parent << 1) | (node_ptr->parent_color & 1);
+}
+
+static uint32_t cbst_color(const jfs_cbst_t *tree, uint32_t node) {
+    return cbst_at(tree, node)->parent_color & 1;
+}
+
+static void cbst_set_color(jfs_cbst_t *tree, uint32_t node, uint32_t color) {
+    assert(color == CBST_RED || color == CBST_BLACK);
+    jfs_cbst_node_t *const node_ptr = cbst_at(tree, node);
+    node_ptr->parent_color = (node_ptr->parent_color & ~(uint32_t) 1) | color;
+}
+
+static void cbst_set_parent_color(jfs_cbst_t *tree, uint32_t node, uint32_t parent, uint32_t color) {
+    assert(color == CBST_RED || color == CBST_BLACK);
+    cbst_at(tree, node)->parent_color = (parent << 1) | color;
+}
@@ -0,0 +1,182 @@
+#include "d_ary_heap.h"
+#include "memory_layout_generator.h"
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint8_t *dheap_slot(const jfs_dheap_t *heap, size_t index);
+static void    *dheap_value(const jfs_dheap_t *heap, size_t index) WUR;
+static void     dheap_place(jfs_dheap_t *heap, size_t index, const uint8_t *slot);
+static void     dheap_fix(jfs_dheap_t *heap, size_t index);
+static void     dheap_sift_up(jfs_dheap_t *heap, size_t index);
+static void     dheap_sift_down(jfs_dheap_t *heap, size_t index);
+static void     dheap_take(jfs_dheap_t *heap, size_t index, void *value_out);
+
+jfs_mlg_desc_t jfs_dheap_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    jfs_mlg_desc_t slot_desc = {.align = alignof(jfs_dheap_slot_t), .size = sizeof(jfs_dheap_slot_t), .count = 1};
+    assert(jfs_mlg_valid_desc(&slot_desc));
+
+    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = 1};
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc) || obj_count == 0 || obj_count == SIZE_MAX, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    jfs_mlg_append(&slot_desc, &obj_desc);
+    slot_desc.size = jfs_mlg_align_size(slot_desc.size, slot_desc.align);
+    slot_desc.count = obj_count + 1; // the last slot is the sifts' scratch
+    return slot_desc;
+}
+
+jfs_mlg_desc_t jfs_dheap_make_handle_desc(size_t obj_count, jfs_err_t *err) {
+    VAL_FAIL_IF(obj_count == 0, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    // free handles are linked through the free list so they need room for its pointer
+    const size_t size = sizeof(jfs_dheap_handle_t) > sizeof(jfs_fl_obj_t) ? sizeof(jfs_dheap_handle_t) : sizeof(jfs_fl_obj_t);
+    const size_t align = alignof(jfs_dheap_handle_t) > alignof(jfs_fl_obj_t) ? alignof(jfs_dheap_handle_t) : alignof(jfs_fl_obj_t);
+    return (jfs_mlg_desc_t) {.align = align, .size = jfs_mlg_align_size(size, align), .count = obj_count};
+}
+
+void jfs_dheap_init(jfs_dheap_t *heap_init, const jfs_dheap_conf_t *conf, jfs_err_t *err) {
+    assert(conf != NULL);
+    VOID_FAIL_IF(!jfs_mlg_valid_component(conf->component), JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(conf->component->desc.count < 2, JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(conf->handle_component == NULL || conf->handle_component->desc.count < conf->component->desc.count - 1, JFS_ERR_BAD_CONF);
+
+    jfs_fl_init(&heap_init->handles, conf->handle_component, err);
+    VOID_CHECK_ERR;
+
+    heap_init->slots = conf->component->ptr;
+    heap_init->slot_size = conf->component->desc.size;
+    heap_init->capacity = conf->component->desc.count - 1;
+    heap_init->scratch = heap_init->slots + (heap_init->capacity * heap_init->slot_size);
+    heap_init->count = 0;
+
+    heap_init->value_offset = jfs_mlg_align_size(sizeof(jfs_dheap_slot_t), conf->component->desc.align);
+    VOID_FAIL_IF(heap_init->value_offset >= heap_init->slot_size, JFS_ERR_BAD_CONF);
+    heap_init->value_size = heap_init->slot_size - heap_init->value_offset;
+    if (conf->value_size != 0) {
+        VOID_FAIL_IF(conf->value_size > heap_init->value_size, JFS_ERR_BAD_CONF);
+        heap_init->value_size = conf->value_size;
+    }
+
+    heap_init->cmp = conf->cmp;
+    VOID_FAIL_IF(heap_init->cmp == NULL, JFS_ERR_BAD_CONF);
+}
+
+jfs_dheap_handle_t *jfs_dheap_push(jfs_dheap_t *heap, const void *value, jfs_err_t *err) {
+    NULL_FAIL_IF(heap->count == heap->capacity, JFS_ERR_FULL);
+
+    jfs_dheap_handle_t *const handle = jfs_fl_alloc(&heap->handles);
+    assert(handle != NULL); // there are at least as many handles as slots
+
+    const size_t index = heap->count;
+    ((jfs_dheap_slot_t *) dheap_slot(heap, index))->handle = handle;
+    memcpy(dheap_value(heap, index), value, heap->value_size);
+    handle->index = index;
+    heap->count += 1;
+
+    dheap_sift_up(heap, index);
+    return handle;
+}
+
+void jfs_dheap_pop(jfs_dheap_t *heap, void *value_out, jfs_err_t *err) {
+    VOID_FAIL_IF(heap->count == 0, JFS_ERR_EMPTY);
+    dheap_take(heap, 0, value_out);
+}
+
+void *jfs_dheap_peek(const jfs_dheap_t *heap) {
+    return heap->count > 0 ? dheap_value(heap, 0) : NULL;
+}
+
+void *jfs_dheap_value(const jfs_dheap_t *heap, const jfs_dheap_handle_t *handle) {
+    assert(handle->index < heap->count);
+    return dheap_value(heap, handle->index);
+}
+
+void jfs_dheap_update(jfs_dheap_t *heap, jfs_dheap_handle_t *handle, const void *value) {
+    assert(handle->index < heap->count);
+    memcpy(dheap_value(heap, handle->index), value, heap->value_size);
+    dheap_fix(heap, handle->index);
+}
+
+void jfs_dheap_remove(jfs_dheap_t *heap, jfs_dheap_handle_t *handle_move, void *value_out) {
+    assert(handle_move->index < heap->count);
+    dheap_take(heap, handle_move->index, value_out);
+}
+
+static uint8_t *dheap_slot(const jfs_dheap_t *heap, size_t index) {
+    return heap->slots + (index * heap->slot_size);
+}
+
+static void *dheap_value(const jfs_dheap_t *heap, size_t index) {
+    return jfs_mlg_apply_offset(dheap_slot(heap, index), heap->value_offset);
+}
+
+// copies a whole slot into index and points its handle at the new spot
+static void dheap_place(jfs_dheap_t *heap, size_t index, const uint8_t *slot) {
+    uint8_t *const to = dheap_slot(heap, index);
+    memcpy(to, slot, heap->slot_size);
+    ((jfs_dheap_slot_t *) to)->handle->index = index;
+}
+
+// value at index changed in either direction
+static void dheap_fix(jfs_dheap_t *heap, size_t index) {
+    if (index > 0 && heap->cmp(dheap_value(heap, index), dheap_value(heap, (index - 1) / JFS_DHEAP_ARITY)) < 0) {
+        dheap_sift_up(heap, index);
+    } else {
+        dheap_sift_down(heap, index);
+    }
+}
+
+// the moving slot is held aside and parents shift down into the hole instead of swapping at every level
+static void dheap_sift_up(jfs_dheap_t *heap, size_t index) {
+    uint8_t *const moving = heap->scratch;
+    memcpy(moving, dheap_slot(heap, index), heap->slot_size);
+    const void *const moving_value = moving + heap->value_offset;
+
+    while (index > 0) {
+        const size_t parent = (index - 1) / JFS_DHEAP_ARITY;
+        if (heap->cmp(moving_value, dheap_value(heap, parent)) >= 0) break;
+
+        dheap_place(heap, index, dheap_slot(heap, parent));
+        index = parent;
+    }
+
+    dheap_place(heap, index, moving);
+}
+
+static void dheap_sift_down(jfs_dheap_t *heap, size_t index) {
+    uint8_t *const moving = heap->scratch;
+    memcpy(moving, dheap_slot(heap, index), heap->slot_size);
+    const void *const moving_value = moving + heap->value_offset;
+
+    for (;;) {
+        const size_t first = (index * JFS_DHEAP_ARITY) + 1;
+        if (first >= heap->count) break;
+
+        const size_t end = heap->count - first < JFS_DHEAP_ARITY ? heap->count : first + JFS_DHEAP_ARITY;
+        size_t       best = first;
+        for (size_t child = first + 1; child < end; child++) {
+            if (heap->cmp(dheap_value(heap, child), dheap_value(heap, best)) < 0) best = child;
+        }
+        if (heap->cmp(dheap_value(heap, best), moving_value) >= 0) break;
+
+        dheap_place(heap, index, dheap_slot(heap, best));
+        index = best;
+    }
+
+    dheap_place(heap, index, moving);
+}
+
+// the last slot fills the hole and is moved whichever way it needs to go
+static void dheap_take(jfs_dheap_t *heap, size_t index, void *value_out) {
+    jfs_dheap_handle_t *const handle = ((jfs_dheap_slot_t *) dheap_slot(heap, index))->handle;
+    memcpy(value_out, dheap_value(heap, index), heap->value_size);
+    jfs_fl_free(&heap->handles, handle);
+
+    heap->count -= 1;
+    if (index == heap->count) return;
+
+    dheap_place(heap, index, dheap_slot(heap, heap->count));
+    dheap_fix(heap, index);
+}
@@ -2,12 +2,17 @@
 #include <asm-generic/errno-base.h>
 #include <asm-generic/errno.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -53,6 +58,115 @@ DIR *jcl_opendir(const char *path_str, jcl_err_t *err) {
     return dir;
 }
 
+int jcl_openat(int dir_fd, const char *path_str, int flags, jcl_err_t *err) {
+    int fd = openat(dir_fd, path_str, flags);
+    if (fd == -1) {
+        switch (errno) {
+            case ENOENT:
+            case ENOTDIR:
+            case ELOOP:   *err = JCL_ERR_INVAL_PATH; break; // ELOOP is also a symlink met with O_NOFOLLOW
+            case EACCES:  *err = JCL_ERR_ACCESS; break;
+            case EINTR:   *err = JCL_ERR_INTER; break;
+            default:      *err = JCL_ERR_SYS; break;
+        }
+        VAL_RETURN_ERR(-1);
+    }
+
+    return fd;
+}
+
+size_t jcl_getdents64(int dir_fd, void *buf, size_t size, jcl_err_t *err) {
+    long status = syscall(SYS_getdents64, dir_fd, buf, size);
+    if (status == -1) {
+        switch (errno) {
+            case ENOENT: *err = JCL_ERR_INVAL_PATH; break; // the dir was removed while being read
+            default:     *err = JCL_ERR_SYS; break;
+        }
+        VAL_RETURN_ERR(0);
+    }
+
+    return (size_t) status;
+}
+
+void jcl_statx(int dir_fd, const char *path_str, int flags, unsigned int mask, struct statx *statx_init, jcl_err_t *err) {
+    if (syscall(SYS_statx, dir_fd, path_str, flags, mask, statx_init) != 0) {
+        switch (errno) {
+            case EACCES:  *err = JCL_ERR_ACCESS; break;
+            case ENOENT:
+            case ENOTDIR: *err = JCL_ERR_INVAL_PATH; break;
+            default:      *err = JCL_ERR_SYS; break;
+        }
+        VOID_RETURN_ERR;
+    }
+}
+
+int jcl_io_uring_setup(unsigned int entries, struct io_uring_params *params, jcl_err_t *err) {
+    long fd = syscall(SYS_io_uring_setup, entries, params);
+    if (fd == -1) {
+        switch (errno) {
+            case EINVAL: *err = JCL_ERR_ARG; break;
+            default:     *err = JCL_ERR_SYS; break; // ENOSYS and EPERM when io_uring is disabled
+        }
+        VAL_RETURN_ERR(-1);
+    }
+
+    return (int) fd;
+}
+
+unsigned int jcl_io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, jcl_err_t *err) {
+    long status = syscall(SYS_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+    if (status == -1) {
+        switch (errno) {
+            case EINTR:  *err = JCL_ERR_INTER; break;
+            case EAGAIN:
+            case EBUSY:  *err = JCL_ERR_AGAIN; break;
+            default:     *err = JCL_ERR_SYS; break;
+        }
+        VAL_RETURN_ERR(0);
+    }
+
+    return (unsigned int) status;
+}
+
+int jcl_inotify_init1(int flags, jcl_err_t *err) {
+    int fd = inotify_init1(flags);
+    if (fd == -1) {
+        switch (errno) {
+            case EMFILE: *err = JCL_ERR_FULL; break;
+            default:     *err = JCL_ERR_SYS; break;
+        }
+        VAL_RETURN_ERR(-1);
+    }
+
+    return fd;
+}
+
+int jcl_inotify_add_watch(int inotify_fd, const char *path_str, uint32_t mask, jcl_err_t *err) {
+    int wd = inotify_add_watch(inotify_fd, path_str, mask);
+    if (wd == -1) {
+        switch (errno) {
+            case EACCES:  *err = JCL_ERR_ACCESS; break;
+            case ENOENT:
+            case ENOTDIR: *err = JCL_ERR_INVAL_PATH; break;
+            case ENOSPC:  *err = JCL_ERR_FULL; break;
+            default:      *err = JCL_ERR_SYS; break;
+        }
+        VAL_RETURN_ERR(-1);
+    }
+
+    return wd;
+}
+
+void jcl_inotify_rm_watch(int inotify_fd, int wd, jcl_err_t *err) {
+    if (inotify_rm_watch(inotify_fd, wd) != 0) {
+        switch (errno) {
+            case EINVAL: *err = JCL_ERR_ARG; break; // already gone with its dir
+            default:     *err = JCL_ERR_SYS; break;
+        }
+        VOID_RETURN_ERR;
+    }
+}
+
 void jcl_shutdown(int sock_fd, int how, jcl_err_t *err) {
     if (shutdown(sock_fd, how) != 0) {
         switch (errno) {
@@ -213,6 +327,15 @@ void jcl_mutex_trylock(pthread_mutex_t *mutex, jcl_err_t *err) {
     }
 }
 
+void jcl_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr, jcl_err_t *err) {
+    if (pthread_cond_init(cond, attr) != 0) {
+        switch (errno) {
+            default: *err = JCL_ERR_SYS; break;
+        }
+        VOID_RETURN_ERR;
+    }
+}
+
 void jcl_cond_destroy(pthread_cond_t *cond, jcl_err_t *err) {
     if (pthread_cond_destroy(cond) != 0) {
         switch (errno) {
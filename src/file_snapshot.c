@@ -0,0 +1,442 @@
+#include "file_snapshot.h"
+#include "error.h"
+#include "file_io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FWS_MAGIC            ((uint64_t) 0x317377665f73666a) // "jfs_fws1"
+#define FWS_BUFFER_SIZE      ((size_t) 64 * 1024)
+#define FWS_RESTART_INTERVAL 16 // names between full ones, a lookup decodes at most this many
+#define FWS_NAME_HEADER      2  // shared prefix length and suffix length, one byte each since names are at most NAME_MAX
+
+typedef struct fws_header fws_header_t;
+typedef struct fws_layout fws_layout_t;
+typedef struct fws_writer fws_writer_t;
+
+// the tables follow in this order with nothing between them, names is the last thing in the file
+struct fws_header {
+    uint64_t magic;
+    uint64_t file_size;
+    int64_t  started_sec;
+    int64_t  started_nsec;
+    uint64_t start_path_len; // the start path opens the names area
+    uint64_t dir_count;
+    uint64_t file_count;
+    uint64_t dirs_offset;
+    uint64_t files_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+};
+
+// every file of the record grouped by dir and sorted by name, the order they're written in
+struct fws_layout {
+    const jfs_fw_file_t **order;
+    uint64_t             *first_file; // per dir
+    uint64_t             *entry;      // per dir
+    uint64_t             *child;      // per file in order
+    size_t                file_count;
+    size_t                names_size;
+};
+
+struct fws_writer {
+    int      fd;
+    uint8_t *buf; // FWS_BUFFER_SIZE
+    size_t   used;
+};
+
+static void   fws_layout_init(fws_layout_t *layout_init, const jfs_fw_record_t *record, jfs_err_t *err);
+static void   fws_layout_free(fws_layout_t *layout_free);
+static int    fws_file_cmp(const void *a, const void *b);
+static size_t fws_layout_find(const fws_layout_t *layout, const jfs_fw_record_t *record, size_t dir, const jfs_fio_name_t *name);
+static size_t fws_shared_len(const jfs_fw_file_t *prev, const jfs_fw_file_t *file, size_t position);
+
+static void fws_put(fws_writer_t *writer, const void *data, size_t size, jfs_err_t *err);
+static void fws_flush(fws_writer_t *writer, jfs_err_t *err);
+static void fws_write_dirs(fws_writer_t *writer, const jfs_fw_record_t *record, const fws_layout_t *layout, jfs_err_t *err);
+static void fws_write_files(fws_writer_t *writer, const jfs_fw_record_t *record, const fws_layout_t *layout, size_t names_start, jfs_err_t *err);
+static void fws_write_names(fws_writer_t *writer, const jfs_fw_record_t *record, const fws_layout_t *layout, jfs_err_t *err);
+
+static bool fws_valid_header(const fws_header_t *header, const uint8_t *map, size_t map_size);
+static int  fws_name_cmp(const uint8_t *a, size_t a_len, const char *b, size_t b_len);
+static const uint8_t *fws_name_at(const jfs_fws_t *snapshot, size_t file_index, jfs_err_t *err) WUR;
+
+void jfs_fws_save(const jfs_fw_record_t *record, int fd, jfs_err_t *err) {
+    fws_layout_t layout = {0};
+    fws_writer_t writer = {.fd = fd, .buf = NULL, .used = 0};
+
+    fws_layout_init(&layout, record, err);
+    VOID_CHECK_ERR;
+
+    writer.buf = jfs_malloc(FWS_BUFFER_SIZE, err);
+    GOTO_IF_ERR(cleanup);
+
+    const size_t dirs_offset = sizeof(fws_header_t);
+    const size_t files_offset = dirs_offset + (record->dir_count * sizeof(jfs_fws_dir_t));
+    const size_t names_offset = files_offset + (layout.file_count * sizeof(jfs_fws_file_t));
+    const size_t names_start = record->start_path.len + 1;
+
+    const fws_header_t header = {
+        .magic = FWS_MAGIC,
+        .file_size = names_offset + names_start + layout.names_size,
+        .started_sec = record->started.tv_sec,
+        .started_nsec = record->started.tv_nsec,
+        .start_path_len = record->start_path.len,
+        .dir_count = record->dir_count,
+        .file_count = layout.file_count,
+        .dirs_offset = dirs_offset,
+        .files_offset = files_offset,
+        .names_offset = names_offset,
+        .names_size = names_start + layout.names_size,
+    };
+    fws_put(&writer, &header, sizeof(header), err);
+    GOTO_IF_ERR(cleanup);
+
+    fws_write_dirs(&writer, record, &layout, err);
+    GOTO_IF_ERR(cleanup);
+    fws_write_files(&writer, record, &layout, names_start, err);
+    GOTO_IF_ERR(cleanup);
+
+    fws_put(&writer, record->start_path.str, names_start, err); // with its nul
+    GOTO_IF_ERR(cleanup);
+    fws_write_names(&writer, record, &layout, err);
+    GOTO_IF_ERR(cleanup);
+
+    fws_flush(&writer, err);
+
+cleanup:
+    free(writer.buf);
+    fws_layout_free(&layout);
+}
+
+void jfs_fws_init(jfs_fws_t *snapshot_init, int fd, jfs_err_t *err) {
+    memset(snapshot_init, 0, sizeof(*snapshot_init));
+
+    struct stat file_stat = {0};
+    VOID_FAIL_IF(fstat(fd, &file_stat) != 0, JFS_ERR_SYS);
+    const size_t map_size = (size_t) file_stat.st_size;
+    VOID_FAIL_IF(map_size < sizeof(fws_header_t), JFS_ERR_FWS_SNAPSHOT);
+
+    uint8_t *const map = jfs_mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0, err);
+    VOID_CHECK_ERR;
+
+    fws_header_t header = {0};
+    memcpy(&header, map, sizeof(header));
+    if (!fws_valid_header(&header, map, map_size)) GOTO_WITH_ERR(cleanup, JFS_ERR_FWS_SNAPSHOT);
+
+    snapshot_init->map = map;
+    snapshot_init->map_size = map_size;
+    snapshot_init->names = map + header.names_offset;
+    snapshot_init->names_size = header.names_size;
+    snapshot_init->start_path = (const char *) snapshot_init->names;
+    snapshot_init->start_path_len = header.start_path_len;
+    snapshot_init->started = (struct timespec) {.tv_sec = header.started_sec, .tv_nsec = header.started_nsec};
+    snapshot_init->dir_count = header.dir_count;
+    snapshot_init->dir_array = (const jfs_fws_dir_t *) (const void *) (map + header.dirs_offset);
+    snapshot_init->file_count = header.file_count;
+    snapshot_init->file_array = (const jfs_fws_file_t *) (const void *) (map + header.files_offset);
+    return;
+
+cleanup:
+    munmap(map, map_size);
+}
+
+void jfs_fws_free(jfs_fws_t *snapshot_free) {
+    if (snapshot_free->map != NULL) munmap(snapshot_free->map, snapshot_free->map_size);
+    memset(snapshot_free, 0, sizeof(*snapshot_free));
+}
+
+size_t jfs_fws_file_name(const jfs_fws_t *snapshot, size_t file_index, char *buf, jfs_err_t *err) {
+    VAL_FAIL_IF(file_index >= snapshot->file_count, JFS_ERR_ARG, 0);
+
+    // back to the closest full name, the first file of every dir and every FWS_RESTART_INTERVAL after it has one
+    size_t restart = file_index;
+    for (;;) {
+        const uint8_t *const entry = fws_name_at(snapshot, restart, err);
+        VAL_CHECK_ERR(0);
+        if (entry[0] == 0) break;
+        VAL_FAIL_IF(restart == 0 || file_index - restart >= FWS_RESTART_INTERVAL, JFS_ERR_FWS_SNAPSHOT, 0);
+        restart -= 1;
+    }
+
+    size_t len = 0;
+    for (size_t i = restart; i <= file_index; i++) {
+        const uint8_t *const entry = fws_name_at(snapshot, i, err);
+        VAL_CHECK_ERR(0);
+        VAL_FAIL_IF(entry[0] > len || entry[1] > NAME_MAX - entry[0], JFS_ERR_FWS_SNAPSHOT, 0);
+        memcpy(&buf[entry[0]], &entry[FWS_NAME_HEADER], entry[1]);
+        len = (size_t) entry[0] + entry[1];
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+size_t jfs_fws_find(const jfs_fws_t *snapshot, size_t dir_index, const char *name, jfs_err_t *err) {
+    VAL_FAIL_IF(dir_index >= snapshot->dir_count, JFS_ERR_ARG, JFS_FWS_NONE);
+    const jfs_fws_dir_t *const dir = &snapshot->dir_array[dir_index];
+    VAL_FAIL_IF(dir->first_file > snapshot->file_count || dir->file_count > snapshot->file_count - dir->first_file, JFS_ERR_FWS_SNAPSHOT,
+                JFS_FWS_NONE);
+
+    const size_t name_len = strlen(name);
+    if (name_len > NAME_MAX || dir->file_count == 0) return JFS_FWS_NONE;
+
+    // the last full name that isn't past name, its block is the only one name can be in
+    size_t low = 0;
+    size_t high = ((dir->file_count - 1) / FWS_RESTART_INTERVAL) + 1;
+    while (high - low > 1) {
+        const size_t         mid = low + ((high - low) / 2);
+        const uint8_t *const entry = fws_name_at(snapshot, dir->first_file + (mid * FWS_RESTART_INTERVAL), err);
+        VAL_CHECK_ERR(JFS_FWS_NONE);
+
+        if (fws_name_cmp(&entry[FWS_NAME_HEADER], entry[1], name, name_len) <= 0) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    const size_t block_start = low * FWS_RESTART_INTERVAL;
+    const size_t block_end = block_start + FWS_RESTART_INTERVAL < dir->file_count ? block_start + FWS_RESTART_INTERVAL : dir->file_count;
+    uint8_t      decoded[NAME_MAX + 1];
+    size_t       len = 0;
+    for (size_t i = block_start; i < block_end; i++) {
+        const uint8_t *const entry = fws_name_at(snapshot, dir->first_file + i, err);
+        VAL_CHECK_ERR(JFS_FWS_NONE);
+        VAL_FAIL_IF(entry[0] > len || entry[1] > NAME_MAX - entry[0], JFS_ERR_FWS_SNAPSHOT, JFS_FWS_NONE);
+        memcpy(&decoded[entry[0]], &entry[FWS_NAME_HEADER], entry[1]);
+        len = (size_t) entry[0] + entry[1];
+
+        const int cmp = fws_name_cmp(decoded, len, name, name_len);
+        if (cmp == 0) return dir->first_file + i;
+        if (cmp > 0) break;
+    }
+    return JFS_FWS_NONE;
+}
+
+void jfs_fws_dir_path(const jfs_fws_t *snapshot, size_t dir_index, jfs_fio_path_buf_t *buf, jfs_err_t *err) {
+    VOID_FAIL_IF(dir_index >= snapshot->dir_count, JFS_ERR_ARG);
+
+    // names are copied in back to front at the end of buf, then slid up behind the start path
+    const size_t top_sep = snapshot->start_path_len > 0 && snapshot->start_path[snapshot->start_path_len - 1] == '/' ? 0 : 1;
+    char         name[NAME_MAX + 1];
+    size_t       pos = PATH_MAX;
+    size_t       depth = 0;
+    for (size_t i = dir_index; snapshot->dir_array[i].parent != JFS_FWS_NONE; i = snapshot->dir_array[i].parent) {
+        const jfs_fws_dir_t *const dir = &snapshot->dir_array[i];
+        VOID_FAIL_IF(dir->parent >= snapshot->dir_count || ++depth > snapshot->dir_count, JFS_ERR_FWS_SNAPSHOT);
+
+        const size_t len = jfs_fws_file_name(snapshot, dir->entry, name, err);
+        VOID_CHECK_ERR;
+        VOID_FAIL_IF(len + 1 + snapshot->start_path_len > pos, JFS_ERR_FIO_PATH_OVERFLOW);
+        pos -= len;
+        memcpy(&buf->data[pos], name, len);
+        buf->data[--pos] = '/';
+    }
+
+    if (pos < PATH_MAX && top_sep == 0) pos += 1;
+    const size_t tail = PATH_MAX - pos;
+    memmove(&buf->data[snapshot->start_path_len], &buf->data[pos], tail);
+    memcpy(buf->data, snapshot->start_path, snapshot->start_path_len);
+    buf->len = snapshot->start_path_len + tail;
+    buf->data[buf->len] = '\0';
+}
+
+static void fws_layout_init(fws_layout_t *layout_init, const jfs_fw_record_t *record, jfs_err_t *err) {
+    memset(layout_init, 0, sizeof(*layout_init));
+
+    for (size_t i = 0; i < record->dir_count; i++) {
+        layout_init->file_count += record->dir_array[i].file_count;
+    }
+    const size_t file_size = layout_init->file_count > 0 ? layout_init->file_count : 1;
+    const size_t dir_size = record->dir_count > 0 ? record->dir_count : 1;
+
+    layout_init->order = jfs_malloc(sizeof(*layout_init->order) * file_size, err);
+    GOTO_IF_ERR(cleanup);
+    layout_init->child = jfs_malloc(sizeof(*layout_init->child) * file_size, err);
+    GOTO_IF_ERR(cleanup);
+    layout_init->first_file = jfs_malloc(sizeof(*layout_init->first_file) * dir_size, err);
+    GOTO_IF_ERR(cleanup);
+    layout_init->entry = jfs_malloc(sizeof(*layout_init->entry) * dir_size, err);
+    GOTO_IF_ERR(cleanup);
+
+    size_t position = 0;
+    for (size_t i = 0; i < record->dir_count; i++) {
+        const jfs_fw_dir_t *const dir = &record->dir_array[i];
+        layout_init->first_file[i] = position;
+        for (size_t j = 0; j < dir->file_count; j++) {
+            if (dir->files[j].name.len > NAME_MAX) GOTO_WITH_ERR(cleanup, JFS_ERR_ARG);
+            layout_init->order[position + j] = &dir->files[j];
+            layout_init->child[position + j] = JFS_FWS_NONE;
+        }
+        qsort(&layout_init->order[position], dir->file_count, sizeof(*layout_init->order), fws_file_cmp);
+
+        for (size_t j = 0; j < dir->file_count; j++) {
+            const jfs_fw_file_t *const prev = j > 0 ? layout_init->order[position + j - 1] : NULL;
+            const jfs_fw_file_t *const file = layout_init->order[position + j];
+            layout_init->names_size += FWS_NAME_HEADER + file->name.len - fws_shared_len(prev, file, j);
+        }
+        position += dir->file_count;
+    }
+
+    // a dir is named by its entry in the parent's listing, which in turn points back at the dir
+    for (size_t i = 0; i < record->dir_count; i++) {
+        const jfs_fw_dir_t *const dir = &record->dir_array[i];
+        layout_init->entry[i] = JFS_FWS_NONE;
+        if (dir->parent == JFS_FW_NO_PARENT) continue;
+
+        const size_t found = fws_layout_find(layout_init, record, dir->parent, &dir->name);
+        if (found == JFS_FWS_NONE) GOTO_WITH_ERR(cleanup, JFS_ERR_ARG);
+        layout_init->entry[i] = found;
+        layout_init->child[found] = i;
+    }
+    return;
+
+cleanup:
+    fws_layout_free(layout_init);
+}
+
+static void fws_layout_free(fws_layout_t *layout_free) {
+    free(layout_free->order);
+    free(layout_free->child);
+    free(layout_free->first_file);
+    free(layout_free->entry);
+    memset(layout_free, 0, sizeof(*layout_free));
+}
+
+static int fws_file_cmp(const void *a, const void *b) {
+    const jfs_fw_file_t *const file_a = *(const jfs_fw_file_t *const *) a;
+    const jfs_fw_file_t *const file_b = *(const jfs_fw_file_t *const *) b;
+    return strcmp(file_a->name.str, file_b->name.str);
+}
+
+// position in layout order of the file called name in dir, JFS_FWS_NONE when there is none
+static size_t fws_layout_find(const fws_layout_t *layout, const jfs_fw_record_t *record, size_t dir, const jfs_fio_name_t *name) {
+    const jfs_fw_file_t *const key_file = &(jfs_fw_file_t) {.name = *name};
+    const jfs_fw_file_t *const *const first = &layout->order[layout->first_file[dir]];
+    const jfs_fw_file_t *const *const found = bsearch(&key_file, first, record->dir_array[dir].file_count, sizeof(*first), fws_file_cmp);
+    return found != NULL ? layout->first_file[dir] + (size_t) (found - first) : JFS_FWS_NONE;
+}
+
+// prefix taken over from the name before, none at the start of each restart block
+static size_t fws_shared_len(const jfs_fw_file_t *prev, const jfs_fw_file_t *file, size_t position) {
+    if (prev == NULL || position % FWS_RESTART_INTERVAL == 0) return 0;
+
+    size_t shared = 0;
+    while (shared < prev->name.len && shared < file->name.len && prev->name.str[shared] == file->name.str[shared]) {
+        shared++;
+    }
+    return shared;
+}
+
+static void fws_put(fws_writer_t *writer, const void *data, size_t size, jfs_err_t *err) {
+    const uint8_t *src = data;
+    while (size > 0) {
+        if (writer->used == FWS_BUFFER_SIZE) {
+            fws_flush(writer, err);
+            VOID_CHECK_ERR;
+        }
+
+        const size_t room = FWS_BUFFER_SIZE - writer->used;
+        const size_t chunk = size < room ? size : room;
+        memcpy(&writer->buf[writer->used], src, chunk);
+        writer->used += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+static void fws_flush(fws_writer_t *writer, jfs_err_t *err) {
+    (void) jfs_fio_write(writer->fd, writer->buf, writer->used, err);
+    VOID_CHECK_ERR;
+    writer->used = 0;
+}
+
+static void fws_write_dirs(fws_writer_t *writer, const jfs_fw_record_t *record, const fws_layout_t *layout, jfs_err_t *err) {
+    for (size_t i = 0; i < record->dir_count; i++) {
+        const jfs_fw_dir_t *const record_dir = &record->dir_array[i];
+        const jfs_fws_dir_t       dir = {
+                  .parent = record_dir->parent != JFS_FW_NO_PARENT ? record_dir->parent : JFS_FWS_NONE,
+                  .entry = layout->entry[i],
+                  .first_file = layout->first_file[i],
+                  .file_count = record_dir->file_count,
+                  .inode = record_dir->inode,
+                  .mtime_sec = record_dir->mtime.tv_sec,
+                  .mtime_nsec = record_dir->mtime.tv_nsec,
+        };
+        fws_put(writer, &dir, sizeof(dir), err);
+        VOID_CHECK_ERR;
+    }
+}
+
+static void fws_write_files(fws_writer_t *writer, const jfs_fw_record_t *record, const fws_layout_t *layout, size_t names_start, jfs_err_t *err) {
+    size_t name = names_start;
+    for (size_t i = 0; i < record->dir_count; i++) {
+        const size_t first = layout->first_file[i];
+        for (size_t j = 0; j < record->dir_array[i].file_count; j++) {
+            const jfs_fw_file_t *const prev = j > 0 ? layout->order[first + j - 1] : NULL;
+            const jfs_fw_file_t *const record_file = layout->order[first + j];
+            const jfs_fws_file_t       file = {
+                      .inode = record_file->inode,
+                      .size = record_file->size,
+                      .mtime_sec = record_file->mtime.tv_sec,
+                      .mtime_nsec = (uint32_t) record_file->mtime.tv_nsec,
+                      .mode = record_file->mode,
+                      .dir = layout->child[first + j],
+                      .name = name,
+                      .type = record_file->type,
+                      .reserved = 0,
+            };
+            fws_put(writer, &file, sizeof(file), err);
+            VOID_CHECK_ERR;
+            name += FWS_NAME_HEADER + record_file->name.len - fws_shared_len(prev, record_file, j);
+        }
+    }
+}
+
+static void fws_write_names(fws_writer_t *writer, const jfs_fw_record_t *record, const fws_layout_t *layout, jfs_err_t *err) {
+    for (size_t i = 0; i < record->dir_count; i++) {
+        const size_t first = layout->first_file[i];
+        for (size_t j = 0; j < record->dir_array[i].file_count; j++) {
+            const jfs_fw_file_t *const prev = j > 0 ? layout->order[first + j - 1] : NULL;
+            const jfs_fw_file_t *const file = layout->order[first + j];
+            const size_t               shared = fws_shared_len(prev, file, j);
+            const uint8_t              name_header[FWS_NAME_HEADER] = {(uint8_t) shared, (uint8_t) (file->name.len - shared)};
+
+            fws_put(writer, name_header, sizeof(name_header), err);
+            VOID_CHECK_ERR;
+            fws_put(writer, &file->name.str[shared], file->name.len - shared, err);
+            VOID_CHECK_ERR;
+        }
+    }
+}
+
+// every table has to sit exactly where the counts put it, nothing past the header is looked at here
+static bool fws_valid_header(const fws_header_t *header, const uint8_t *map, size_t map_size) {
+    if (header->magic != FWS_MAGIC || header->file_size != map_size) return false;
+    if (header->dirs_offset != sizeof(*header) || header->dir_count == 0) return false;
+    if (header->dir_count > (map_size - header->dirs_offset) / sizeof(jfs_fws_dir_t)) return false;
+    if (header->files_offset != header->dirs_offset + (header->dir_count * sizeof(jfs_fws_dir_t))) return false;
+    if (header->file_count > (map_size - header->files_offset) / sizeof(jfs_fws_file_t)) return false;
+    if (header->names_offset != header->files_offset + (header->file_count * sizeof(jfs_fws_file_t))) return false;
+    if (header->names_size != map_size - header->names_offset) return false;
+    if (header->start_path_len > PATH_MAX || header->start_path_len >= header->names_size) return false;
+    return map[header->names_offset + header->start_path_len] == '\0';
+}
+
+static int fws_name_cmp(const uint8_t *a, size_t a_len, const char *b, size_t b_len) {
+    const int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0) return cmp;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+// the entry's header and suffix are checked against the names area, the file is otherwise taken as written
+static const uint8_t *fws_name_at(const jfs_fws_t *snapshot, size_t file_index, jfs_err_t *err) {
+    const uint64_t offset = snapshot->file_array[file_index].name;
+    NULL_FAIL_IF(offset > snapshot->names_size || snapshot->names_size - offset < FWS_NAME_HEADER, JFS_ERR_FWS_SNAPSHOT);
+
+    const uint8_t *const entry = &snapshot->names[offset];
+    NULL_FAIL_IF(entry[1] > snapshot->names_size - offset - FWS_NAME_HEADER, JFS_ERR_FWS_SNAPSHOT);
+    return entry;
+}
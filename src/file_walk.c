@@ -1,22 +1,108 @@
+#define _GNU_SOURCE // AT_EMPTY_PATH
+
 #include "file_walk.h"
 #include "error.h"
+#include "io_ring.h"
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/stat.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#define FW_PENDING_VECTOR_DEFAULT_CAPACITY 16
+#define FW_FILE_VECTOR_DEFAULT_CAPACITY    16
+#define FW_DIR_VECTOR_DEFAULT_CAPACITY     16
+
+#define FW_DENTS_SIZE       ((size_t) 65536)                      // 64 kb, a few thousand entries per getdents64 call
+#define FW_START_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC) // the start path may be a symlink
+#define FW_OPEN_FLAGS       (FW_START_OPEN_FLAGS | O_NOFOLLOW)   // a dir swapped for a symlink mid walk is skipped, not followed
+#define FW_BLOCK_SIZE       ((size_t) 1 << 20)                   // 1 mb, a few thousand dirs worth of names per malloc
+
+#define FW_RING_ENTRIES 256 // statx in flight per scanner
+#define FW_STATX_MASK   (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME)
+#define FW_STATX_FLAGS  AT_SYMLINK_NOFOLLOW
+
+// a dir modified this close to the previous walk's start may have changed again within the same timestamp,
+// two seconds covers the coarsest common filesystems
+#define FW_RACY_SECONDS 2
+
+typedef struct fw_pending        fw_pending_t;
+typedef struct fw_pending_vector fw_pending_vector_t;
+typedef struct fw_file_vector    fw_file_vector_t;
+typedef struct fw_dir_vector     fw_dir_vector_t;
+typedef struct fw_dir_fd         fw_dir_fd_t;
+typedef struct fw_scanner        fw_scanner_t;
+typedef struct fw_worker         fw_worker_t;
+typedef struct fw_walk           fw_walk_t;
+typedef struct fw_dirent64       fw_dirent64_t;
+typedef struct fw_block_mark     fw_block_mark_t;
+typedef struct fw_frame          fw_frame_t;
+typedef struct fw_visitor        fw_visitor_t;
+typedef struct fw_prev_child     fw_prev_child_t;
+typedef struct fw_prev           fw_prev_t;
+
+// the record layout getdents64 fills the buffer with, glibc doesn't export it
+struct fw_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
 
-#define FW_PATH_VECTOR_DEFAULT_CAPACITY 16
-#define FW_FILE_VECTOR_DEFAULT_CAPACITY 16
-#define FW_DIR_VECTOR_DEFAULT_CAPACITY  16
+// names and file arrays are bump allocated out of these and only freed with the whole record
+struct jfs_fw_block {
+    jfs_fw_block_t *next;
+    size_t          size; // of data
+    size_t          used;
+    uint8_t         data[];
+};
 
-typedef struct fw_path_vector fw_path_vector_t;
-typedef struct fw_file_vector fw_file_vector_t;
-typedef struct fw_dir_vector  fw_dir_vector_t;
+// everything allocated after it was taken is dropped by fw_block_reset
+struct fw_block_mark {
+    jfs_fw_block_t *block;
+    size_t          used;
+};
 
-struct fw_path_vector {
-    size_t          count;
-    size_t          capacity;
-    jfs_fio_path_t *path_array;
+// a scanned dir stays open while any of its subdirectories still has to be opened relative to it
+struct fw_dir_fd {
+    int           fd;
+    atomic_size_t refs;
+};
+
+// a directory that was found but not scanned yet
+struct fw_pending {
+    fw_dir_fd_t   *parent;    // NULL for the start dir, which is opened by its full path, and under trusted trees
+    size_t         parent_id; // id of the parent's jfs_fw_dir_t, JFS_FW_NO_PARENT for the start dir
+    size_t         prev_id;   // same dir in the previous record, JFS_FW_NO_PARENT when there is none
+    jfs_fio_name_t name;      // relative to parent, points into the scanner's blocks
+};
+
+struct fw_prev_child {
+    const char *name;
+    size_t      index;
+};
+
+// the previous record's dirs grouped by parent and sorted by name, so a subdir finds its old self by binary search
+struct fw_prev {
+    const jfs_fw_record_t *record;
+    const jfs_fw_trust_t  *trust;       // NULL when every dir has to be checked
+    size_t                 root;        // JFS_FW_NO_PARENT when the record is of another start path
+    size_t                *child_start; // children of dir i are child_start[i] up to child_start[i + 1]
+    fw_prev_child_t       *children;
+};
+
+struct fw_pending_vector {
+    size_t        count;
+    size_t        capacity;
+    fw_pending_t *pending_array;
 };
 
 struct fw_file_vector {
@@ -31,58 +117,160 @@ struct fw_dir_vector {
     jfs_fw_dir_t *dir_array;
 };
 
+// what one thread needs to scan dirs, the single threaded state has one and so does every walk worker
+struct fw_scanner {
+    const jfs_fio_path_t *start_path;
+    const fw_prev_t      *prev; // NULL unless the walk is incremental
+    fw_pending_vector_t  *found; // subdirectories get pushed here
+    fw_dir_vector_t       dir_vec;
+    jfs_fw_block_t       *blocks;   // owns the names and file arrays of dir_vec
+    fw_file_vector_t      file_vec; // entries of the dir being scanned, reused for every dir
+    uint8_t              *dents;    // FW_DENTS_SIZE scan buffer reused for every dir
+    bool                  stat;     // fill in the metadata of every scanned entry
+    bool                  ring_ok;  // otherwise one statx call per entry
+    jfs_ior_t             ring;
+    struct statx         *stx; // one per entry of the dir being scanned
+    size_t                stx_capacity;
+    size_t                id_base;   // a dir's id is its dir_vec index * id_stride + id_base,
+    size_t                id_stride; // unique across workers until the walk renumbers them into one array
+};
+
 struct jfs_fw_state {
-    fw_path_vector_t path_vec;
-    fw_dir_vector_t  dir_vec;
+    jfs_fio_path_t      start_path;
+    struct timespec     started;
+    fw_pending_vector_t pending_vec;
+    fw_scanner_t        scanner;
 };
 
-static jfs_fw_types_t fw_map_dirent_type(unsigned char ent_type, jfs_err_t *err);
-static void           fw_file_init(jfs_fw_file_t *file_init, const struct dirent *ent, jfs_err_t *err);
-static void           fw_dir_init(jfs_fw_dir_t *dir_init, fw_file_vector_t *vec_free, jfs_fio_path_t *path_free, jfs_err_t *err);
+// one per thread of a parallel walk, the owner works the top of pending (depth first) and thieves take the bottom
+struct fw_worker {
+    fw_walk_t          *walk;
+    pthread_t           thread;
+    pthread_mutex_t     lock; // guards pending and bottom
+    fw_pending_vector_t pending;
+    size_t              bottom; // entries below this were stolen
+    fw_pending_vector_t found;  // subdirectories of the dir being scanned, moved to pending once it's done
+    fw_scanner_t        scanner;
+};
 
-static void fw_path_vector_init(fw_path_vector_t *vec_init, jfs_err_t *err);
-static void fw_path_vector_free(fw_path_vector_t *vec_free);
-static void fw_path_vector_push(fw_path_vector_t *vec, jfs_fio_path_t *path_free, jfs_err_t *err);
-static void fw_path_vector_pop(fw_path_vector_t *vec, jfs_fio_path_t *path_init, jfs_err_t *err);
+struct fw_walk {
+    struct timespec started;
+    fw_prev_t       prev;
+    fw_worker_t    *workers;
+    size_t        worker_count;
+    atomic_size_t pending; // dirs queued or being scanned, the walk is over when it hits 0
+    atomic_bool   failed;
+    jfs_err_t     err; // set by whoever flips failed
+
+    // workers out of work sleep here until something is published, pending hits 0 or the walk fails
+    pthread_mutex_t idle_lock;
+    pthread_cond_t  idle_cond;
+    atomic_size_t   idle_count;
+    atomic_size_t   publish_count; // bumped after every publish so a sleeper can tell it missed one
+};
 
-static void           fw_file_vector_init(fw_file_vector_t *vec_init, jfs_err_t *err);
-static void           fw_file_vector_free(fw_file_vector_t *vec_free);
-static void           fw_file_vector_push(fw_file_vector_t *vec, jfs_fw_file_t *file_free, jfs_err_t *err);
-static jfs_fw_file_t *fw_file_vector_to_array(fw_file_vector_t *vec_free, jfs_err_t *err) WUR;
+// a dir on the visitor's current descent, kept open until all of its subdirs have been visited
+struct fw_frame {
+    int             fd;
+    size_t          id; // visit number, the parent of its subdirs
+    size_t          depth;
+    size_t          path_len;
+    jfs_fw_file_t  *subdirs; // in the scanner's blocks, released with everything after mark when the frame pops
+    size_t          subdir_count;
+    size_t          next;
+    fw_block_mark_t mark;
+};
+
+struct fw_visitor {
+    fw_scanner_t       scanner;
+    fw_frame_t        *frames;
+    size_t             frame_count;
+    size_t             frame_capacity;
+    jfs_fio_path_buf_t path;
+    size_t             visited;
+    jfs_fw_visit_fn    visit;
+    void              *ctx;
+    bool               stopped;
+};
+
+static jfs_fw_types_t fw_map_dirent_type(unsigned char ent_type, jfs_err_t *err);
+static jfs_fw_types_t fw_resolve_type(int dir_fd, const char *name, jfs_err_t *err);
+static void           fw_file_init(jfs_fw_file_t *file_init, int dir_fd, const fw_dirent64_t *ent, jfs_fw_block_t **blocks, jfs_err_t *err);
+static void           fw_dir_init(jfs_fw_dir_t *dir_init, const fw_file_vector_t *vec, jfs_fw_block_t **blocks, fw_pending_t *pending_free, jfs_err_t *err);
+
+static void *fw_block_alloc(jfs_fw_block_t **blocks, size_t size, size_t align, jfs_err_t *err) WUR;
+static void  fw_block_free_all(jfs_fw_block_t *blocks_move);
+static void  fw_block_splice(jfs_fw_block_t **blocks, jfs_fw_block_t **blocks_move);
+static void  fw_block_get_mark(const jfs_fw_block_t *blocks, fw_block_mark_t *mark_init);
+static void  fw_block_reset(jfs_fw_block_t **blocks, const fw_block_mark_t *mark);
+
+static void         fw_pending_free(fw_pending_t *pending_free);
+static void         fw_pending_transfer(fw_pending_t *pending_init, fw_pending_t *pending_free);
+static fw_dir_fd_t *fw_dir_fd_create(int fd, jfs_err_t *err) WUR;
+static void         fw_dir_fd_release(fw_dir_fd_t *dir_fd_move);
+
+static void fw_pending_vector_init(fw_pending_vector_t *vec_init, jfs_err_t *err);
+static void fw_pending_vector_free(fw_pending_vector_t *vec_free);
+static void fw_pending_vector_push(fw_pending_vector_t *vec, fw_pending_t *pending_free, jfs_err_t *err);
+static void fw_pending_vector_pop(fw_pending_vector_t *vec, fw_pending_t *pending_init, jfs_err_t *err);
+
+static void fw_file_vector_init(fw_file_vector_t *vec_init, jfs_err_t *err);
+static void fw_file_vector_free(fw_file_vector_t *vec_free);
+static void fw_file_vector_push(fw_file_vector_t *vec, jfs_fw_file_t *file_free, jfs_err_t *err);
 
 static void          fw_dir_vector_init(fw_dir_vector_t *vec_init, jfs_err_t *err);
 static void          fw_dir_vector_free(fw_dir_vector_t *vec_free);
 static void          fw_dir_vector_push(fw_dir_vector_t *vec, jfs_fw_dir_t *dir_free, jfs_err_t *err);
 static jfs_fw_dir_t *fw_dir_vector_to_array(fw_dir_vector_t *vec_free, jfs_err_t *err) WUR;
 
-static void fw_scan_dir(DIR *dir, fw_file_vector_t *vec, jfs_err_t *err);
-static void fw_handle_dirent(const struct dirent *ent, fw_file_vector_t *vec, jfs_err_t *err);
-static void fw_push_dir_paths(fw_path_vector_t *path_vec, fw_file_vector_t *file_vec, const jfs_fio_path_t *dir_path, jfs_err_t *err);
-
-void jfs_fw_file_free(jfs_fw_file_t *file_free) {
-    jfs_fio_name_free(&file_free->name);
-    memset(file_free, 0, sizeof(*file_free));
-}
+static void fw_scanner_init(fw_scanner_t *scanner_init, const jfs_fio_path_t *start_path, fw_pending_vector_t *found, jfs_err_t *err);
+static void fw_scanner_free(fw_scanner_t *scanner_free);
+static void fw_scanner_enable_stat(fw_scanner_t *scanner, jfs_err_t *err);
+static void fw_process_dir(fw_scanner_t *scanner, fw_pending_t *pending_free, jfs_err_t *err);
+static void fw_scan_dir(int dir_fd, fw_scanner_t *scanner, jfs_err_t *err);
+static bool fw_is_dot_name(const char *name);
+static void fw_handle_dirent(int dir_fd, const fw_dirent64_t *ent, fw_scanner_t *scanner, jfs_err_t *err);
+static void fw_push_subdirs(fw_scanner_t *scanner, int *fd_move, size_t dir_id, size_t prev_id, jfs_err_t *err);
+
+static void   fw_prev_init(fw_prev_t *prev_init, const jfs_fw_record_t *record, const jfs_fio_path_t *start_path, jfs_err_t *err);
+static void   fw_prev_free(fw_prev_t *prev_free);
+static int    fw_prev_child_cmp(const void *a, const void *b);
+static size_t fw_prev_find(const fw_prev_t *prev, size_t parent_index, const char *name);
+static bool   fw_prev_unchanged(const fw_prev_t *prev, size_t index, const struct statx *dir_stx);
+static jfs_fw_trust_t fw_prev_trust(const fw_prev_t *prev, size_t index);
+static void   fw_reuse_files(fw_scanner_t *scanner, const jfs_fw_dir_t *old_dir, jfs_err_t *err);
+
+static void fw_stat_files(fw_scanner_t *scanner, int dir_fd, jfs_err_t *err);
+static void fw_stat_ring(fw_scanner_t *scanner, int dir_fd, jfs_err_t *err);
+static void fw_stat_each(fw_scanner_t *scanner, int dir_fd, jfs_err_t *err);
+static void fw_file_set_stat(jfs_fw_file_t *file, const struct statx *stx);
+
+static size_t fw_walk_thread_count(const jfs_fw_conf_t *conf);
+static void   fw_walk_fail(fw_walk_t *walk, jfs_err_t walk_err);
+static void   fw_walk_wait(fw_walk_t *walk, size_t seen_publish_count);
+static void   fw_walk_wake(fw_walk_t *walk, size_t count);
+static void   fw_walk_collect(jfs_fw_record_t *record_init, fw_walk_t *walk, const jfs_fio_path_t *start_path, jfs_err_t *err);
+static void   fw_walk_free(fw_walk_t *walk);
+
+static void  fw_worker_init(fw_worker_t *worker_init, fw_walk_t *walk, const jfs_fio_path_t *start_path, jfs_err_t *err);
+static void  fw_worker_free(fw_worker_t *worker_free);
+static void *fw_worker_run(void *worker_ptr);
+static bool  fw_worker_pop(fw_worker_t *worker, fw_pending_t *pending_init);
+static bool  fw_worker_steal(fw_worker_t *worker, fw_pending_t *pending_init);
+static void  fw_worker_publish(fw_worker_t *worker, jfs_err_t *err);
+
+static void fw_visitor_init(fw_visitor_t *visitor_init, const jfs_fio_path_t *start_path, jfs_fw_visit_fn visit, void *ctx, jfs_err_t *err);
+static void fw_visitor_free(fw_visitor_t *visitor_free);
+static void fw_visitor_enter(fw_visitor_t *visitor, int fd_move, const jfs_fio_name_t *name, size_t parent_id, size_t depth, jfs_err_t *err);
+static void fw_visitor_push_frame(fw_visitor_t *visitor, fw_frame_t *frame, jfs_err_t *err);
+static void fw_visitor_pop_frame(fw_visitor_t *visitor);
+static void fw_visitor_next(fw_visitor_t *visitor, jfs_err_t *err);
 
 void jfs_fw_file_transfer(jfs_fw_file_t *file_init, jfs_fw_file_t *file_free) {
     *file_init = *file_free;
     memset(file_free, 0, sizeof(*file_free));
 }
 
-void jfs_fw_dir_free(jfs_fw_dir_t *dir_free) {
-    if (dir_free->files != NULL) {
-        for (size_t i = 0; i < dir_free->file_count; i++) {
-            jfs_fw_file_free(&dir_free->files[i]);
-        }
-
-        free(dir_free->files);
-    }
-
-    jfs_fio_path_free(&dir_free->path);
-
-    memset(dir_free, 0, sizeof(*dir_free));
-}
-
 void jfs_fw_dir_transfer(jfs_fw_dir_t *dir_init, jfs_fw_dir_t *dir_free) {
     *dir_init = *dir_free;
     memset(dir_free, 0, sizeof(*dir_free));
@@ -90,107 +278,208 @@ void jfs_fw_dir_transfer(jfs_fw_dir_t *dir_init, jfs_fw_dir_t *dir_free) {
 
 jfs_fw_state_t *jfs_fw_state_create(const jfs_fio_path_t *start_path, jfs_err_t *err) {
     jfs_fw_state_t *state = NULL;
-    jfs_fio_path_t  new_path = {0};
+    fw_pending_t    start = {.parent = NULL, .parent_id = JFS_FW_NO_PARENT, .prev_id = JFS_FW_NO_PARENT, .name = {0}};
 
     state = jfs_malloc(sizeof(*state), err);
     GOTO_IF_ERR(cleanup);
+    memset(state, 0, sizeof(*state));
+    clock_gettime(CLOCK_REALTIME, &state->started);
 
-    fw_path_vector_init(&state->path_vec, err);
+    jfs_fio_path_init(&state->start_path, start_path->str, err);
     GOTO_IF_ERR(cleanup);
 
-    fw_dir_vector_init(&state->dir_vec, err);
+    fw_pending_vector_init(&state->pending_vec, err);
     GOTO_IF_ERR(cleanup);
 
-    jfs_fio_path_init(&new_path, start_path->str, err);
+    fw_scanner_init(&state->scanner, &state->start_path, &state->pending_vec, err);
     GOTO_IF_ERR(cleanup);
 
-    fw_path_vector_push(&state->path_vec, &new_path, err);
+    fw_pending_vector_push(&state->pending_vec, &start, err);
     GOTO_IF_ERR(cleanup);
 
     return state;
 cleanup:
-    if (state != NULL) {
-        fw_dir_vector_free(&state->dir_vec);
-        fw_path_vector_free(&state->path_vec);
-        free(state);
-    }
-
-    jfs_fio_path_free(&new_path);
+    jfs_fw_state_destroy(state);
     NULL_RETURN_ERR;
 }
 
 void jfs_fw_state_destroy(jfs_fw_state_t *state_move) {
     if (state_move == NULL) return;
 
-    fw_path_vector_free(&state_move->path_vec);
-    fw_dir_vector_free(&state_move->dir_vec);
+    fw_pending_vector_free(&state_move->pending_vec);
+    fw_scanner_free(&state_move->scanner);
+    jfs_fio_path_free(&state_move->start_path);
 
     free(state_move);
 }
 
-int jfs_fw_state_step(jfs_fw_state_t *state, jfs_err_t *err) { // NOLINT(readability-function-cognitive-complexity)
-    if (state->path_vec.count == 0) return 1;
+int jfs_fw_state_step(jfs_fw_state_t *state, jfs_err_t *err) {
+    if (state->pending_vec.count == 0) return 1;
 
-    fw_file_vector_t file_vec = {0};
-    jfs_fio_path_t   dir_path = {0};
-    jfs_fw_dir_t     dir = {0};
-    DIR             *sys_dir = NULL;
+    fw_pending_t pending = {0};
+    fw_pending_vector_pop(&state->pending_vec, &pending, err);
+    VAL_CHECK_ERR(state->pending_vec.count == 0);
 
-    fw_file_vector_init(&file_vec, err);
-    GOTO_IF_ERR(cleanup);
+    fw_process_dir(&state->scanner, &pending, err);
+    VAL_CHECK_ERR(state->pending_vec.count == 0);
 
-    fw_path_vector_pop(&state->path_vec, &dir_path, err);
-    GOTO_IF_ERR(cleanup);
+    return state->pending_vec.count > 0;
+}
+
+void jfs_fw_record_init(jfs_fw_record_t *record_init, jfs_fw_state_t *state_move, jfs_err_t *err) {
+    VOID_FAIL_IF(state_move->pending_vec.count > 0, JFS_ERR_FW_STATE);
+
+    size_t        new_dir_count = state_move->scanner.dir_vec.count;
+    jfs_fw_dir_t *new_dir_array = fw_dir_vector_to_array(&state_move->scanner.dir_vec, err);
+    VOID_CHECK_ERR;
+
+    record_init->dir_array = new_dir_array;
+    record_init->dir_count = new_dir_count;
+    record_init->started = state_move->started;
+    record_init->blocks = NULL;
+    fw_block_splice(&record_init->blocks, &state_move->scanner.blocks);
+    jfs_fio_path_transfer(&record_init->start_path, &state_move->start_path);
+
+    jfs_fw_state_destroy(state_move);
+}
+
+void jfs_fw_walk(jfs_fw_record_t *record_init, const jfs_fio_path_t *start_path, const jfs_fw_conf_t *conf, jfs_err_t *err) {
+    fw_walk_t    walk = {0};
+    fw_pending_t start = {.parent = NULL, .parent_id = JFS_FW_NO_PARENT, .prev_id = JFS_FW_NO_PARENT, .name = {0}};
+    size_t       started = 0;
 
-    sys_dir = jfs_opendir(dir_path.str, err);
+    clock_gettime(CLOCK_REALTIME, &walk.started);
+    walk.worker_count = fw_walk_thread_count(conf);
+    atomic_init(&walk.pending, 0);
+    atomic_init(&walk.failed, false);
+    atomic_init(&walk.idle_count, 0);
+    atomic_init(&walk.publish_count, 0);
+    walk.err = JFS_OK;
+
+    jfs_mutex_init(&walk.idle_lock, NULL, err);
+    VOID_CHECK_ERR;
+    jfs_cond_init(&walk.idle_cond, NULL, err);
+    if (*err != JFS_OK) {
+        jfs_err_t destroy_err = JFS_OK;
+        jfs_mutex_destroy(&walk.idle_lock, &destroy_err);
+        VOID_RETURN_ERR;
+    }
+
+    walk.workers = jfs_malloc(sizeof(*walk.workers) * walk.worker_count, err);
     GOTO_IF_ERR(cleanup);
+    memset(walk.workers, 0, sizeof(*walk.workers) * walk.worker_count);
 
-    fw_scan_dir(sys_dir, &file_vec, err);
+    if (conf != NULL && conf->previous != NULL) {
+        fw_prev_init(&walk.prev, conf->previous, start_path, err);
+        GOTO_IF_ERR(cleanup);
+        walk.prev.trust = conf->trust;
+        start.prev_id = walk.prev.root;
+    }
+
+    for (size_t i = 0; i < walk.worker_count; i++) {
+        fw_worker_init(&walk.workers[i], &walk, start_path, err);
+        GOTO_IF_ERR(cleanup);
+        if (walk.prev.record != NULL) walk.workers[i].scanner.prev = &walk.prev;
+
+        if (conf != NULL && conf->stat) {
+            fw_scanner_enable_stat(&walk.workers[i].scanner, err);
+            GOTO_IF_ERR(cleanup);
+        }
+    }
+
+    // the start dir is scanned here so its errors come back exactly like jfs_fw_state_step's
+    fw_process_dir(&walk.workers[0].scanner, &start, err);
     GOTO_IF_ERR(cleanup);
 
-    fw_push_dir_paths(&state->path_vec, &file_vec, &dir_path, err);
+    // deal the top level out so every thread starts with work instead of stealing it one dir at a time
+    fw_pending_vector_t *const top = &walk.workers[0].found;
+    atomic_store(&walk.pending, top->count);
+    for (size_t i = 0; top->count > 0; i++) {
+        fw_worker_t *const worker = &walk.workers[i % walk.worker_count];
+        fw_pending_vector_push(&worker->pending, &top->pending_array[top->count - 1], err);
+        GOTO_IF_ERR(cleanup);
+        top->count -= 1;
+    }
+
+    // the calling thread is worker 0
+    for (started = 1; started < walk.worker_count; started++) {
+        if (pthread_create(&walk.workers[started].thread, NULL, fw_worker_run, &walk.workers[started]) != 0) {
+            fw_walk_fail(&walk, JFS_ERR_SYS);
+            break;
+        }
+    }
+    (void) fw_worker_run(&walk.workers[0]);
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(walk.workers[i].thread, NULL);
+    }
+    if (atomic_load(&walk.failed)) GOTO_WITH_ERR(cleanup, walk.err);
+
+    fw_walk_collect(record_init, &walk, start_path, err);
+
+cleanup:
+    fw_walk_free(&walk);
+}
+
+void jfs_fw_visit(const jfs_fio_path_t *start_path, jfs_fw_visit_fn visit, void *ctx, jfs_err_t *err) {
+    fw_visitor_t *visitor = NULL;
+    int           fd = -1;
+
+    visitor = jfs_malloc(sizeof(*visitor), err); // the path buffer is PATH_MAX, too much for some stacks
+    VOID_CHECK_ERR;
+    memset(visitor, 0, sizeof(*visitor));
+
+    fw_visitor_init(visitor, start_path, visit, ctx, err);
     GOTO_IF_ERR(cleanup);
 
-    fw_dir_init(&dir, &file_vec, &dir_path, err);
+    fd = jfs_openat(AT_FDCWD, start_path->str, FW_START_OPEN_FLAGS, err);
     GOTO_IF_ERR(cleanup);
 
-    fw_dir_vector_push(&state->dir_vec, &dir, err);
+    const jfs_fio_name_t start_name = {0};
+    fw_visitor_enter(visitor, fd, &start_name, JFS_FW_NO_PARENT, 0, err);
     GOTO_IF_ERR(cleanup);
 
-    closedir(sys_dir);
-    return state->path_vec.count > 0;
+    while (visitor->frame_count > 0 && !visitor->stopped) {
+        fw_visitor_next(visitor, err);
+        GOTO_IF_ERR(cleanup);
+    }
 
 cleanup:
-    if (sys_dir != NULL) closedir(sys_dir);
-    fw_file_vector_free(&file_vec);
-    jfs_fio_path_free(&dir_path);
-    jfs_fw_dir_free(&dir);
+    fw_visitor_free(visitor);
+    free(visitor);
     REMAP_ERR(JFS_ERR_ACCESS, JFS_ERR_FW_SKIP);
     REMAP_ERR(JFS_ERR_INVAL_PATH, JFS_ERR_FW_FAIL);
-    VAL_RETURN_ERR(state->path_vec.count == 0);
 }
 
-void jfs_fw_record_init(jfs_fw_record_t *record_init, jfs_fw_state_t *state_move, jfs_err_t *err) {
-    VOID_FAIL_IF(state_move->path_vec.count > 0, JFS_ERR_FW_STATE);
+void jfs_fw_record_dir_path(const jfs_fw_record_t *record, size_t dir_index, jfs_fio_path_buf_t *buf, jfs_err_t *err) {
+    VOID_FAIL_IF(dir_index >= record->dir_count, JFS_ERR_ARG);
 
-    size_t        new_dir_count = state_move->dir_vec.count;
-    jfs_fw_dir_t *new_dir_array = fw_dir_vector_to_array(&state_move->dir_vec, err);
-    VOID_CHECK_ERR;
+    // a start path of / already ends in the separator its children need
+    const jfs_fio_path_t *const start = &record->start_path;
+    const size_t                top_sep = start->len > 0 && start->str[start->len - 1] == '/' ? 0 : 1;
 
-    record_init->dir_array = new_dir_array;
-    record_init->dir_count = new_dir_count;
+    // measure first so the names can be copied in back to front without a stack
+    size_t len = start->len;
+    for (size_t i = dir_index; record->dir_array[i].parent != JFS_FW_NO_PARENT; i = record->dir_array[i].parent) {
+        const size_t sep = record->dir_array[record->dir_array[i].parent].parent != JFS_FW_NO_PARENT ? 1 : top_sep;
+        len += sep + record->dir_array[i].name.len;
+        VOID_FAIL_IF(len > PATH_MAX, JFS_ERR_FIO_PATH_OVERFLOW);
+    }
 
-    jfs_fw_state_destroy(state_move);
+    buf->len = len;
+    buf->data[len] = '\0';
+    for (size_t i = dir_index; record->dir_array[i].parent != JFS_FW_NO_PARENT; i = record->dir_array[i].parent) {
+        const jfs_fio_name_t *const name = &record->dir_array[i].name;
+        len -= name->len;
+        memcpy(&buf->data[len], name->str, name->len);
+        if (record->dir_array[record->dir_array[i].parent].parent != JFS_FW_NO_PARENT || top_sep == 1) buf->data[--len] = '/';
+    }
+    memcpy(buf->data, start->str, start->len);
 }
 
 void jfs_fw_record_free(jfs_fw_record_t *record_free) {
-    if (record_free->dir_array != NULL) {
-        for (size_t i = 0; i < record_free->dir_count; i++) {
-            jfs_fw_dir_free(&record_free->dir_array[i]);
-        }
-
-        free(record_free->dir_array);
-    }
+    free(record_free->dir_array);
+    fw_block_free_all(record_free->blocks);
+    jfs_fio_path_free(&record_free->start_path);
 
     memset(record_free, 0, sizeof(*record_free));
 }
@@ -204,77 +493,185 @@ static jfs_fw_types_t fw_map_dirent_type(unsigned char ent_type, jfs_err_t *err)
     }
 }
 
-static void fw_file_init(jfs_fw_file_t *file_init, const struct dirent *ent, jfs_err_t *err) {
-    jfs_fw_types_t new_type = 0;
-    jfs_fio_name_t new_name = {0};
+// nfs readdir and xfs without ftype leave d_type unknown, the file is stat'd for it then
+static jfs_fw_types_t fw_resolve_type(int dir_fd, const char *name, jfs_err_t *err) {
+    struct statx stx = {0};
+    jfs_statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stx, err);
+    REMAP_ERR(JFS_ERR_ACCESS, JFS_ERR_FW_UNSUPPORTED); // removed or unreadable since the listing, skipped like a socket
+    REMAP_ERR(JFS_ERR_INVAL_PATH, JFS_ERR_FW_UNSUPPORTED);
+    VAL_CHECK_ERR(0);
+
+    if (S_ISREG(stx.stx_mode)) return JFS_FW_REG;
+    if (S_ISDIR(stx.stx_mode)) return JFS_FW_DIR;
+    *err = JFS_ERR_FW_UNSUPPORTED;
+    VAL_RETURN_ERR(0);
+}
 
-    new_type = fw_map_dirent_type(ent->d_type, err);
+static void fw_file_init(jfs_fw_file_t *file_init, int dir_fd, const fw_dirent64_t *ent, jfs_fw_block_t **blocks, jfs_err_t *err) {
+    jfs_fw_types_t new_type = fw_map_dirent_type(ent->d_type, err);
+    if (*err == JFS_ERR_FW_UNKNOWN) {
+        RES_ERR;
+        new_type = fw_resolve_type(dir_fd, ent->d_name, err);
+    }
     VOID_CHECK_ERR;
-    jfs_fio_name_init(&new_name, ent->d_name, err);
+
+    const size_t len = strlen(ent->d_name);
+    char *const  str = fw_block_alloc(blocks, len + 1, 1, err);
     VOID_CHECK_ERR;
+    memcpy(str, ent->d_name, len + 1);
 
-    jfs_fio_name_transfer(&file_init->name, &new_name);
-    file_init->inode = ent->d_ino;
+    file_init->name = (jfs_fio_name_t) {.len = len, .str = str};
+    file_init->inode = (ino_t) ent->d_ino;
     file_init->type = new_type;
 }
 
-static void fw_dir_init(jfs_fw_dir_t *dir_init, fw_file_vector_t *vec_free, jfs_fio_path_t *path_free, jfs_err_t *err) {
-    size_t         new_count = vec_free->count;
+// the scanned entries are copied out of the reused vector into an exactly sized array in the blocks
+static void fw_dir_init(jfs_fw_dir_t *dir_init, const fw_file_vector_t *vec, jfs_fw_block_t **blocks, fw_pending_t *pending_free, jfs_err_t *err) {
     jfs_fw_file_t *new_files = NULL;
 
-    if (vec_free->count > 0) {
-        new_files = fw_file_vector_to_array(vec_free, err);
+    if (vec->count > 0) {
+        new_files = fw_block_alloc(blocks, sizeof(*new_files) * vec->count, alignof(jfs_fw_file_t), err);
         VOID_CHECK_ERR;
-    } else {
-        fw_file_vector_free(vec_free);
+        memcpy(new_files, vec->file_array, sizeof(*new_files) * vec->count);
     }
 
-    dir_init->file_count = new_count;
+    dir_init->file_count = vec->count;
     dir_init->files = new_files;
-    jfs_fio_path_transfer(&dir_init->path, path_free);
+    dir_init->parent = pending_free->parent_id;
+    dir_init->name = pending_free->name;
+    pending_free->name = (jfs_fio_name_t) {0};
+}
+
+static void *fw_block_alloc(jfs_fw_block_t **blocks, size_t size, size_t align, jfs_err_t *err) {
+    jfs_fw_block_t *block = *blocks;
+
+    if (block != NULL) {
+        const size_t pad = (align - ((uintptr_t) &block->data[block->used] & (align - 1))) & (align - 1);
+        if (pad + size <= block->size - block->used) {
+            void *const ptr = &block->data[block->used + pad];
+            block->used += pad + size;
+            return ptr;
+        }
+    }
+
+    // data starts max aligned, oversized requests get a block of their own,
+    // the list stays in allocation order so fw_block_reset can unwind it
+    const size_t data_size = size > FW_BLOCK_SIZE ? size : FW_BLOCK_SIZE;
+    block = jfs_malloc(sizeof(*block) + data_size, err);
+    NULL_CHECK_ERR;
+
+    block->size = data_size;
+    block->used = size;
+    block->next = *blocks;
+    *blocks = block;
+    return block->data;
 }
 
-static void fw_path_vector_init(fw_path_vector_t *vec_init, jfs_err_t *err) {
-    jfs_fio_path_t *new_path_array = jfs_malloc(sizeof(*new_path_array) * FW_PATH_VECTOR_DEFAULT_CAPACITY, err);
+static void fw_block_free_all(jfs_fw_block_t *blocks_move) {
+    while (blocks_move != NULL) {
+        jfs_fw_block_t *const next = blocks_move->next;
+        free(blocks_move);
+        blocks_move = next;
+    }
+}
+
+// moves the whole list in blocks_move onto the front of blocks
+static void fw_block_splice(jfs_fw_block_t **blocks, jfs_fw_block_t **blocks_move) {
+    if (*blocks_move == NULL) return;
+
+    jfs_fw_block_t *tail = *blocks_move;
+    while (tail->next != NULL) {
+        tail = tail->next;
+    }
+
+    tail->next = *blocks;
+    *blocks = *blocks_move;
+    *blocks_move = NULL;
+}
+
+static void fw_block_get_mark(const jfs_fw_block_t *blocks, fw_block_mark_t *mark_init) {
+    mark_init->block = (jfs_fw_block_t *) blocks;
+    mark_init->used = blocks != NULL ? blocks->used : 0;
+}
+
+static void fw_block_reset(jfs_fw_block_t **blocks, const fw_block_mark_t *mark) {
+    while (*blocks != mark->block) {
+        jfs_fw_block_t *const next = (*blocks)->next;
+        free(*blocks);
+        *blocks = next;
+    }
+
+    if (*blocks != NULL) (*blocks)->used = mark->used;
+}
+
+static void fw_pending_free(fw_pending_t *pending_free) {
+    fw_dir_fd_release(pending_free->parent);
+    memset(pending_free, 0, sizeof(*pending_free));
+}
+
+static void fw_pending_transfer(fw_pending_t *pending_init, fw_pending_t *pending_free) {
+    *pending_init = *pending_free;
+    memset(pending_free, 0, sizeof(*pending_free));
+}
+
+static fw_dir_fd_t *fw_dir_fd_create(int fd, jfs_err_t *err) {
+    fw_dir_fd_t *const dir_fd = jfs_malloc(sizeof(*dir_fd), err);
+    NULL_CHECK_ERR;
+
+    dir_fd->fd = fd;
+    atomic_init(&dir_fd->refs, 1);
+    return dir_fd;
+}
+
+static void fw_dir_fd_release(fw_dir_fd_t *dir_fd_move) {
+    if (dir_fd_move == NULL) return;
+    if (atomic_fetch_sub(&dir_fd_move->refs, 1) > 1) return;
+
+    close(dir_fd_move->fd);
+    free(dir_fd_move);
+}
+
+static void fw_pending_vector_init(fw_pending_vector_t *vec_init, jfs_err_t *err) {
+    fw_pending_t *new_pending_array = jfs_malloc(sizeof(*new_pending_array) * FW_PENDING_VECTOR_DEFAULT_CAPACITY, err);
     VOID_CHECK_ERR;
 
-    vec_init->path_array = new_path_array;
-    vec_init->capacity = FW_PATH_VECTOR_DEFAULT_CAPACITY;
+    vec_init->pending_array = new_pending_array;
+    vec_init->capacity = FW_PENDING_VECTOR_DEFAULT_CAPACITY;
     vec_init->count = 0;
 }
 
-static void fw_path_vector_free(fw_path_vector_t *vec_free) {
-    if (vec_free->path_array != NULL) {
+static void fw_pending_vector_free(fw_pending_vector_t *vec_free) {
+    if (vec_free->pending_array != NULL) {
         for (size_t i = 0; i < vec_free->count; i++) {
-            jfs_fio_path_free(&vec_free->path_array[i]);
+            fw_pending_free(&vec_free->pending_array[i]);
         }
 
-        free(vec_free->path_array);
+        free(vec_free->pending_array);
     }
 
     memset(vec_free, 0, sizeof(*vec_free));
 }
 
-static void fw_path_vector_push(fw_path_vector_t *vec, jfs_fio_path_t *path_free, jfs_err_t *err) {
+static void fw_pending_vector_push(fw_pending_vector_t *vec, fw_pending_t *pending_free, jfs_err_t *err) {
     if (vec->count >= vec->capacity) {
         const size_t new_capacity = vec->capacity * 2;
 
-        jfs_fio_path_t *new_path_array = jfs_realloc(vec->path_array, sizeof(*new_path_array) * new_capacity, err);
+        fw_pending_t *new_pending_array = jfs_realloc(vec->pending_array, sizeof(*new_pending_array) * new_capacity, err);
         VOID_CHECK_ERR;
 
-        vec->path_array = new_path_array;
+        vec->pending_array = new_pending_array;
         vec->capacity = new_capacity;
     }
 
-    jfs_fio_path_transfer(&vec->path_array[vec->count], path_free);
+    fw_pending_transfer(&vec->pending_array[vec->count], pending_free);
     vec->count += 1;
 }
 
-static void fw_path_vector_pop(fw_path_vector_t *vec, jfs_fio_path_t *path_init, jfs_err_t *err) {
+static void fw_pending_vector_pop(fw_pending_vector_t *vec, fw_pending_t *pending_init, jfs_err_t *err) {
     VOID_FAIL_IF(vec->count == 0, JFS_ERR_EMPTY);
 
     vec->count -= 1;
-    jfs_fio_path_transfer(path_init, &vec->path_array[vec->count]);
+    fw_pending_transfer(pending_init, &vec->pending_array[vec->count]);
 }
 
 static void fw_file_vector_init(fw_file_vector_t *vec_init, jfs_err_t *err) {
@@ -287,14 +684,7 @@ static void fw_file_vector_init(fw_file_vector_t *vec_init, jfs_err_t *err) {
 }
 
 static void fw_file_vector_free(fw_file_vector_t *vec_free) {
-    if (vec_free->file_array != NULL) {
-        for (size_t i = 0; i < vec_free->count; i++) {
-            jfs_fw_file_free(&vec_free->file_array[i]);
-        }
-
-        free(vec_free->file_array);
-    }
-
+    free(vec_free->file_array);
     memset(vec_free, 0, sizeof(*vec_free));
 }
 
@@ -313,16 +703,6 @@ static void fw_file_vector_push(fw_file_vector_t *vec, jfs_fw_file_t *file_free,
     vec->count += 1;
 }
 
-static jfs_fw_file_t *fw_file_vector_to_array(fw_file_vector_t *vec_free, jfs_err_t *err) {
-    NULL_FAIL_IF(vec_free->count == 0, JFS_ERR_EMPTY);
-
-    jfs_fw_file_t *file_array = jfs_realloc(vec_free->file_array, sizeof(*file_array) * vec_free->count, err);
-    NULL_CHECK_ERR;
-
-    memset(vec_free, 0, sizeof(*vec_free));
-    return file_array;
-}
-
 static void fw_dir_vector_init(fw_dir_vector_t *vec_init, jfs_err_t *err) {
     jfs_fw_dir_t *new_dir_array = jfs_malloc(sizeof(*new_dir_array) * FW_DIR_VECTOR_DEFAULT_CAPACITY, err);
     VOID_CHECK_ERR;
@@ -333,14 +713,7 @@ static void fw_dir_vector_init(fw_dir_vector_t *vec_init, jfs_err_t *err) {
 }
 
 static void fw_dir_vector_free(fw_dir_vector_t *vec_free) {
-    if (vec_free->dir_array != NULL) {
-        for (size_t i = 0; i < vec_free->count; i++) {
-            jfs_fw_dir_free(&vec_free->dir_array[i]);
-        }
-
-        free(vec_free->dir_array);
-    }
-
+    free(vec_free->dir_array);
     memset(vec_free, 0, sizeof(*vec_free));
 }
 
@@ -369,55 +742,749 @@ static jfs_fw_dir_t *fw_dir_vector_to_array(fw_dir_vector_t *vec_free, jfs_err_t
     return dir_array;
 }
 
-static void fw_scan_dir(DIR *dir, fw_file_vector_t *vec, jfs_err_t *err) {
-    struct dirent *ent = NULL;
+static void fw_scanner_init(fw_scanner_t *scanner_init, const jfs_fio_path_t *start_path, fw_pending_vector_t *found, jfs_err_t *err) {
+    scanner_init->start_path = start_path;
+    scanner_init->prev = NULL;
+    scanner_init->found = found;
+    scanner_init->id_base = 0;
+    scanner_init->id_stride = 1;
+    scanner_init->stat = false;
+    scanner_init->ring_ok = false;
+    scanner_init->stx = NULL;
+    scanner_init->stx_capacity = 0;
 
-    errno = 0;
-    while ((ent = readdir(dir)) != NULL) {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
-        fw_handle_dirent(ent, vec, err);
-        if (*err == JFS_ERR_FW_UNSUPPORTED) {
-            RES_ERR;
-            continue;
-        }
+    scanner_init->blocks = NULL;
+
+    fw_dir_vector_init(&scanner_init->dir_vec, err);
+    VOID_CHECK_ERR;
+
+    fw_file_vector_init(&scanner_init->file_vec, err);
+    VOID_CHECK_ERR;
+
+    scanner_init->dents = jfs_malloc(FW_DENTS_SIZE, err);
+    VOID_CHECK_ERR;
+}
+
+static void fw_scanner_free(fw_scanner_t *scanner_free) {
+    fw_dir_vector_free(&scanner_free->dir_vec);
+    fw_file_vector_free(&scanner_free->file_vec);
+    fw_block_free_all(scanner_free->blocks);
+    free(scanner_free->dents);
+    if (scanner_free->ring_ok) jfs_ior_free(&scanner_free->ring);
+    free(scanner_free->stx);
+    memset(scanner_free, 0, sizeof(*scanner_free));
+}
+
+// a kernel without io_uring, or with it turned off, falls back to plain statx calls on the walking thread
+static void fw_scanner_enable_stat(fw_scanner_t *scanner, jfs_err_t *err) {
+    scanner->stat = true;
+
+    jfs_ior_init(&scanner->ring, FW_RING_ENTRIES, err);
+    if (*err == JFS_ERR_SYS) {
+        RES_ERR;
+        return;
+    }
+    VOID_CHECK_ERR;
+
+    scanner->ring_ok = true;
+}
+
+// opens the dir relative to its parent's fd so the kernel resolves one component instead of the whole path,
+// a dir that matches the previous record is listed from there and only opened if something still needs its fd
+static void fw_process_dir(fw_scanner_t *scanner, fw_pending_t *pending_free, jfs_err_t *err) {
+    jfs_fw_dir_t dir = {0};
+    struct statx dir_stx = {0};
+    int          fd = -1;
+
+    const bool           is_start = pending_free->parent_id == JFS_FW_NO_PARENT;
+    const int            at_fd = is_start ? AT_FDCWD : pending_free->parent != NULL ? pending_free->parent->fd : -1;
+    const char          *name = is_start ? scanner->start_path->str : pending_free->name.str;
+    const jfs_fw_trust_t trust = fw_prev_trust(scanner->prev, pending_free->prev_id);
+    const int            open_flags = is_start ? FW_START_OPEN_FLAGS : FW_OPEN_FLAGS;
+    const jfs_fw_dir_t  *old_dir = NULL;
+
+    // with nothing to reuse or files to restat the dir is opened either way, so it is stat'd through the fd
+    // instead of resolving the name twice, only a dir that may be reused unopened is stat'd by name
+    const bool restat = scanner->stat && trust == JFS_FW_TRUST_NONE;
+    if (trust != JFS_FW_TRUST_NONE) {
+        old_dir = &scanner->prev->record->dir_array[pending_free->prev_id];
+        dir_stx.stx_dev_major = major(old_dir->device);
+        dir_stx.stx_dev_minor = minor(old_dir->device);
+        dir_stx.stx_ino = old_dir->inode;
+        dir_stx.stx_mtime = (struct statx_timestamp) {.tv_sec = old_dir->mtime.tv_sec, .tv_nsec = (uint32_t) old_dir->mtime.tv_nsec};
+    } else if (pending_free->prev_id == JFS_FW_NO_PARENT || restat) {
+        fd = jfs_openat(at_fd, name, open_flags, err);
+        GOTO_IF_ERR(cleanup);
+        jfs_statx(fd, "", AT_EMPTY_PATH, STATX_INO | STATX_MTIME, &dir_stx, err);
+        GOTO_IF_ERR(cleanup);
+    } else {
+        jfs_statx(at_fd, name, is_start ? 0 : AT_SYMLINK_NOFOLLOW, STATX_INO | STATX_MTIME, &dir_stx, err);
+        GOTO_IF_ERR(cleanup);
+    }
+
+    if (trust == JFS_FW_TRUST_NONE && pending_free->prev_id != JFS_FW_NO_PARENT && fw_prev_unchanged(scanner->prev, pending_free->prev_id, &dir_stx)) {
+        old_dir = &scanner->prev->record->dir_array[pending_free->prev_id];
+    }
+
+    bool has_subdirs = false;
+    for (size_t i = 0; old_dir != NULL && i < old_dir->file_count; i++) {
+        if (old_dir->files[i].type == JFS_FW_DIR) has_subdirs = true;
+    }
+
+    // a trusted tree is never opened, so neither are its subdirs and they need no fd from it
+    if (fd == -1 && trust != JFS_FW_TRUST_TREE && (old_dir == NULL || has_subdirs)) {
+        fd = jfs_openat(at_fd, name, open_flags, err);
+    }
+    fw_dir_fd_release(pending_free->parent);
+    pending_free->parent = NULL;
+    GOTO_IF_ERR(cleanup);
+
+    scanner->file_vec.count = 0;
+    if (old_dir != NULL) {
+        fw_reuse_files(scanner, old_dir, err);
+    } else {
+        fw_scan_dir(fd, scanner, err);
+    }
+    GOTO_IF_ERR(cleanup);
+
+    if (restat) { // file contents change without touching the dir, so reused listings are stat'd again too
+        fw_stat_files(scanner, fd, err);
+        GOTO_IF_ERR(cleanup);
+    }
+
+    const size_t dir_id = (scanner->dir_vec.count * scanner->id_stride) + scanner->id_base;
+    fw_push_subdirs(scanner, &fd, dir_id, pending_free->prev_id, err);
+    GOTO_IF_ERR(cleanup);
+
+    fw_dir_init(&dir, &scanner->file_vec, &scanner->blocks, pending_free, err);
+    GOTO_IF_ERR(cleanup);
+    dir.device = makedev(dir_stx.stx_dev_major, dir_stx.stx_dev_minor);
+    dir.inode = (ino_t) dir_stx.stx_ino;
+    dir.mtime = (struct timespec) {.tv_sec = dir_stx.stx_mtime.tv_sec, .tv_nsec = dir_stx.stx_mtime.tv_nsec};
+
+    fw_dir_vector_push(&scanner->dir_vec, &dir, err);
+    GOTO_IF_ERR(cleanup);
+
+    return;
+
+cleanup:
+    if (fd != -1) close(fd);
+    fw_pending_free(pending_free);
+    REMAP_ERR(JFS_ERR_ACCESS, JFS_ERR_FW_SKIP);
+    REMAP_ERR(JFS_ERR_INVAL_PATH, JFS_ERR_FW_FAIL);
+}
+
+// records are parsed straight out of the buffer, one syscall covers thousands of entries on a big dir
+static void fw_scan_dir(int dir_fd, fw_scanner_t *scanner, jfs_err_t *err) {
+    for (;;) {
+        const size_t filled = jfs_getdents64(dir_fd, scanner->dents, FW_DENTS_SIZE, err);
         VOID_CHECK_ERR;
+        if (filled == 0) return;
+
+        for (size_t offset = 0; offset < filled;) {
+            const fw_dirent64_t *const ent = (const fw_dirent64_t *) (scanner->dents + offset); // NOLINT
+            offset += ent->d_reclen;
+
+            if (fw_is_dot_name(ent->d_name)) continue;
+            fw_handle_dirent(dir_fd, ent, scanner, err);
+            if (*err == JFS_ERR_FW_UNSUPPORTED) {
+                RES_ERR;
+                continue;
+            }
+            VOID_CHECK_ERR;
+        }
     }
+}
 
-    VOID_FAIL_IF(errno != 0, JFS_ERR_SYS);
+static bool fw_is_dot_name(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
 }
 
-static void fw_handle_dirent(const struct dirent *ent, fw_file_vector_t *vec, jfs_err_t *err) {
+static void fw_handle_dirent(int dir_fd, const fw_dirent64_t *ent, fw_scanner_t *scanner, jfs_err_t *err) {
     jfs_fw_file_t file = {0};
-    fw_file_init(&file, ent, err);
+    fw_file_init(&file, dir_fd, ent, &scanner->blocks, err);
     VOID_CHECK_ERR;
 
-    fw_file_vector_push(vec, &file, err);
-    if (*err != JFS_OK) {
-        jfs_fw_file_free(&file);
-        VOID_RETURN_ERR;
+    fw_file_vector_push(&scanner->file_vec, &file, err);
+}
+
+// the dir's fd is handed to its subdirectories, it closes once the last of them has been opened,
+// their names point at the file entries already in the blocks
+static void fw_push_subdirs(fw_scanner_t *scanner, int *fd_move, size_t dir_id, size_t prev_id, jfs_err_t *err) {
+    const fw_file_vector_t *const file_vec = &scanner->file_vec;
+
+    size_t subdir_count = 0;
+    for (size_t i = 0; i < file_vec->count; i++) {
+        if (file_vec->file_array[i].type == JFS_FW_DIR) subdir_count += 1;
+    }
+    if (subdir_count == 0) {
+        if (*fd_move != -1) close(*fd_move);
+        *fd_move = -1;
+        return;
+    }
+
+    fw_dir_fd_t *dir_fd = NULL;
+    if (*fd_move != -1) {
+        dir_fd = fw_dir_fd_create(*fd_move, err);
+        VOID_CHECK_ERR;
+        *fd_move = -1;
     }
+
+    for (size_t i = 0; i < file_vec->count; i++) {
+        if (file_vec->file_array[i].type != JFS_FW_DIR) continue;
+
+        // a changed dir still points its subdirs at their old selves, they may well be unchanged
+        const char *const subdir_name = file_vec->file_array[i].name.str;
+        const size_t      subdir_prev_id = prev_id != JFS_FW_NO_PARENT ? fw_prev_find(scanner->prev, prev_id, subdir_name) : JFS_FW_NO_PARENT;
+
+        if (dir_fd != NULL) atomic_fetch_add(&dir_fd->refs, 1);
+        fw_pending_t subdir = {.parent = dir_fd, .parent_id = dir_id, .prev_id = subdir_prev_id, .name = file_vec->file_array[i].name};
+        fw_pending_vector_push(scanner->found, &subdir, err);
+        if (*err != JFS_OK) {
+            fw_pending_free(&subdir);
+            break;
+        }
+    }
+
+    fw_dir_fd_release(dir_fd); // the scanner's own ref
+}
+
+static void fw_prev_init(fw_prev_t *prev_init, const jfs_fw_record_t *record, const jfs_fio_path_t *start_path, jfs_err_t *err) {
+    memset(prev_init, 0, sizeof(*prev_init));
+    prev_init->record = record;
+    prev_init->root = JFS_FW_NO_PARENT;
+
+    const size_t count = record->dir_count;
+    prev_init->child_start = jfs_malloc(sizeof(*prev_init->child_start) * (count + 1), err);
+    GOTO_IF_ERR(cleanup);
+    prev_init->children = jfs_malloc(sizeof(*prev_init->children) * (count > 0 ? count : 1), err);
+    GOTO_IF_ERR(cleanup);
+
+    // counting sort by parent, child_start[p + 1] ends up as the end of p's group
+    memset(prev_init->child_start, 0, sizeof(*prev_init->child_start) * (count + 1));
+    for (size_t i = 0; i < count; i++) {
+        const size_t parent = record->dir_array[i].parent;
+        if (parent == JFS_FW_NO_PARENT) {
+            if (strcmp(record->start_path.str, start_path->str) == 0) prev_init->root = i;
+            continue;
+        }
+        prev_init->child_start[parent + 1] += 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        prev_init->child_start[i + 1] += prev_init->child_start[i];
+    }
+    for (size_t i = 0; i < count; i++) {
+        const size_t parent = record->dir_array[i].parent;
+        if (parent == JFS_FW_NO_PARENT) continue;
+        prev_init->children[prev_init->child_start[parent]++] = (fw_prev_child_t) {.name = record->dir_array[i].name.str, .index = i};
+    }
+
+    // the fill moved every start up to the next group's, shift them back
+    for (size_t i = count; i > 0; i--) {
+        prev_init->child_start[i] = prev_init->child_start[i - 1];
+    }
+    prev_init->child_start[0] = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t group = prev_init->child_start[i + 1] - prev_init->child_start[i];
+        if (group > 1) qsort(&prev_init->children[prev_init->child_start[i]], group, sizeof(*prev_init->children), fw_prev_child_cmp);
+    }
+
+    return;
+
+cleanup:
+    fw_prev_free(prev_init);
 }
 
-static void fw_push_dir_paths(fw_path_vector_t *path_vec, fw_file_vector_t *file_vec, const jfs_fio_path_t *dir_path, jfs_err_t *err) {
-    jfs_fio_path_t     push_path = {0};
-    jfs_fio_path_buf_t buf = {0};
+static void fw_prev_free(fw_prev_t *prev_free) {
+    free(prev_free->child_start);
+    free(prev_free->children);
+    memset(prev_free, 0, sizeof(*prev_free));
+}
+
+static int fw_prev_child_cmp(const void *a, const void *b) {
+    return strcmp(((const fw_prev_child_t *) a)->name, ((const fw_prev_child_t *) b)->name);
+}
+
+static size_t fw_prev_find(const fw_prev_t *prev, size_t parent_index, const char *name) {
+    size_t low = prev->child_start[parent_index];
+    size_t high = prev->child_start[parent_index + 1];
+
+    while (low < high) {
+        const size_t mid = low + ((high - low) / 2);
+        const int    cmp = strcmp(name, prev->children[mid].name);
+        if (cmp == 0) return prev->children[mid].index;
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+
+    return JFS_FW_NO_PARENT;
+}
+
+// a dir's mtime moves whenever an entry is added, removed or renamed, the inode catches a dir replaced under the same name
+static bool fw_prev_unchanged(const fw_prev_t *prev, size_t index, const struct statx *dir_stx) {
+    const jfs_fw_dir_t *const old_dir = &prev->record->dir_array[index];
+
+    if (old_dir->device != makedev(dir_stx->stx_dev_major, dir_stx->stx_dev_minor) || old_dir->inode != (ino_t) dir_stx->stx_ino) return false;
+    if (old_dir->mtime.tv_sec != dir_stx->stx_mtime.tv_sec || old_dir->mtime.tv_nsec != (long) dir_stx->stx_mtime.tv_nsec) return false;
+    return old_dir->mtime.tv_sec + FW_RACY_SECONDS <= prev->record->started.tv_sec;
+}
+
+static jfs_fw_trust_t fw_prev_trust(const fw_prev_t *prev, size_t index) {
+    if (prev == NULL || prev->trust == NULL || index == JFS_FW_NO_PARENT) return JFS_FW_TRUST_NONE;
+    return prev->trust[index];
+}
+
+// the old record may be freed once the walk is done, so the names are copied into this walk's blocks
+static void fw_reuse_files(fw_scanner_t *scanner, const jfs_fw_dir_t *old_dir, jfs_err_t *err) {
+    for (size_t i = 0; i < old_dir->file_count; i++) {
+        jfs_fw_file_t file = old_dir->files[i];
+
+        char *const str = fw_block_alloc(&scanner->blocks, file.name.len + 1, 1, err);
+        VOID_CHECK_ERR;
+        memcpy(str, file.name.str, file.name.len + 1);
+        file.name.str = str;
+
+        fw_file_vector_push(&scanner->file_vec, &file, err);
+        VOID_CHECK_ERR;
+    }
+}
+
+// entries that fail on their own, mostly ones removed since the scan, keep their metadata zeroed
+static void fw_stat_files(fw_scanner_t *scanner, int dir_fd, jfs_err_t *err) {
+    fw_file_vector_t *const file_vec = &scanner->file_vec;
+    if (file_vec->count == 0) return;
+
+    if (file_vec->count > scanner->stx_capacity) {
+        struct statx *new_stx = jfs_realloc(scanner->stx, sizeof(*new_stx) * file_vec->count, err);
+        VOID_CHECK_ERR;
+
+        scanner->stx = new_stx;
+        scanner->stx_capacity = file_vec->count;
+    }
+
+    for (size_t i = 0; i < file_vec->count; i++) {
+        scanner->stx[i].stx_mask = 0;
+    }
+
+    if (scanner->ring_ok) {
+        fw_stat_ring(scanner, dir_fd, err);
+    } else {
+        fw_stat_each(scanner, dir_fd, err);
+    }
+    VOID_CHECK_ERR;
 
     for (size_t i = 0; i < file_vec->count; i++) {
-        if (file_vec->file_array[i].type == JFS_FW_REG) continue;
+        fw_file_set_stat(&file_vec->file_array[i], &scanner->stx[i]);
+    }
+}
+
+// the whole dir goes in as one batch (ring sized chunks of it), the kernel runs the lookups in parallel
+static void fw_stat_ring(fw_scanner_t *scanner, int dir_fd, jfs_err_t *err) {
+    const fw_file_vector_t *const file_vec = &scanner->file_vec;
+    size_t                        queued = 0;
+    size_t                        completed = 0;
+
+    while (completed < file_vec->count) {
+        for (; queued < file_vec->count; queued++) {
+            struct io_uring_sqe *const sqe = jfs_ior_get_sqe(&scanner->ring);
+            if (sqe == NULL) break;
+
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dir_fd;
+            sqe->addr = (uintptr_t) file_vec->file_array[queued].name.str;
+            sqe->len = FW_STATX_MASK;
+            sqe->off = (uintptr_t) &scanner->stx[queued];
+            sqe->statx_flags = FW_STATX_FLAGS;
+            sqe->user_data = queued;
+        }
+
+        jfs_ior_submit_and_wait(&scanner->ring, (unsigned int) (queued - completed), err);
+        VOID_CHECK_ERR;
 
-        jfs_fio_path_buf_compose(&buf, dir_path, &(file_vec->file_array[i].name), err);
-        if (*err == JFS_ERR_FIO_PATH_OVERFLOW) {
+        struct io_uring_cqe cqe = {0};
+        while (jfs_ior_pop_cqe(&scanner->ring, &cqe)) {
+            if (cqe.res < 0) scanner->stx[cqe.user_data].stx_mask = 0;
+            completed += 1;
+        }
+    }
+}
+
+static void fw_stat_each(fw_scanner_t *scanner, int dir_fd, jfs_err_t *err) {
+    const fw_file_vector_t *const file_vec = &scanner->file_vec;
+
+    for (size_t i = 0; i < file_vec->count; i++) {
+        jfs_statx(dir_fd, file_vec->file_array[i].name.str, FW_STATX_FLAGS, FW_STATX_MASK, &scanner->stx[i], err);
+        if (*err == JFS_ERR_ACCESS || *err == JFS_ERR_INVAL_PATH) {
             RES_ERR;
+            scanner->stx[i].stx_mask = 0;
+        }
+        VOID_CHECK_ERR;
+    }
+}
+
+static void fw_file_set_stat(jfs_fw_file_t *file, const struct statx *stx) {
+    if ((stx->stx_mask & FW_STATX_MASK) != FW_STATX_MASK) return;
+
+    file->size = stx->stx_size;
+    file->mtime = (struct timespec) {.tv_sec = stx->stx_mtime.tv_sec, .tv_nsec = stx->stx_mtime.tv_nsec};
+    file->mode = stx->stx_mode;
+}
+
+static size_t fw_walk_thread_count(const jfs_fw_conf_t *conf) {
+    if (conf != NULL && conf->thread_count > 0) return conf->thread_count;
+
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t) cpus : 1;
+}
+
+// the first hard error wins, everyone else sees failed and stops at their next dir
+static void fw_walk_fail(fw_walk_t *walk, jfs_err_t walk_err) {
+    bool expected = false;
+    if (atomic_compare_exchange_strong(&walk->failed, &expected, true)) walk->err = walk_err;
+    fw_walk_wake(walk, SIZE_MAX);
+}
+
+// seen_publish_count is read before the worker last looked for work, anything published since cuts the wait short
+static void fw_walk_wait(fw_walk_t *walk, size_t seen_publish_count) {
+    pthread_mutex_lock(&walk->idle_lock);
+    atomic_fetch_add(&walk->idle_count, 1);
+    while (atomic_load(&walk->publish_count) == seen_publish_count && atomic_load(&walk->pending) != 0 && !atomic_load(&walk->failed)) {
+        pthread_cond_wait(&walk->idle_cond, &walk->idle_lock);
+    }
+    atomic_fetch_sub(&walk->idle_count, 1);
+    pthread_mutex_unlock(&walk->idle_lock);
+}
+
+// callers change what the sleepers check first, a sleeper counted here either sees the change or gets the signal
+static void fw_walk_wake(fw_walk_t *walk, size_t count) {
+    if (atomic_load(&walk->idle_count) == 0) return;
+
+    pthread_mutex_lock(&walk->idle_lock);
+    if (count >= atomic_load(&walk->idle_count)) {
+        pthread_cond_broadcast(&walk->idle_cond);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            pthread_cond_signal(&walk->idle_cond);
+        }
+    }
+    pthread_mutex_unlock(&walk->idle_lock);
+}
+
+// moves every worker's dirs into one array and renumbers the parent ids into indexes of it, their blocks go along
+static void fw_walk_collect(jfs_fw_record_t *record_init, fw_walk_t *walk, const jfs_fio_path_t *start_path, jfs_err_t *err) {
+    jfs_fio_path_t new_start_path = {0};
+    jfs_fw_dir_t  *dir_array = NULL;
+    size_t         dir_count = 0;
+
+    size_t *const offsets = jfs_malloc(sizeof(*offsets) * walk->worker_count, err);
+    VOID_CHECK_ERR;
+    for (size_t i = 0; i < walk->worker_count; i++) {
+        offsets[i] = dir_count;
+        dir_count += walk->workers[i].scanner.dir_vec.count;
+    }
+
+    jfs_fio_path_init(&new_start_path, start_path->str, err);
+    GOTO_IF_ERR(cleanup);
+
+    dir_array = jfs_malloc(sizeof(*dir_array) * dir_count, err);
+    GOTO_IF_ERR(cleanup);
+
+    size_t index = 0;
+    for (size_t i = 0; i < walk->worker_count; i++) {
+        fw_dir_vector_t *const dir_vec = &walk->workers[i].scanner.dir_vec;
+        for (size_t j = 0; j < dir_vec->count; j++) {
+            jfs_fw_dir_t *const dir = &dir_array[index++];
+            jfs_fw_dir_transfer(dir, &dir_vec->dir_array[j]);
+            if (dir->parent != JFS_FW_NO_PARENT) dir->parent = offsets[dir->parent % walk->worker_count] + (dir->parent / walk->worker_count);
+        }
+        dir_vec->count = 0;
+    }
+
+    record_init->dir_array = dir_array;
+    record_init->dir_count = dir_count;
+    record_init->started = walk->started;
+    record_init->blocks = NULL;
+    for (size_t i = 0; i < walk->worker_count; i++) {
+        fw_block_splice(&record_init->blocks, &walk->workers[i].scanner.blocks);
+    }
+    jfs_fio_path_transfer(&record_init->start_path, &new_start_path);
+
+cleanup:
+    jfs_fio_path_free(&new_start_path);
+    free(offsets);
+}
+
+static void fw_walk_free(fw_walk_t *walk) {
+    if (walk->workers != NULL) {
+        for (size_t i = 0; i < walk->worker_count; i++) {
+            fw_worker_free(&walk->workers[i]);
+        }
+
+        free(walk->workers);
+    }
+
+    jfs_err_t destroy_err = JFS_OK;
+    jfs_cond_destroy(&walk->idle_cond, &destroy_err);
+    jfs_mutex_destroy(&walk->idle_lock, &destroy_err);
+
+    fw_prev_free(&walk->prev);
+    memset(walk, 0, sizeof(*walk));
+}
+
+static void fw_worker_init(fw_worker_t *worker_init, fw_walk_t *walk, const jfs_fio_path_t *start_path, jfs_err_t *err) {
+    worker_init->walk = walk;
+    worker_init->bottom = 0;
+
+    jfs_mutex_init(&worker_init->lock, NULL, err);
+    VOID_CHECK_ERR;
+
+    fw_pending_vector_init(&worker_init->pending, err);
+    VOID_CHECK_ERR;
+
+    fw_pending_vector_init(&worker_init->found, err);
+    VOID_CHECK_ERR;
+
+    fw_scanner_init(&worker_init->scanner, start_path, &worker_init->found, err);
+    VOID_CHECK_ERR;
+
+    worker_init->scanner.id_base = (size_t) (worker_init - walk->workers);
+    worker_init->scanner.id_stride = walk->worker_count;
+}
+
+static void fw_worker_free(fw_worker_t *worker_free) {
+    if (worker_free->walk == NULL) return; // never initialized
+
+    // stolen entries were transferred out and zeroed so freeing the whole range is safe
+    fw_pending_vector_free(&worker_free->pending);
+    fw_pending_vector_free(&worker_free->found);
+    fw_scanner_free(&worker_free->scanner);
+
+    jfs_err_t destroy_err = JFS_OK;
+    jfs_mutex_destroy(&worker_free->lock, &destroy_err);
+    memset(worker_free, 0, sizeof(*worker_free));
+}
+
+static void *fw_worker_run(void *worker_ptr) {
+    fw_worker_t *const worker = worker_ptr;
+    fw_walk_t *const   walk = worker->walk;
+    jfs_err_t          walk_err = JFS_OK;
+    jfs_err_t *const   err = &walk_err;
+
+    while (!atomic_load_explicit(&walk->failed, memory_order_relaxed)) {
+        fw_pending_t pending = {0};
+        const size_t seen_publish_count = atomic_load(&walk->publish_count);
+
+        if (!fw_worker_pop(worker, &pending) && !fw_worker_steal(worker, &pending)) {
+            if (atomic_load(&walk->pending) == 0) break;
+            fw_walk_wait(walk, seen_publish_count); // someone is still scanning and may push more
             continue;
         }
 
-        jfs_fio_path_init(&push_path, buf.data, err);
-        VOID_CHECK_ERR;
+        // unreadable dirs and ones removed since their parent was listed are left out, the start dir was checked already
+        fw_process_dir(&worker->scanner, &pending, err);
+        if (*err == JFS_ERR_FW_SKIP || *err == JFS_ERR_FW_FAIL) RES_ERR;
+        if (*err == JFS_OK) fw_worker_publish(worker, err);
+        if (*err != JFS_OK) {
+            fw_walk_fail(walk, *err);
+            break;
+        }
+
+        if (atomic_fetch_sub(&walk->pending, 1) == 1) fw_walk_wake(walk, SIZE_MAX); // the walk is over
+    }
+
+    return NULL;
+}
+
+static bool fw_worker_pop(fw_worker_t *worker, fw_pending_t *pending_init) {
+    bool popped = false;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->pending.count > worker->bottom) {
+        worker->pending.count -= 1;
+        fw_pending_transfer(pending_init, &worker->pending.pending_array[worker->pending.count]);
+        popped = true;
+    }
+    if (worker->pending.count == worker->bottom) { // empty, the stolen slots can be reused
+        worker->pending.count = 0;
+        worker->bottom = 0;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return popped;
+}
+
+// takes the oldest entry of another worker, near the top of the tree so it's likely a big subtree
+static bool fw_worker_steal(fw_worker_t *worker, fw_pending_t *pending_init) {
+    fw_walk_t *const walk = worker->walk;
+    const size_t     self = (size_t) (worker - walk->workers);
+
+    for (size_t i = 1; i < walk->worker_count; i++) {
+        fw_worker_t *const victim = &walk->workers[(self + i) % walk->worker_count];
+        bool               stolen = false;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->pending.count > victim->bottom) {
+            fw_pending_transfer(pending_init, &victim->pending.pending_array[victim->bottom]);
+            victim->bottom += 1;
+            stolen = true;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (stolen) return true;
+    }
 
-        fw_path_vector_push(path_vec, &push_path, err);
+    return false;
+}
+
+// pending goes up before the entries can be seen so it never reads 0 while work is left
+static void fw_worker_publish(fw_worker_t *worker, jfs_err_t *err) {
+    fw_pending_vector_t *const found = &worker->found;
+    const size_t               found_count = found->count;
+    if (found_count == 0) return;
+
+    atomic_fetch_add(&worker->walk->pending, found_count);
+
+    pthread_mutex_lock(&worker->lock);
+    for (size_t i = 0; i < found->count; i++) {
+        fw_pending_vector_push(&worker->pending, &found->pending_array[i], err);
         if (*err != JFS_OK) {
-            jfs_fio_path_free(&push_path);
-            VOID_RETURN_ERR;
+            for (size_t j = i; j < found->count; j++) {
+                fw_pending_free(&found->pending_array[j]);
+            }
+            break;
         }
     }
+    found->count = 0;
+    pthread_mutex_unlock(&worker->lock);
+
+    atomic_fetch_add(&worker->walk->publish_count, 1);
+    fw_walk_wake(worker->walk, found_count);
+}
+
+static void fw_visitor_init(fw_visitor_t *visitor_init, const jfs_fio_path_t *start_path, jfs_fw_visit_fn visit, void *ctx, jfs_err_t *err) {
+    visitor_init->visit = visit;
+    visitor_init->ctx = ctx;
+    visitor_init->visited = 0;
+    visitor_init->stopped = false;
+
+    jfs_fio_path_buf_copy(&visitor_init->path, start_path, err);
+    VOID_CHECK_ERR;
+
+    fw_scanner_init(&visitor_init->scanner, start_path, NULL, err);
+    VOID_CHECK_ERR;
+}
+
+static void fw_visitor_free(fw_visitor_t *visitor_free) {
+    if (visitor_free == NULL) return;
+
+    while (visitor_free->frame_count > 0) {
+        fw_visitor_pop_frame(visitor_free);
+    }
+
+    free(visitor_free->frames);
+    fw_scanner_free(&visitor_free->scanner);
+    memset(visitor_free, 0, sizeof(*visitor_free));
+}
+
+// scans the dir, hands it to the callback and, if it may be descended into, keeps it open as a frame
+static void fw_visitor_enter(fw_visitor_t *visitor, int fd_move, const jfs_fio_name_t *name, size_t parent_id, size_t depth, jfs_err_t *err) {
+    fw_scanner_t *const scanner = &visitor->scanner;
+    fw_frame_t          frame = {.fd = fd_move, .id = visitor->visited, .depth = depth, .path_len = visitor->path.len};
+
+    fw_block_get_mark(scanner->blocks, &frame.mark);
+
+    scanner->file_vec.count = 0;
+    fw_scan_dir(frame.fd, scanner, err);
+    GOTO_IF_ERR(cleanup);
+
+    const jfs_fw_dir_t dir = {.name = *name, .parent = parent_id, .files = scanner->file_vec.file_array, .file_count = scanner->file_vec.count};
+    visitor->visited += 1;
+
+    const jfs_fw_action_t action = visitor->visit(&visitor->path, &dir, depth, visitor->ctx);
+    if (action == JFS_FW_STOP) visitor->stopped = true;
+    if (action != JFS_FW_DESCEND) goto cleanup;
+
+    // only the subdirs have to outlive the scan, the other names go when the frame pops
+    for (size_t i = 0; i < scanner->file_vec.count; i++) {
+        if (scanner->file_vec.file_array[i].type == JFS_FW_DIR) frame.subdir_count += 1;
+    }
+    if (frame.subdir_count == 0) goto cleanup;
+
+    frame.subdirs = fw_block_alloc(&scanner->blocks, sizeof(*frame.subdirs) * frame.subdir_count, alignof(jfs_fw_file_t), err);
+    GOTO_IF_ERR(cleanup);
+    for (size_t i = 0, j = 0; i < scanner->file_vec.count; i++) {
+        if (scanner->file_vec.file_array[i].type == JFS_FW_DIR) frame.subdirs[j++] = scanner->file_vec.file_array[i];
+    }
+
+    fw_visitor_push_frame(visitor, &frame, err);
+    GOTO_IF_ERR(cleanup);
+
+    return;
+
+cleanup:
+    close(frame.fd);
+    fw_block_reset(&scanner->blocks, &frame.mark);
+}
+
+static void fw_visitor_push_frame(fw_visitor_t *visitor, fw_frame_t *frame, jfs_err_t *err) {
+    if (visitor->frame_count >= visitor->frame_capacity) {
+        const size_t new_capacity = visitor->frame_capacity > 0 ? visitor->frame_capacity * 2 : FW_PENDING_VECTOR_DEFAULT_CAPACITY;
+
+        fw_frame_t *new_frames = jfs_realloc(visitor->frames, sizeof(*new_frames) * new_capacity, err);
+        VOID_CHECK_ERR;
+
+        visitor->frames = new_frames;
+        visitor->frame_capacity = new_capacity;
+    }
+
+    visitor->frames[visitor->frame_count] = *frame;
+    visitor->frame_count += 1;
+}
+
+static void fw_visitor_pop_frame(fw_visitor_t *visitor) {
+    fw_frame_t *const frame = &visitor->frames[visitor->frame_count - 1];
+
+    close(frame->fd);
+    fw_block_reset(&visitor->scanner.blocks, &frame->mark);
+    visitor->frame_count -= 1;
+}
+
+// opens the next subdir of the innermost frame, or pops it once they have all been visited
+static void fw_visitor_next(fw_visitor_t *visitor, jfs_err_t *err) {
+    fw_frame_t *const frame = &visitor->frames[visitor->frame_count - 1];
+    if (frame->next == frame->subdir_count) {
+        fw_visitor_pop_frame(visitor);
+        return;
+    }
+
+    const jfs_fw_file_t *const subdir = &frame->subdirs[frame->next];
+    const size_t               parent_id = frame->id;
+    const size_t               depth = frame->depth + 1;
+    frame->next += 1;
+
+    // a start path of / already ends in the separator
+    jfs_fio_path_buf_t *const path = &visitor->path;
+    const size_t              sep = frame->path_len > 0 && path->data[frame->path_len - 1] == '/' ? 0 : 1;
+    if (frame->path_len + sep + subdir->name.len > PATH_MAX) return; // too deep to name, skipped like an unreadable dir
+
+    path->len = frame->path_len;
+    if (sep == 1) path->data[path->len++] = '/';
+    memcpy(&path->data[path->len], subdir->name.str, subdir->name.len + 1);
+    path->len += subdir->name.len;
+
+    // unreadable, removed or swapped for a symlink since it was listed, skipped the same way
+    const int fd = jfs_openat(frame->fd, subdir->name.str, FW_OPEN_FLAGS, err);
+    if (*err == JFS_ERR_ACCESS || *err == JFS_ERR_INVAL_PATH) {
+        RES_ERR;
+        return;
+    }
+    VOID_CHECK_ERR;
+
+    // entering can grow the frame array, frame is stale after this
+    fw_visitor_enter(visitor, fd, &subdir->name, parent_id, depth, err);
+    if (*err == JFS_ERR_ACCESS || *err == JFS_ERR_INVAL_PATH) RES_ERR;
 }
@@ -0,0 +1,578 @@
+#include "file_watch.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define FWT_EVENTS_SIZE ((size_t) 65536) // 64 kb, the kernel queues far fewer events than that per read
+#define FWT_INIT_FLAGS  (IN_NONBLOCK | IN_CLOEXEC)
+#define FWT_DIR_MASK    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define FWT_STAT_MASK   (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB) // only worth waking up for when the record holds metadata
+
+#define FWT_NO_WATCH -1
+
+typedef struct fwt_watch fwt_watch_t;
+typedef struct fwt_inode fwt_inode_t;
+
+// one inotify watch descriptor and the dir of the current record it's on
+struct fwt_watch {
+    int    wd;
+    size_t dir;
+};
+
+struct fwt_inode {
+    dev_t  device;
+    ino_t  inode;
+    size_t dir;
+};
+
+struct jfs_fwt {
+    jfs_fio_path_t     start_path;
+    jfs_fw_conf_t      conf; // previous and trust are filled in per update
+    int                fd;
+    uint32_t           mask;
+    bool               overflow; // the kernel dropped events, every dir gets checked on the next update
+    jfs_fw_record_t    record;
+    int               *dir_wds;     // one per dir of the record, FWT_NO_WATCH when it couldn't be watched
+    bool              *dirty;       // one per dir of the record, can't be trusted on the next update
+    fwt_watch_t       *watches;     // sorted by wd
+    size_t             watch_count;
+    uint8_t           *events;      // FWT_EVENTS_SIZE
+    jfs_fio_path_buf_t path;
+};
+
+static bool fwt_update_pass(jfs_fwt_t *watch, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err);
+
+static void   fwt_drain(jfs_fwt_t *watch, jfs_err_t *err);
+static void   fwt_mark(jfs_fwt_t *watch, const struct inotify_event *event);
+static int    fwt_watch_cmp(const void *a, const void *b);
+static size_t fwt_find_wd(const jfs_fwt_t *watch, int wd);
+static bool   fwt_any_dirty(const jfs_fwt_t *watch);
+
+static jfs_fw_trust_t *fwt_make_trust(const jfs_fwt_t *watch, jfs_err_t *err) WUR;
+
+static fwt_inode_t *fwt_index_inodes(const jfs_fw_record_t *record, const int *wds, size_t *count_out, jfs_err_t *err) WUR;
+static int          fwt_inode_cmp(const void *a, const void *b);
+static size_t       fwt_find_inode(const fwt_inode_t *index, size_t count, const jfs_fw_dir_t *dir);
+
+static void fwt_emit(jfs_fwt_t *watch, const jfs_fw_record_t *new_record, const jfs_fw_trust_t *trust, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err);
+static void fwt_match_dirs(const jfs_fw_record_t *old_record, const jfs_fw_record_t *new_record, size_t *matched, size_t *stack, jfs_err_t *err);
+static void fwt_emit_all(jfs_fwt_t *watch, const jfs_fw_record_t *record, size_t dir, jfs_fwt_event_types_t type, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err);
+static void fwt_emit_diff(jfs_fwt_t *watch, const jfs_fw_record_t *new_record, size_t old_dir, size_t new_dir, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err);
+static void fwt_emit_file(jfs_fwt_t *watch, const jfs_fw_record_t *record, size_t dir, const jfs_fw_file_t *file, jfs_fwt_event_types_t type, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err);
+static const jfs_fw_file_t **fwt_sort_files(const jfs_fw_dir_t *dir, jfs_err_t *err) WUR;
+static int                   fwt_file_cmp(const void *a, const void *b);
+static bool                  fwt_file_modified(const jfs_fw_file_t *old_file, const jfs_fw_file_t *new_file);
+
+static size_t fwt_watch_dirs(jfs_fwt_t *watch, const jfs_fw_record_t *new_record, int *new_wds, bool *new_dirty, jfs_err_t *err);
+static void fwt_set_watches(jfs_fwt_t *watch, const jfs_fw_record_t *record, const int *wds, jfs_err_t *err);
+
+jfs_fwt_t *jfs_fwt_create(const jfs_fio_path_t *start_path, const jfs_fw_conf_t *conf, jfs_err_t *err) {
+    jfs_fwt_t *watch = jfs_malloc(sizeof(*watch), err); // holds a path buffer, too much for some stacks
+    NULL_CHECK_ERR;
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+
+    if (conf != NULL) watch->conf = *conf;
+    watch->conf.previous = NULL;
+    watch->conf.trust = NULL;
+    watch->mask = FWT_DIR_MASK | (watch->conf.stat ? FWT_STAT_MASK : 0);
+
+    jfs_fio_path_init(&watch->start_path, start_path->str, err);
+    GOTO_IF_ERR(cleanup);
+
+    watch->events = jfs_malloc(FWT_EVENTS_SIZE, err);
+    GOTO_IF_ERR(cleanup);
+
+    watch->fd = jfs_inotify_init1(FWT_INIT_FLAGS, err);
+    GOTO_IF_ERR(cleanup);
+
+    jfs_fw_walk(&watch->record, &watch->start_path, &watch->conf, err);
+    GOTO_IF_ERR(cleanup);
+
+    const size_t dir_count = watch->record.dir_count;
+    watch->dir_wds = jfs_malloc(sizeof(*watch->dir_wds) * dir_count, err);
+    GOTO_IF_ERR(cleanup);
+    watch->dirty = jfs_malloc(sizeof(*watch->dirty) * dir_count, err);
+    GOTO_IF_ERR(cleanup);
+
+    // the watches go on after the walk, anything that changed in between is caught because every new watch leaves its dir dirty
+    (void) fwt_watch_dirs(watch, &watch->record, watch->dir_wds, watch->dirty, err);
+    GOTO_IF_ERR(cleanup);
+    fwt_set_watches(watch, &watch->record, watch->dir_wds, err);
+    GOTO_IF_ERR(cleanup);
+
+    return watch;
+
+cleanup:
+    jfs_fwt_destroy(watch);
+    NULL_RETURN_ERR;
+}
+
+void jfs_fwt_destroy(jfs_fwt_t *watch_move) {
+    if (watch_move == NULL) return;
+
+    // closing the inotify fd drops every watch on it
+    if (watch_move->fd != -1) close(watch_move->fd);
+    jfs_fw_record_free(&watch_move->record);
+    jfs_fio_path_free(&watch_move->start_path);
+    free(watch_move->dir_wds);
+    free(watch_move->dirty);
+    free(watch_move->watches);
+    free(watch_move->events);
+    free(watch_move);
+}
+
+int jfs_fwt_fd(const jfs_fwt_t *watch) {
+    return watch->fd;
+}
+
+const jfs_fw_record_t *jfs_fwt_record(const jfs_fwt_t *watch) {
+    return &watch->record;
+}
+
+// a dir that only just got its watch could have changed before it went on, so it's checked by another pass right away,
+// that only repeats while new dirs keep showing up
+void jfs_fwt_update(jfs_fwt_t *watch, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err) {
+    bool added = true;
+    while (added) {
+        fwt_drain(watch, err);
+        VOID_CHECK_ERR;
+        if (!watch->overflow && !fwt_any_dirty(watch)) return;
+
+        added = fwt_update_pass(watch, on_event, ctx, err);
+        VOID_CHECK_ERR;
+    }
+}
+
+// true when a dir got a new watch
+static bool fwt_update_pass(jfs_fwt_t *watch, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err) {
+    jfs_fw_record_t new_record = {0};
+    jfs_fw_trust_t *trust = NULL;
+    int            *new_wds = NULL;
+    bool           *new_dirty = NULL;
+    size_t          added = 0;
+
+    trust = fwt_make_trust(watch, err);
+    VAL_CHECK_ERR(false);
+
+    // everything quiet is copied from the current record, the rest goes through the usual inode and mtime check
+    watch->conf.previous = &watch->record;
+    watch->conf.trust = trust;
+    jfs_fw_walk(&new_record, &watch->start_path, &watch->conf, err);
+    watch->conf.previous = NULL;
+    watch->conf.trust = NULL;
+    GOTO_IF_ERR(cleanup);
+
+    if (on_event != NULL) {
+        fwt_emit(watch, &new_record, trust, on_event, ctx, err);
+        GOTO_IF_ERR(cleanup);
+    }
+
+    new_wds = jfs_malloc(sizeof(*new_wds) * new_record.dir_count, err);
+    GOTO_IF_ERR(cleanup);
+    new_dirty = jfs_malloc(sizeof(*new_dirty) * new_record.dir_count, err);
+    GOTO_IF_ERR(cleanup);
+
+    added = fwt_watch_dirs(watch, &new_record, new_wds, new_dirty, err);
+    GOTO_IF_ERR(cleanup);
+    fwt_set_watches(watch, &new_record, new_wds, err);
+    GOTO_IF_ERR(cleanup);
+
+    jfs_fw_record_free(&watch->record);
+    watch->record = new_record;
+    new_record = (jfs_fw_record_t) {0};
+    free(watch->dir_wds);
+    watch->dir_wds = new_wds;
+    new_wds = NULL;
+    free(watch->dirty);
+    watch->dirty = new_dirty;
+    new_dirty = NULL;
+    watch->overflow = false;
+
+cleanup:
+    jfs_fw_record_free(&new_record);
+    free(trust);
+    free(new_wds);
+    free(new_dirty);
+    return added > 0;
+}
+
+// reads until the queue is empty, the events only say which dirs to look at again
+static void fwt_drain(jfs_fwt_t *watch, jfs_err_t *err) {
+    for (;;) {
+        const size_t size = jfs_read(watch->fd, watch->events, FWT_EVENTS_SIZE, err);
+        if (*err == JFS_ERR_AGAIN) {
+            RES_ERR;
+            return;
+        }
+        if (*err == JFS_ERR_INTER) {
+            RES_ERR;
+            continue;
+        }
+        VOID_CHECK_ERR;
+
+        for (size_t offset = 0; offset + sizeof(struct inotify_event) <= size;) {
+            struct inotify_event event;
+            memcpy(&event, &watch->events[offset], sizeof(event)); // the name after it keeps the next one 4 byte aligned only
+            fwt_mark(watch, &event);
+            offset += sizeof(event) + event.len;
+        }
+    }
+}
+
+static void fwt_mark(jfs_fwt_t *watch, const struct inotify_event *event) {
+    if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        watch->overflow = true;
+        return;
+    }
+
+    const size_t index = fwt_find_wd(watch, event->wd);
+    if (index == watch->watch_count) return; // removed by an earlier update
+    const size_t dir = watch->watches[index].dir;
+    watch->dirty[dir] = true;
+
+    // the kernel already dropped the watch, the dir is unwatched until the next update adds one again
+    if ((event->mask & IN_IGNORED) != 0) watch->dir_wds[dir] = FWT_NO_WATCH;
+
+    // the parent's own watch reports this too, unless the dir left through a rename the parent didn't see
+    const size_t parent = watch->record.dir_array[dir].parent;
+    if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) != 0 && parent != JFS_FW_NO_PARENT) watch->dirty[parent] = true;
+}
+
+static int fwt_watch_cmp(const void *a, const void *b) {
+    const int wd_a = ((const fwt_watch_t *) a)->wd;
+    const int wd_b = ((const fwt_watch_t *) b)->wd;
+    return (wd_a > wd_b) - (wd_a < wd_b);
+}
+
+// watch_count when wd isn't one of ours
+static size_t fwt_find_wd(const jfs_fwt_t *watch, int wd) {
+    if (watch->watch_count == 0) return 0;
+
+    const fwt_watch_t  key = {.wd = wd};
+    const fwt_watch_t *found = bsearch(&key, watch->watches, watch->watch_count, sizeof(*watch->watches), fwt_watch_cmp);
+    return found != NULL ? (size_t) (found - watch->watches) : watch->watch_count;
+}
+
+static bool fwt_any_dirty(const jfs_fwt_t *watch) {
+    for (size_t i = 0; i < watch->record.dir_count; i++) {
+        if (watch->dirty[i]) return true;
+    }
+    return false;
+}
+
+// dirty dirs are checked, their ancestors only have to look at the one subdir on the way down,
+// everything else wasn't touched since its watch went on
+static jfs_fw_trust_t *fwt_make_trust(const jfs_fwt_t *watch, jfs_err_t *err) {
+    const jfs_fw_record_t *const record = &watch->record;
+
+    jfs_fw_trust_t *trust = jfs_malloc(sizeof(*trust) * (record->dir_count > 0 ? record->dir_count : 1), err);
+    NULL_CHECK_ERR;
+
+    const jfs_fw_trust_t quiet = watch->overflow ? JFS_FW_TRUST_NONE : JFS_FW_TRUST_TREE;
+    for (size_t i = 0; i < record->dir_count; i++) {
+        trust[i] = quiet;
+    }
+    if (watch->overflow) return trust;
+
+    for (size_t i = 0; i < record->dir_count; i++) {
+        if (!watch->dirty[i]) continue;
+        trust[i] = JFS_FW_TRUST_NONE;
+
+        // with stat the parent's entry for the dir holds its mtime, which whatever happened in it just moved
+        size_t top = i;
+        if (watch->conf.stat && record->dir_array[i].parent != JFS_FW_NO_PARENT) {
+            top = record->dir_array[i].parent;
+            trust[top] = JFS_FW_TRUST_NONE;
+        }
+
+        // stops at the first ancestor an earlier dirty dir already opened up
+        for (size_t parent = record->dir_array[top].parent; parent != JFS_FW_NO_PARENT && trust[parent] == JFS_FW_TRUST_TREE;
+             parent = record->dir_array[parent].parent) {
+            trust[parent] = JFS_FW_TRUST_DIR;
+        }
+    }
+    return trust;
+}
+
+// every dir of record by device and inode, only the watched ones when wds isn't NULL
+static fwt_inode_t *fwt_index_inodes(const jfs_fw_record_t *record, const int *wds, size_t *count_out, jfs_err_t *err) {
+    fwt_inode_t *index = jfs_malloc(sizeof(*index) * (record->dir_count > 0 ? record->dir_count : 1), err);
+    NULL_CHECK_ERR;
+
+    size_t count = 0;
+    for (size_t i = 0; i < record->dir_count; i++) {
+        if (wds != NULL && wds[i] == FWT_NO_WATCH) continue;
+        index[count++] = (fwt_inode_t) {.device = record->dir_array[i].device, .inode = record->dir_array[i].inode, .dir = i};
+    }
+    qsort(index, count, sizeof(*index), fwt_inode_cmp);
+
+    *count_out = count;
+    return index;
+}
+
+static int fwt_inode_cmp(const void *a, const void *b) {
+    const fwt_inode_t *const entry_a = a;
+    const fwt_inode_t *const entry_b = b;
+    if (entry_a->device != entry_b->device) return entry_a->device < entry_b->device ? -1 : 1;
+    return (entry_a->inode > entry_b->inode) - (entry_a->inode < entry_b->inode);
+}
+
+// count when no entry has the dir's device and inode
+static size_t fwt_find_inode(const fwt_inode_t *index, size_t count, const jfs_fw_dir_t *dir) {
+    if (count == 0) return 0;
+
+    const fwt_inode_t  key = {.device = dir->device, .inode = dir->inode};
+    const fwt_inode_t *found = bsearch(&key, index, count, sizeof(*index), fwt_inode_cmp);
+    return found != NULL ? (size_t) (found - index) : count;
+}
+
+// a dir that kept its place is diffed entry by entry, one that appeared, vanished or moved reports everything in it
+static void fwt_emit(jfs_fwt_t *watch, const jfs_fw_record_t *new_record, const jfs_fw_trust_t *trust, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err) {
+    const jfs_fw_record_t *const old_record = &watch->record;
+    size_t                      *matched = NULL;
+    size_t                      *stack = NULL;
+    bool                        *kept = NULL;
+
+    const size_t new_size = new_record->dir_count > 0 ? new_record->dir_count : 1;
+    matched = jfs_malloc(sizeof(*matched) * new_size, err);
+    GOTO_IF_ERR(cleanup);
+    stack = jfs_malloc(sizeof(*stack) * new_size, err);
+    GOTO_IF_ERR(cleanup);
+    kept = jfs_malloc(sizeof(*kept) * (old_record->dir_count > 0 ? old_record->dir_count : 1), err);
+    GOTO_IF_ERR(cleanup);
+
+    fwt_match_dirs(old_record, new_record, matched, stack, err);
+    GOTO_IF_ERR(cleanup);
+
+    memset(kept, 0, sizeof(*kept) * old_record->dir_count);
+    for (size_t i = 0; i < new_record->dir_count; i++) {
+        if (matched[i] != JFS_FW_NO_PARENT) kept[matched[i]] = true;
+    }
+
+    for (size_t i = 0; i < old_record->dir_count; i++) {
+        if (kept[i]) continue;
+        fwt_emit_all(watch, old_record, i, JFS_FWT_DELETE, on_event, ctx, err);
+        GOTO_IF_ERR(cleanup);
+    }
+
+    for (size_t i = 0; i < new_record->dir_count; i++) {
+        if (matched[i] == JFS_FW_NO_PARENT) {
+            fwt_emit_all(watch, new_record, i, JFS_FWT_CREATE, on_event, ctx, err);
+        } else if (trust[matched[i]] == JFS_FW_TRUST_NONE) {
+            fwt_emit_diff(watch, new_record, matched[i], i, on_event, ctx, err);
+        }
+        GOTO_IF_ERR(cleanup);
+    }
+
+cleanup:
+    free(matched);
+    free(stack);
+    free(kept);
+}
+
+// matched[i] is the old dir at the same path with the same device and inode as new dir i, JFS_FW_NO_PARENT when there is none,
+// parents can come after their children in either record so each chain is resolved from the top through stack
+static void fwt_match_dirs(const jfs_fw_record_t *old_record, const jfs_fw_record_t *new_record, size_t *matched, size_t *stack, jfs_err_t *err) {
+    size_t       old_count = 0;
+    fwt_inode_t *old_index = fwt_index_inodes(old_record, NULL, &old_count, err);
+    VOID_CHECK_ERR;
+
+    const size_t unresolved = JFS_FW_NO_PARENT - 1;
+    for (size_t i = 0; i < new_record->dir_count; i++) {
+        matched[i] = unresolved;
+    }
+
+    for (size_t i = 0; i < new_record->dir_count; i++) {
+        size_t depth = 0;
+        for (size_t dir = i; dir != JFS_FW_NO_PARENT && matched[dir] == unresolved; dir = new_record->dir_array[dir].parent) {
+            stack[depth++] = dir;
+        }
+
+        while (depth > 0) {
+            const size_t              dir = stack[--depth];
+            const jfs_fw_dir_t *const new_dir = &new_record->dir_array[dir];
+            matched[dir] = JFS_FW_NO_PARENT;
+
+            const size_t found = fwt_find_inode(old_index, old_count, new_dir);
+            if (found == old_count) continue;
+            const size_t              old = old_index[found].dir;
+            const jfs_fw_dir_t *const old_dir = &old_record->dir_array[old];
+
+            if (new_dir->parent == JFS_FW_NO_PARENT) {
+                if (old_dir->parent == JFS_FW_NO_PARENT) matched[dir] = old;
+                continue;
+            }
+            if (old_dir->parent == JFS_FW_NO_PARENT || matched[new_dir->parent] != old_dir->parent) continue;
+            if (strcmp(new_dir->name.str, old_dir->name.str) == 0) matched[dir] = old;
+        }
+    }
+
+    free(old_index);
+}
+
+static void fwt_emit_all(jfs_fwt_t *watch, const jfs_fw_record_t *record, size_t dir, jfs_fwt_event_types_t type, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err) {
+    const jfs_fw_dir_t *const record_dir = &record->dir_array[dir];
+    for (size_t i = 0; i < record_dir->file_count; i++) {
+        fwt_emit_file(watch, record, dir, &record_dir->files[i], type, on_event, ctx, err);
+        VOID_CHECK_ERR;
+    }
+}
+
+// both listings sorted by name and merged, a name that now points at another inode was replaced
+static void fwt_emit_diff(jfs_fwt_t *watch, const jfs_fw_record_t *new_record, size_t old_dir, size_t new_dir, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err) {
+    const jfs_fw_record_t *const old_record = &watch->record;
+    const jfs_fw_dir_t *const    old = &old_record->dir_array[old_dir];
+    const jfs_fw_dir_t *const    new = &new_record->dir_array[new_dir];
+    const jfs_fw_file_t        **old_files = NULL;
+    const jfs_fw_file_t        **new_files = NULL;
+
+    old_files = fwt_sort_files(old, err);
+    GOTO_IF_ERR(cleanup);
+    new_files = fwt_sort_files(new, err);
+    GOTO_IF_ERR(cleanup);
+
+    size_t i = 0;
+    size_t j = 0;
+    while (i < old->file_count || j < new->file_count) {
+        const int cmp = i == old->file_count   ? 1
+                      : j == new->file_count   ? -1
+                                               : strcmp(old_files[i]->name.str, new_files[j]->name.str);
+
+        if (cmp < 0) {
+            fwt_emit_file(watch, old_record, old_dir, old_files[i++], JFS_FWT_DELETE, on_event, ctx, err);
+        } else if (cmp > 0) {
+            fwt_emit_file(watch, new_record, new_dir, new_files[j++], JFS_FWT_CREATE, on_event, ctx, err);
+        } else if (old_files[i]->inode != new_files[j]->inode || old_files[i]->type != new_files[j]->type) {
+            fwt_emit_file(watch, old_record, old_dir, old_files[i++], JFS_FWT_DELETE, on_event, ctx, err);
+            GOTO_IF_ERR(cleanup);
+            fwt_emit_file(watch, new_record, new_dir, new_files[j++], JFS_FWT_CREATE, on_event, ctx, err);
+        } else {
+            if (watch->conf.stat && fwt_file_modified(old_files[i], new_files[j])) {
+                fwt_emit_file(watch, new_record, new_dir, new_files[j], JFS_FWT_MODIFY, on_event, ctx, err);
+            }
+            i++;
+            j++;
+        }
+        GOTO_IF_ERR(cleanup);
+    }
+
+cleanup:
+    free(old_files);
+    free(new_files);
+}
+
+// a file whose path doesn't fit in PATH_MAX can't be named, it's left out rather than failing the update
+static void fwt_emit_file(jfs_fwt_t *watch, const jfs_fw_record_t *record, size_t dir, const jfs_fw_file_t *file, jfs_fwt_event_types_t type, jfs_fwt_event_fn on_event, void *ctx, jfs_err_t *err) {
+    jfs_fio_path_buf_t *const path = &watch->path;
+
+    jfs_fw_record_dir_path(record, dir, path, err);
+    if (*err == JFS_ERR_FIO_PATH_OVERFLOW) {
+        RES_ERR;
+        return;
+    }
+    VOID_CHECK_ERR;
+
+    const size_t sep = path->len > 0 && path->data[path->len - 1] == '/' ? 0 : 1;
+    if (path->len + sep + file->name.len > PATH_MAX) return;
+    if (sep == 1) path->data[path->len++] = '/';
+    memcpy(&path->data[path->len], file->name.str, file->name.len);
+    path->len += file->name.len;
+    path->data[path->len] = '\0';
+
+    const jfs_fwt_event_t event = {.type = type, .file_type = file->type, .path = path};
+    on_event(&event, ctx);
+}
+
+static const jfs_fw_file_t **fwt_sort_files(const jfs_fw_dir_t *dir, jfs_err_t *err) {
+    const jfs_fw_file_t **files = jfs_malloc(sizeof(*files) * (dir->file_count > 0 ? dir->file_count : 1), err);
+    NULL_CHECK_ERR;
+
+    for (size_t i = 0; i < dir->file_count; i++) {
+        files[i] = &dir->files[i];
+    }
+    qsort(files, dir->file_count, sizeof(*files), fwt_file_cmp);
+    return files;
+}
+
+static int fwt_file_cmp(const void *a, const void *b) {
+    const jfs_fw_file_t *const file_a = *(const jfs_fw_file_t *const *) a;
+    const jfs_fw_file_t *const file_b = *(const jfs_fw_file_t *const *) b;
+    return strcmp(file_a->name.str, file_b->name.str);
+}
+
+static bool fwt_file_modified(const jfs_fw_file_t *old_file, const jfs_fw_file_t *new_file) {
+    return old_file->size != new_file->size || old_file->mode != new_file->mode || old_file->mtime.tv_sec != new_file->mtime.tv_sec ||
+           old_file->mtime.tv_nsec != new_file->mtime.tv_nsec;
+}
+
+// a dir keeps the watch of the old dir with its device and inode, the rest get a new one and stay dirty until an update has looked at them,
+// the watch limit or a dir that went away in the meantime leaves a dir unwatched and dirty on every update,
+// returns how many watches were added
+static size_t fwt_watch_dirs(jfs_fwt_t *watch, const jfs_fw_record_t *new_record, int *new_wds, bool *new_dirty, jfs_err_t *err) {
+    const jfs_fw_record_t *const old_record = &watch->record;
+    fwt_inode_t                 *old_index = NULL;
+    bool                        *claimed = NULL;
+    size_t                       old_count = 0;
+    size_t                       added = 0;
+
+    // on create the record is new_record and nothing is watched yet
+    if (old_record != new_record) {
+        old_index = fwt_index_inodes(old_record, watch->dir_wds, &old_count, err);
+        VAL_CHECK_ERR(0);
+        claimed = jfs_malloc(sizeof(*claimed) * (old_count > 0 ? old_count : 1), err);
+        GOTO_IF_ERR(cleanup);
+        memset(claimed, 0, sizeof(*claimed) * old_count);
+    }
+
+    for (size_t i = 0; i < new_record->dir_count; i++) {
+        new_wds[i] = FWT_NO_WATCH;
+        new_dirty[i] = true;
+
+        const size_t found = fwt_find_inode(old_index, old_count, &new_record->dir_array[i]);
+        if (found != old_count && !claimed[found]) {
+            new_wds[i] = watch->dir_wds[old_index[found].dir];
+            new_dirty[i] = false;
+            claimed[found] = true;
+            continue;
+        }
+
+        jfs_fw_record_dir_path(new_record, i, &watch->path, err);
+        if (*err == JFS_OK) new_wds[i] = jfs_inotify_add_watch(watch->fd, watch->path.data, watch->mask, err);
+        if (*err == JFS_OK) added += 1;
+        if (*err == JFS_ERR_FULL || *err == JFS_ERR_ACCESS || *err == JFS_ERR_INVAL_PATH || *err == JFS_ERR_FIO_PATH_OVERFLOW) {
+            RES_ERR;
+            new_wds[i] = FWT_NO_WATCH;
+        }
+        GOTO_IF_ERR(cleanup);
+    }
+
+    // whatever wasn't claimed belongs to a dir that's gone, its watch usually went with it
+    for (size_t i = 0; i < old_count; i++) {
+        if (claimed[i]) continue;
+        jfs_inotify_rm_watch(watch->fd, watch->dir_wds[old_index[i].dir], err);
+        RES_ERR;
+    }
+
+cleanup:
+    free(old_index);
+    free(claimed);
+    return added;
+}
+
+static void fwt_set_watches(jfs_fwt_t *watch, const jfs_fw_record_t *record, const int *wds, jfs_err_t *err) {
+    fwt_watch_t *watches = jfs_malloc(sizeof(*watches) * (record->dir_count > 0 ? record->dir_count : 1), err);
+    VOID_CHECK_ERR;
+
+    size_t count = 0;
+    for (size_t i = 0; i < record->dir_count; i++) {
+        if (wds[i] != FWT_NO_WATCH) watches[count++] = (fwt_watch_t) {.wd = wds[i], .dir = i};
+    }
+    qsort(watches, count, sizeof(*watches), fwt_watch_cmp);
+
+    free(watch->watches);
+    watch->watches = watches;
+    watch->watch_count = count;
+}
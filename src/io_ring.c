@@ -0,0 +1,110 @@
+#include "io_ring.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static unsigned int *ior_ptr(void *map, uint32_t offset);
+static unsigned int  ior_load_acquire(const unsigned int *shared);
+static void          ior_store_release(unsigned int *shared, unsigned int value);
+
+void jfs_ior_init(jfs_ior_t *ring_init, unsigned int entries, jfs_err_t *err) {
+    struct io_uring_params params = {0};
+    memset(ring_init, 0, sizeof(*ring_init));
+    ring_init->fd = -1;
+
+    ring_init->fd = jfs_io_uring_setup(entries, &params, err);
+    VOID_CHECK_ERR;
+
+    // the rings are mapped separately even when the kernel could share one mapping, it accepts both
+    ring_init->sq_map_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+    ring_init->sq_map = jfs_mmap(NULL, ring_init->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_init->fd, IORING_OFF_SQ_RING, err);
+    GOTO_IF_ERR(cleanup);
+
+    ring_init->cq_map_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    ring_init->cq_map = jfs_mmap(NULL, ring_init->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_init->fd, IORING_OFF_CQ_RING, err);
+    GOTO_IF_ERR(cleanup);
+
+    ring_init->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring_init->sqes = jfs_mmap(NULL, ring_init->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_init->fd, IORING_OFF_SQES, err);
+    GOTO_IF_ERR(cleanup);
+
+    ring_init->entries = params.sq_entries;
+    ring_init->sq_head = ior_ptr(ring_init->sq_map, params.sq_off.head);
+    ring_init->sq_tail = ior_ptr(ring_init->sq_map, params.sq_off.tail);
+    ring_init->sq_array = ior_ptr(ring_init->sq_map, params.sq_off.array);
+    ring_init->sq_mask = *ior_ptr(ring_init->sq_map, params.sq_off.ring_mask);
+    ring_init->sq_local_tail = *ring_init->sq_tail;
+    ring_init->cq_head = ior_ptr(ring_init->cq_map, params.cq_off.head);
+    ring_init->cq_tail = ior_ptr(ring_init->cq_map, params.cq_off.tail);
+    ring_init->cq_mask = *ior_ptr(ring_init->cq_map, params.cq_off.ring_mask);
+    ring_init->cqes = (struct io_uring_cqe *) (void *) ior_ptr(ring_init->cq_map, params.cq_off.cqes);
+
+    return;
+
+cleanup:
+    jfs_ior_free(ring_init);
+}
+
+void jfs_ior_free(jfs_ior_t *ring_free) {
+    if (ring_free->sqes != NULL) munmap(ring_free->sqes, ring_free->sqes_size);
+    if (ring_free->cq_map != NULL) munmap(ring_free->cq_map, ring_free->cq_map_size);
+    if (ring_free->sq_map != NULL) munmap(ring_free->sq_map, ring_free->sq_map_size);
+    if (ring_free->fd != -1) close(ring_free->fd);
+
+    memset(ring_free, 0, sizeof(*ring_free));
+    ring_free->fd = -1;
+}
+
+struct io_uring_sqe *jfs_ior_get_sqe(jfs_ior_t *ring) {
+    if (ring->sq_local_tail - ior_load_acquire(ring->sq_head) >= ring->entries) return NULL;
+
+    const unsigned int   index = ring->sq_local_tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail += 1;
+    return sqe;
+}
+
+// publishes every sqe handed out so far and blocks until at least wait_count completions are ready
+void jfs_ior_submit_and_wait(jfs_ior_t *ring, unsigned int wait_count, jfs_err_t *err) {
+    ior_store_release(ring->sq_tail, ring->sq_local_tail);
+
+    unsigned int to_submit = ring->sq_local_tail - ior_load_acquire(ring->sq_head);
+    for (;;) {
+        const unsigned int submitted = jfs_io_uring_enter(ring->fd, to_submit, wait_count, IORING_ENTER_GETEVENTS, err);
+        if (*err == JFS_ERR_INTER) {
+            RES_ERR;
+            continue;
+        }
+        VOID_CHECK_ERR;
+
+        // the wait only happens once everything went in, a short submit goes around again
+        if (submitted >= to_submit) return;
+        to_submit -= submitted;
+    }
+}
+
+bool jfs_ior_pop_cqe(jfs_ior_t *ring, struct io_uring_cqe *cqe_out) {
+    const unsigned int head = *ring->cq_head; // only this side writes the head
+    if (head == ior_load_acquire(ring->cq_tail)) return false;
+
+    *cqe_out = ring->cqes[head & ring->cq_mask];
+    ior_store_release(ring->cq_head, head + 1);
+    return true;
+}
+
+static unsigned int *ior_ptr(void *map, uint32_t offset) {
+    return (unsigned int *) (void *) ((uint8_t *) map + offset);
+}
+
+// the kernel writes the other side of these, they're shared memory rather than atomics of ours
+static unsigned int ior_load_acquire(const unsigned int *shared) {
+    return atomic_load_explicit((const _Atomic unsigned int *) shared, memory_order_acquire);
+}
+
+static void ior_store_release(unsigned int *shared, unsigned int value) {
+    atomic_store_explicit((_Atomic unsigned int *) shared, value, memory_order_release);
+}
@@ -1,18 +1,97 @@
 #include "lru_cache.h"
+#include "file_io.h"
 #include <assert.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
-static void lru_promote(jfs_lru_t *lru, size_t index);
-static int lru_valid_fn(const jfs_lru_fn_t *fn);
+#define LRU_SWEEP_STEP        4  // entries checked for expiry per access, only while some entry has a ttl
+#define LRU_BATCH_MAX         64 // keys resolved per scan in jfs_lru_access_many
+#define LRU_PREFETCH_DISTANCE 4  // entries fetched ahead of the batch scan
+#define LRU_NOT_FOUND         SIZE_MAX
+#define LRU_MRC_WORDS         8 // per sample, keys, slot_stamps, stamp_slots and tree each take two
+
+#define LRU_SNAPSHOT_MAGIC       ((uint64_t) 0x3175726c5f73666a) // "jfs_lru1"
+#define LRU_SNAPSHOT_ALIGN       ((size_t) 8)                    // records are padded so the mapped file can be read in place
+#define LRU_SNAPSHOT_BUFFER_SIZE ((size_t) 64 * 1024)
+
+typedef struct lru_batch_key       lru_batch_key_t;
+typedef struct lru_snapshot_header lru_snapshot_header_t;
+typedef struct lru_snapshot_record lru_snapshot_record_t;
+
+struct lru_batch_key {
+    uint64_t hash;
+    size_t   key_index;
+};
+
+struct lru_snapshot_header {
+    uint64_t magic;
+    uint64_t has_hash;
+};
+
+// followed by size bytes of user data padded to LRU_SNAPSHOT_ALIGN
+struct lru_snapshot_record {
+    uint64_t ttl_ns; // time left when saved, 0 never expires
+    uint64_t hash;
+    uint64_t cost;
+    uint64_t size;
+};
+
+static void            *lru_entry_slot(const jfs_lru_t *lru, const jfs_lru_entry_t *entry) WUR;
+static jfs_lru_entry_t *lru_slot_entry(const jfs_lru_t *lru, const void *slot);
+static jfs_lru_entry_t *lru_index(const jfs_lru_t *lru, size_t index);
+static bool             lru_expired(const jfs_lru_entry_t *entry, uint64_t now);
+static uint64_t         lru_now(void);
+static uint64_t         lru_hash(const jfs_lru_t *lru, const void *key);
+static void             lru_hit(jfs_lru_t *lru, jfs_lru_entry_t *entry, void *user_ctx);
+static void             lru_miss(jfs_lru_t *lru, jfs_lru_entry_t *entry, void *user_ctx);
+static void             lru_evict(jfs_lru_t *lru, jfs_lru_entry_t *entry);
+static void             lru_remove(jfs_lru_t *lru, size_t index);
+static void             lru_trim(jfs_lru_t *lru);
+static void             lru_sweep(jfs_lru_t *lru, uint64_t now);
+static void             lru_promote(jfs_lru_t *lru, size_t index);
+static int              lru_valid_fn(const jfs_lru_fn_t *fn);
+
+static void     lru_mrc_init(jfs_lru_mrc_t *mrc_init, const jfs_lru_mrc_conf_t *conf, const jfs_lru_fn_t *fn, jfs_err_t *err);
+static void     lru_mrc_record(jfs_lru_mrc_t *mrc, uint64_t hash);
+static uint64_t lru_mrc_mix(uint64_t hash);
+static size_t   lru_mrc_find(const jfs_lru_mrc_t *mrc, uint64_t sample);
+static void     lru_mrc_erase(jfs_lru_mrc_t *mrc, size_t slot);
+static void     lru_mrc_drop_oldest(jfs_lru_mrc_t *mrc);
+static void     lru_mrc_renumber(jfs_lru_mrc_t *mrc);
+static void     lru_mrc_tree_add(jfs_lru_mrc_t *mrc, size_t stamp, int64_t delta);
+static uint64_t lru_mrc_tree_prefix(const jfs_lru_mrc_t *mrc, size_t stamp);
+static size_t   lru_mrc_tree_first(const jfs_lru_mrc_t *mrc);
+
+static void lru_snapshot_flush(int fd, uint8_t *buf, size_t *used, jfs_err_t *err);
+
+static void   lru_batch_access(jfs_lru_t *lru, const void *const *keys, void *const *user_ctxs, size_t key_count);
+static int    lru_batch_key_cmp(const void *a, const void *b);
+static size_t lru_batch_lower_bound(const lru_batch_key_t *order, size_t key_count, uint64_t hash);
+static void   lru_batch_scan(const jfs_lru_t *lru, const void *const *keys, const lru_batch_key_t *order, size_t *found, size_t key_count);
+static void   lru_batch_shift(size_t *found, size_t key_count, size_t resolved, size_t index);
+static void   lru_batch_forget(size_t *found, size_t key_count, size_t resolved, size_t index);
+static void   lru_batch_adopt(const jfs_lru_t *lru, const void *const *keys, const uint64_t *hashes, size_t *found, size_t key_count, size_t resolved);
 
 jfs_mlg_desc_t jfs_lru_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
-    const jfs_mlg_desc_t desc = {
+    jfs_mlg_desc_t entry_desc = {.align = alignof(jfs_lru_entry_t), .size = sizeof(jfs_lru_entry_t), .count = 1};
+    assert(jfs_mlg_valid_desc(&entry_desc));
+
+    const jfs_mlg_desc_t obj_desc = {
         .align = obj_align,
         .size = obj_size,
         .count = obj_count + 1 // extra slot for promote algorithm
     };
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc), JFS_ERR_ARG, (jfs_mlg_desc_t){0});
 
-    VAL_FAIL_IF(!jfs_mlg_valid_desc(&desc), JFS_ERR_ARG, (jfs_mlg_desc_t){0});
-    return desc;
+    const jfs_mlg_desc_t slot_desc = {.align = obj_align, .size = obj_size, .count = 1};
+    jfs_mlg_append(&entry_desc, &slot_desc); // init recomputes the offset from the component align
+    entry_desc.size = jfs_mlg_align_size(entry_desc.size, entry_desc.align);
+    entry_desc.count = obj_desc.count;
+    return entry_desc;
 }
 
 void jfs_lru_init(jfs_lru_t *lru_init, const jfs_lru_conf_t *conf, jfs_err_t *err) {
@@ -21,39 +100,614 @@ void jfs_lru_init(jfs_lru_t *lru_init, const jfs_lru_conf_t *conf, jfs_err_t *er
     jfs_mb_init(&lru_init->mb, conf->component, err);
     VOID_CHECK_ERR;
 
+    lru_init->value_offset = jfs_mlg_align_size(sizeof(jfs_lru_entry_t), conf->component->desc.align);
+    VOID_FAIL_IF(lru_init->value_offset >= lru_init->mb.obj_size, JFS_ERR_BAD_CONF);
+
+    lru_mrc_init(&lru_init->mrc, &conf->mrc, &conf->fn, err);
+    VOID_CHECK_ERR;
+
     lru_init->count = 0;
     lru_init->fn = conf->fn;
     lru_init->evict_ctx = conf->evict_ctx;
+    lru_init->ttl_count = 0;
+    lru_init->sweep_cursor = 0;
+    lru_init->total_cost = 0;
+    lru_init->cost_budget = conf->cost_budget;
+    memset(&lru_init->stats, 0, sizeof(lru_init->stats));
 }
 
 void jfs_lru_free(jfs_lru_t *lru_move) {
     for (size_t i = 0; i < lru_move->count; i++) {
-        lru_move->fn.evict(jfs_mb_index(&lru_move->mb, i), lru_move->evict_ctx);
+        lru_move->fn.evict(lru_entry_slot(lru_move, lru_index(lru_move, i)), lru_move->evict_ctx);
     }
 }
 
 void jfs_lru_access(jfs_lru_t *lru, const void *key, void *user_ctx) { // NOLINT
+    const uint64_t now = lru->ttl_count > 0 ? lru_now() : 0;
+    const uint64_t hash = lru_hash(lru, key);
+    lru_sweep(lru, now);
+    lru_mrc_record(&lru->mrc, hash);
+
     for (size_t i = 0; i < lru->count; i++) {
-        void *slot_ptr = jfs_mb_index(&lru->mb, i);
-        if (lru->fn.cmp(key, slot_ptr) == 0) {
-            lru->fn.hit(slot_ptr, user_ctx);
-            if (i != 0) lru_promote(lru, i);
+        jfs_lru_entry_t *const entry = lru_index(lru, i);
+        void *const            slot_ptr = lru_entry_slot(lru, entry);
+        if (entry->hash == hash && lru->fn.cmp(key, slot_ptr) == 0) {
+            if (lru_expired(entry, now)) { // expired entries are a miss that reuses the slot
+                lru_evict(lru, entry);
+                lru_miss(lru, entry, user_ctx);
+            } else {
+                lru_hit(lru, entry, user_ctx);
+            }
+            if (i != 0) {
+                lru->stats.promotions += 1;
+                lru_promote(lru, i);
+            }
+            lru_trim(lru);
             return;
         }
     }
 
-    void *slot = NULL;
+    jfs_lru_entry_t *entry = NULL;
     if (lru->count < lru->mb.capacity) {
-        slot = jfs_mb_index(&lru->mb, lru->count);
+        entry = lru_index(lru, lru->count);
+        entry->expires = 0;
+        entry->cost = 0;
         lru->count += 1;
     } else {
         assert(lru->count == lru->mb.capacity);
-        slot = jfs_mb_index(&lru->mb, lru->count - 1);
-        lru->fn.evict(slot, lru->evict_ctx);
+        entry = lru_index(lru, lru->count - 1);
+        lru_evict(lru, entry);
     }
 
-    lru->fn.miss(slot, user_ctx);
+    entry->hash = hash;
+    lru_miss(lru, entry, user_ctx);
     lru_promote(lru, lru->count - 1);
+    lru_trim(lru);
+}
+
+void jfs_lru_access_many(jfs_lru_t *lru, const void *const *keys, size_t key_count, void *const *user_ctxs) {
+    for (size_t start = 0; start < key_count; start += LRU_BATCH_MAX) {
+        const size_t remaining = key_count - start;
+        lru_batch_access(lru, keys + start, user_ctxs + start, remaining < LRU_BATCH_MAX ? remaining : LRU_BATCH_MAX);
+    }
+}
+
+jfs_mlg_desc_t jfs_lru_mrc_make_desc(size_t sample_capacity, size_t bucket_count, jfs_err_t *err) {
+    VAL_FAIL_IF(sample_capacity == 0 || bucket_count == 0, JFS_ERR_ARG, (jfs_mlg_desc_t){0});
+    VAL_FAIL_IF(sample_capacity > (SIZE_MAX - bucket_count) / LRU_MRC_WORDS, JFS_ERR_ARG, (jfs_mlg_desc_t){0});
+
+    // one component holds the histogram followed by the sample index
+    const jfs_mlg_desc_t desc = {.align = alignof(uint64_t), .size = sizeof(uint64_t), .count = bucket_count + (LRU_MRC_WORDS * sample_capacity)};
+    return desc;
+}
+
+double jfs_lru_mrc_miss_ratio(const jfs_lru_t *lru, size_t capacity) {
+    const jfs_lru_mrc_t *const mrc = &lru->mrc;
+    if (mrc->total == 0) return 1.0;
+
+    double hits = 0.0;
+    for (size_t i = 0; i < mrc->bucket_count; i++) {
+        const size_t start = i * mrc->bucket_width;
+        if (start >= capacity) break;
+
+        if (start + mrc->bucket_width <= capacity) {
+            hits += (double) mrc->buckets[i];
+        } else { // capacity ends inside this bucket so assume its distances are spread evenly
+            hits += (double) mrc->buckets[i] * (double) (capacity - start) / (double) mrc->bucket_width;
+        }
+    }
+
+    return 1.0 - (hits / (double) mrc->total);
+}
+
+void jfs_lru_reset_stats(jfs_lru_t *lru) {
+    memset(&lru->stats, 0, sizeof(lru->stats));
+
+    // the samples are kept since they are recency state, not counts
+    if (lru->mrc.buckets != NULL) memset(lru->mrc.buckets, 0, sizeof(*lru->mrc.buckets) * lru->mrc.bucket_count);
+    lru->mrc.cold = 0;
+    lru->mrc.total = 0;
+}
+
+void jfs_lru_save(const jfs_lru_t *lru, int fd, size_t record_max, jfs_lru_save_fn save, void *ctx, jfs_err_t *err) { // NOLINT
+    VOID_FAIL_IF(save == NULL || record_max == 0, JFS_ERR_ARG);
+
+    // the user serializes straight into the staging buffer, so keep room for one full record past the flush point
+    const size_t   record_space = sizeof(lru_snapshot_record_t) + jfs_mlg_align_size(record_max, LRU_SNAPSHOT_ALIGN);
+    const size_t   capacity = LRU_SNAPSHOT_BUFFER_SIZE + record_space;
+    const uint64_t now = lru->ttl_count > 0 ? lru_now() : 0;
+    size_t         used = 0;
+
+    uint8_t *const buf = jfs_malloc(capacity, err);
+    VOID_CHECK_ERR;
+
+    const lru_snapshot_header_t header = {.magic = LRU_SNAPSHOT_MAGIC, .has_hash = lru->fn.hash != NULL};
+    memcpy(buf, &header, sizeof(header));
+    used += sizeof(header);
+
+    for (size_t i = 0; i < lru->count; i++) {
+        const jfs_lru_entry_t *const entry = lru_index(lru, i);
+        if (lru_expired(entry, now)) continue;
+
+        if (capacity - used < record_space) {
+            lru_snapshot_flush(fd, buf, &used, err);
+            GOTO_IF_ERR(cleanup);
+        }
+
+        uint8_t *const payload = buf + used + sizeof(lru_snapshot_record_t);
+        const size_t   size = save(lru_entry_slot(lru, entry), payload, record_max, ctx);
+        if (size == 0) continue;
+        if (size > record_max) GOTO_WITH_ERR(cleanup, JFS_ERR_ARG);
+
+        const size_t                padded_size = jfs_mlg_align_size(size, LRU_SNAPSHOT_ALIGN);
+        const lru_snapshot_record_t record = {
+            .ttl_ns = entry->expires != 0 ? entry->expires - now : 0,
+            .hash = entry->hash,
+            .cost = entry->cost,
+            .size = size,
+        };
+        memcpy(buf + used, &record, sizeof(record));
+        memset(payload + size, 0, padded_size - size);
+        used += sizeof(record) + padded_size;
+    }
+
+    lru_snapshot_flush(fd, buf, &used, err);
+    GOTO_IF_ERR(cleanup);
+
+    free(buf);
+    return;
+cleanup:
+    free(buf);
+}
+
+void jfs_lru_load(jfs_lru_t *lru, int fd, jfs_lru_load_fn load, void *ctx, jfs_err_t *err) { // NOLINT
+    // cmp only takes a key against a slot, so a loaded slot can't be checked against the resident ones
+    VOID_FAIL_IF(load == NULL || lru->count != 0, JFS_ERR_ARG);
+
+    struct stat file_stat = {0};
+    VOID_FAIL_IF(fstat(fd, &file_stat) != 0, JFS_ERR_SYS);
+    const size_t file_size = (size_t) file_stat.st_size;
+    VOID_FAIL_IF(file_size < sizeof(lru_snapshot_header_t), JFS_ERR_LRU_SNAPSHOT);
+
+    uint8_t *const map = jfs_mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0, err);
+    VOID_CHECK_ERR;
+    (void) madvise(map, file_size, MADV_SEQUENTIAL); // only a hint, the restore is one forward pass
+
+    lru_snapshot_header_t header = {0};
+    memcpy(&header, map, sizeof(header));
+    if (header.magic != LRU_SNAPSHOT_MAGIC) GOTO_WITH_ERR(cleanup, JFS_ERR_LRU_SNAPSHOT);
+    if (header.has_hash != (lru->fn.hash != NULL)) GOTO_WITH_ERR(cleanup, JFS_ERR_LRU_SNAPSHOT);
+
+    size_t offset = sizeof(header);
+
+    while (offset < file_size && lru->count < lru->mb.capacity) {
+        lru_snapshot_record_t record = {0};
+        if (file_size - offset < sizeof(record)) GOTO_WITH_ERR(cleanup, JFS_ERR_LRU_SNAPSHOT);
+        memcpy(&record, map + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if (record.size == 0 || record.size > file_size - offset) GOTO_WITH_ERR(cleanup, JFS_ERR_LRU_SNAPSHOT);
+        const uint8_t *const payload = map + offset;
+        offset += jfs_mlg_align_size(record.size, LRU_SNAPSHOT_ALIGN);
+
+        if (lru->cost_budget != 0 && lru->total_cost + record.cost > lru->cost_budget) continue;
+
+        jfs_lru_entry_t *const entry = lru_index(lru, lru->count);
+        entry->expires = 0;
+        entry->cost = 0;
+        entry->hash = record.hash;
+        if (!load(lru_entry_slot(lru, entry), payload, record.size, ctx)) continue;
+
+        lru->count += 1;
+        jfs_lru_set_cost(lru, lru_entry_slot(lru, entry), record.cost);
+        if (record.ttl_ns != 0) jfs_lru_set_ttl(lru, lru_entry_slot(lru, entry), record.ttl_ns);
+    }
+
+    munmap(map, file_size);
+    return;
+cleanup:
+    munmap(map, file_size);
+}
+
+void jfs_lru_set_cost(jfs_lru_t *lru, void *slot, uint64_t cost) {
+    jfs_lru_entry_t *const entry = lru_slot_entry(lru, slot);
+
+    lru->total_cost = lru->total_cost - entry->cost + cost;
+    entry->cost = cost;
+}
+
+void jfs_lru_set_ttl(jfs_lru_t *lru, void *slot, uint64_t ttl_ns) {
+    jfs_lru_entry_t *const entry = lru_slot_entry(lru, slot);
+
+    if (entry->expires == 0 && ttl_ns > 0) lru->ttl_count += 1;
+    if (entry->expires != 0 && ttl_ns == 0) lru->ttl_count -= 1;
+    entry->expires = ttl_ns > 0 ? lru_now() + ttl_ns : 0;
+}
+
+static void *lru_entry_slot(const jfs_lru_t *lru, const jfs_lru_entry_t *entry) {
+    return jfs_mlg_apply_offset((uint8_t *) entry, lru->value_offset);
+}
+
+static jfs_lru_entry_t *lru_slot_entry(const jfs_lru_t *lru, const void *slot) {
+    return (jfs_lru_entry_t *) (((uint8_t *) slot) - lru->value_offset);
+}
+
+static jfs_lru_entry_t *lru_index(const jfs_lru_t *lru, size_t index) {
+    return jfs_mb_index(&lru->mb, index);
+}
+
+static bool lru_expired(const jfs_lru_entry_t *entry, uint64_t now) {
+    return entry->expires != 0 && entry->expires <= now;
+}
+
+static uint64_t lru_now(void) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000ULL) + (uint64_t) now.tv_nsec;
+}
+
+// runs the user evict and drops the entry's ttl and cost bookkeeping, the memory stays where it is
+static void lru_evict(jfs_lru_t *lru, jfs_lru_entry_t *entry) {
+    lru->fn.evict(lru_entry_slot(lru, entry), lru->evict_ctx);
+    lru->stats.evictions += 1;
+    if (entry->expires != 0) lru->ttl_count -= 1;
+    entry->expires = 0;
+    lru->total_cost -= entry->cost;
+    entry->cost = 0;
+}
+
+static void lru_remove(jfs_lru_t *lru, size_t index) {
+    assert(index < lru->count);
+    jfs_mb_remap(&lru->mb, index, index + 1, lru->count - index - 1);
+    lru->count -= 1;
+}
+
+// evicts from the tail until the total cost fits, the front entry is kept even if it alone is over budget
+static void lru_trim(jfs_lru_t *lru) {
+    if (lru->cost_budget == 0) return;
+
+    while (lru->total_cost > lru->cost_budget && lru->count > 1) {
+        lru_evict(lru, lru_index(lru, lru->count - 1));
+        lru->count -= 1;
+    }
+}
+
+// checks a few entries per call and wraps around so every entry is visited within count / LRU_SWEEP_STEP accesses
+static void lru_sweep(jfs_lru_t *lru, uint64_t now) {
+    for (size_t step = 0; step < LRU_SWEEP_STEP && lru->ttl_count > 0; step++) {
+        assert(lru->count > 0);
+        if (lru->sweep_cursor >= lru->count) lru->sweep_cursor = 0;
+
+        jfs_lru_entry_t *const entry = lru_index(lru, lru->sweep_cursor);
+        if (lru_expired(entry, now)) {
+            lru_evict(lru, entry);
+            lru_remove(lru, lru->sweep_cursor); // cursor now points at the next entry
+        } else {
+            lru->sweep_cursor += 1;
+        }
+    }
+}
+
+static void lru_snapshot_flush(int fd, uint8_t *buf, size_t *used, jfs_err_t *err) {
+    (void) jfs_fio_write(fd, buf, *used, err);
+    VOID_CHECK_ERR;
+    *used = 0;
+}
+
+static uint64_t lru_hash(const jfs_lru_t *lru, const void *key) {
+    return lru->fn.hash != NULL ? lru->fn.hash(key) : 0;
+}
+
+static void lru_hit(jfs_lru_t *lru, jfs_lru_entry_t *entry, void *user_ctx) {
+    lru->stats.hits += 1;
+    lru->fn.hit(lru_entry_slot(lru, entry), user_ctx);
+}
+
+static void lru_miss(jfs_lru_t *lru, jfs_lru_entry_t *entry, void *user_ctx) {
+    lru->stats.misses += 1;
+    lru->fn.miss(lru_entry_slot(lru, entry), user_ctx);
+}
+
+static void lru_mrc_init(jfs_lru_mrc_t *mrc_init, const jfs_lru_mrc_conf_t *conf, const jfs_lru_fn_t *fn, jfs_err_t *err) {
+    memset(mrc_init, 0, sizeof(*mrc_init));
+    if (conf->component == NULL) return; // tracker disabled
+
+    VOID_FAIL_IF(!jfs_mlg_valid_component(conf->component), JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(conf->component->desc.size != sizeof(uint64_t), JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(conf->bucket_count == 0 || conf->bucket_count >= conf->component->desc.count, JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF((conf->component->desc.count - conf->bucket_count) / LRU_MRC_WORDS == 0, JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(conf->threshold == 0 || conf->threshold > JFS_LRU_MRC_MODULUS, JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(conf->bucket_width == 0, JFS_ERR_BAD_CONF);
+    VOID_FAIL_IF(fn->hash == NULL, JFS_ERR_BAD_CONF); // sampling is done on the key hash
+
+    mrc_init->buckets = conf->component->ptr;
+    mrc_init->bucket_count = conf->bucket_count;
+    mrc_init->bucket_width = conf->bucket_width;
+    mrc_init->sample_capacity = (conf->component->desc.count - conf->bucket_count) / LRU_MRC_WORDS;
+    mrc_init->table_size = 2 * mrc_init->sample_capacity;
+    mrc_init->keys = mrc_init->buckets + conf->bucket_count;
+    mrc_init->slot_stamps = mrc_init->keys + mrc_init->table_size;
+    mrc_init->stamp_slots = mrc_init->slot_stamps + mrc_init->table_size;
+    mrc_init->tree = mrc_init->stamp_slots + mrc_init->table_size;
+    mrc_init->threshold = conf->threshold;
+    memset(mrc_init->buckets, 0, sizeof(*mrc_init->buckets) * mrc_init->bucket_count);
+    memset(mrc_init->slot_stamps, 0, sizeof(*mrc_init->slot_stamps) * mrc_init->table_size * 3); // through stamp_slots and tree
+}
+
+// the distinct sampled keys used since a key's last use count its stack position, dividing by the
+// sample rate turns that into the reuse distance of the full key stream
+static void lru_mrc_record(jfs_lru_mrc_t *mrc, uint64_t hash) {
+    if (mrc->keys == NULL) return;
+
+    const uint64_t sample = lru_mrc_mix(hash);
+    if (sample % JFS_LRU_MRC_MODULUS >= mrc->threshold) return;
+    mrc->total += 1;
+
+    size_t slot = lru_mrc_find(mrc, sample);
+    if (mrc->slot_stamps[slot] == 0) { // first use, or reused after being dropped as the oldest
+        mrc->cold += 1;
+        if (mrc->sample_count == mrc->sample_capacity) {
+            lru_mrc_drop_oldest(mrc);
+            slot = lru_mrc_find(mrc, sample); // the erase can shift the probe run
+        }
+        mrc->keys[slot] = sample;
+        mrc->sample_count += 1;
+    } else {
+        const size_t   stamp = mrc->slot_stamps[slot] - 1;
+        const uint64_t position = mrc->sample_count - lru_mrc_tree_prefix(mrc, stamp);
+        const uint64_t distance = (position * JFS_LRU_MRC_MODULUS) / mrc->threshold;
+        const uint64_t bucket = distance / mrc->bucket_width;
+        if (bucket < mrc->bucket_count) {
+            mrc->buckets[bucket] += 1;
+        } else {
+            mrc->cold += 1;
+        }
+
+        lru_mrc_tree_add(mrc, stamp, -1);
+        mrc->stamp_slots[stamp] = 0;
+    }
+
+    if (mrc->next_stamp == mrc->table_size) lru_mrc_renumber(mrc);
+
+    const size_t stamp = mrc->next_stamp++;
+    mrc->slot_stamps[slot] = stamp + 1;
+    mrc->stamp_slots[stamp] = slot + 1;
+    lru_mrc_tree_add(mrc, stamp, 1);
+}
+
+// user hashes are only required to be good enough for the cmp filter, so spread them before sampling
+static uint64_t lru_mrc_mix(uint64_t hash) {
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+// the slot holding sample, or the empty slot it would go in, the table is never more than half full
+static size_t lru_mrc_find(const jfs_lru_mrc_t *mrc, uint64_t sample) {
+    size_t slot = sample % mrc->table_size;
+    while (mrc->slot_stamps[slot] != 0 && mrc->keys[slot] != sample) {
+        slot = slot + 1 < mrc->table_size ? slot + 1 : 0;
+    }
+    return slot;
+}
+
+// backward shift deletion, later keys of the probe run move up so lookups never need tombstones
+static void lru_mrc_erase(jfs_lru_mrc_t *mrc, size_t slot) {
+    size_t hole = slot;
+    size_t next = hole;
+    for (;;) {
+        next = next + 1 < mrc->table_size ? next + 1 : 0;
+        if (mrc->slot_stamps[next] == 0) break;
+
+        // a key can only fill the hole when its home isn't cyclically between the hole and itself
+        const size_t home = mrc->keys[next] % mrc->table_size;
+        const bool   movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (!movable) continue;
+
+        mrc->keys[hole] = mrc->keys[next];
+        mrc->slot_stamps[hole] = mrc->slot_stamps[next];
+        mrc->stamp_slots[mrc->slot_stamps[hole] - 1] = hole + 1;
+        hole = next;
+    }
+    mrc->slot_stamps[hole] = 0;
+}
+
+static void lru_mrc_drop_oldest(jfs_lru_mrc_t *mrc) {
+    const size_t stamp = lru_mrc_tree_first(mrc);
+    const size_t slot = mrc->stamp_slots[stamp] - 1;
+
+    lru_mrc_tree_add(mrc, stamp, -1);
+    mrc->stamp_slots[stamp] = 0;
+    lru_mrc_erase(mrc, slot);
+    mrc->sample_count -= 1;
+}
+
+// packs the live stamps down to 0 up to sample_count in the same order, at most once per sample_capacity uses
+static void lru_mrc_renumber(jfs_lru_mrc_t *mrc) {
+    size_t live = 0;
+    for (size_t stamp = 0; stamp < mrc->table_size; stamp++) {
+        if (mrc->stamp_slots[stamp] == 0) continue;
+        const size_t slot = mrc->stamp_slots[stamp] - 1;
+        mrc->stamp_slots[stamp] = 0;
+        mrc->stamp_slots[live] = slot + 1;
+        mrc->slot_stamps[slot] = live + 1;
+        live += 1;
+    }
+
+    // rebuilt in linear time, every node starts as its own count and pushes its total up to its parent
+    for (size_t i = 0; i < mrc->table_size; i++) {
+        mrc->tree[i] = i < live ? 1 : 0;
+    }
+    for (size_t i = 1; i <= mrc->table_size; i++) {
+        const size_t parent = i + (i & (~i + 1));
+        if (parent <= mrc->table_size) mrc->tree[parent - 1] += mrc->tree[i - 1];
+    }
+    mrc->next_stamp = live;
+}
+
+static void lru_mrc_tree_add(jfs_lru_mrc_t *mrc, size_t stamp, int64_t delta) {
+    for (size_t i = stamp + 1; i <= mrc->table_size; i += i & (~i + 1)) {
+        mrc->tree[i - 1] += (uint64_t) delta; // wraps back down for -1
+    }
+}
+
+// live stamps up to and including stamp
+static uint64_t lru_mrc_tree_prefix(const jfs_lru_mrc_t *mrc, size_t stamp) {
+    uint64_t sum = 0;
+    for (size_t i = stamp + 1; i > 0; i -= i & (~i + 1)) {
+        sum += mrc->tree[i - 1];
+    }
+    return sum;
+}
+
+// the oldest live stamp, found by descending the tree for the first prefix of 1
+static size_t lru_mrc_tree_first(const jfs_lru_mrc_t *mrc) {
+    size_t step = 1;
+    while (step * 2 <= mrc->table_size) {
+        step *= 2;
+    }
+
+    size_t position = 0;
+    for (; step > 0; step /= 2) {
+        if (position + step <= mrc->table_size && mrc->tree[position + step - 1] == 0) position += step;
+    }
+    return position; // the 1 based index past the zero prefix, as a 0 based stamp
+}
+
+// hashes every key, finds all resident keys in one prefetched pass over the entries,
+// then replays the accesses in order while tracking how promotes and evictions move the found indices
+static void lru_batch_access(jfs_lru_t *lru, const void *const *keys, void *const *user_ctxs, size_t key_count) { // NOLINT
+    assert(key_count <= LRU_BATCH_MAX);
+
+    uint64_t        hashes[LRU_BATCH_MAX];
+    lru_batch_key_t order[LRU_BATCH_MAX];
+    size_t          found[LRU_BATCH_MAX];
+    const uint64_t  now = lru->ttl_count > 0 ? lru_now() : 0;
+    lru_sweep(lru, now);
+
+    for (size_t i = 0; i < key_count; i++) {
+        hashes[i] = lru_hash(lru, keys[i]);
+        order[i] = (lru_batch_key_t) {.hash = hashes[i], .key_index = i};
+        found[i] = LRU_NOT_FOUND;
+    }
+    if (lru->fn.hash != NULL) qsort(order, key_count, sizeof(*order), lru_batch_key_cmp);
+
+    lru_batch_scan(lru, keys, order, found, key_count);
+
+    for (size_t i = 0; i < key_count; i++) {
+        if (i + 1 < key_count && found[i + 1] != LRU_NOT_FOUND) __builtin_prefetch(lru_index(lru, found[i + 1]));
+        lru_mrc_record(&lru->mrc, hashes[i]);
+
+        size_t           index = found[i];
+        jfs_lru_entry_t *entry = NULL;
+        const bool       is_hit = index != LRU_NOT_FOUND;
+
+        if (is_hit) {
+            entry = lru_index(lru, index);
+            if (lru_expired(entry, now)) {
+                lru_evict(lru, entry);
+                lru_miss(lru, entry, user_ctxs[i]);
+            } else {
+                lru_hit(lru, entry, user_ctxs[i]);
+            }
+        } else {
+            if (lru->count < lru->mb.capacity) {
+                index = lru->count;
+                entry = lru_index(lru, index);
+                entry->expires = 0;
+                entry->cost = 0;
+                lru->count += 1;
+            } else {
+                index = lru->count - 1;
+                entry = lru_index(lru, index);
+                lru_evict(lru, entry);
+                lru_batch_forget(found, key_count, i, index);
+            }
+
+            entry->hash = hashes[i];
+            lru_miss(lru, entry, user_ctxs[i]);
+        }
+
+        if (is_hit && index != 0) lru->stats.promotions += 1;
+        if (index != 0) lru_promote(lru, index);
+        lru_batch_shift(found, key_count, i, index);
+        if (!is_hit) lru_batch_adopt(lru, keys, hashes, found, key_count, i);
+
+        lru_trim(lru);
+        lru_batch_forget(found, key_count, i, lru->count);
+    }
+}
+
+static int lru_batch_key_cmp(const void *a, const void *b) {
+    const uint64_t a_hash = ((const lru_batch_key_t *) a)->hash;
+    const uint64_t b_hash = ((const lru_batch_key_t *) b)->hash;
+    return (a_hash > b_hash) - (a_hash < b_hash);
+}
+
+static size_t lru_batch_lower_bound(const lru_batch_key_t *order, size_t key_count, uint64_t hash) {
+    size_t low = 0;
+    size_t high = key_count;
+    while (low < high) {
+        const size_t mid = low + ((high - low) / 2);
+        if (order[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void lru_batch_scan(const jfs_lru_t *lru, const void *const *keys, const lru_batch_key_t *order, size_t *found, size_t key_count) {
+    size_t unresolved = key_count;
+
+    for (size_t i = 0; i < lru->count && unresolved > 0; i++) {
+        if (i + LRU_PREFETCH_DISTANCE < lru->count) __builtin_prefetch(lru_index(lru, i + LRU_PREFETCH_DISTANCE));
+
+        const jfs_lru_entry_t *const entry = lru_index(lru, i);
+        void *const                  slot_ptr = lru_entry_slot(lru, entry);
+
+        // without fn.hash every hash is 0 so the whole batch is one equal range
+        for (size_t k = lru_batch_lower_bound(order, key_count, entry->hash); k < key_count && order[k].hash == entry->hash; k++) {
+            const size_t key_index = order[k].key_index;
+            if (found[key_index] != LRU_NOT_FOUND) continue;
+            if (lru->fn.cmp(keys[key_index], slot_ptr) != 0) continue;
+
+            found[key_index] = i;
+            unresolved -= 1;
+        }
+    }
+}
+
+// the entry at index was promoted to 0, everything in front of it moved back by one
+static void lru_batch_shift(size_t *found, size_t key_count, size_t resolved, size_t index) {
+    for (size_t k = resolved + 1; k < key_count; k++) {
+        if (found[k] == index) {
+            found[k] = 0;
+        } else if (found[k] != LRU_NOT_FOUND && found[k] < index) {
+            found[k] += 1;
+        }
+    }
+}
+
+// entries from index to the tail were evicted so later keys that found them now miss
+static void lru_batch_forget(size_t *found, size_t key_count, size_t resolved, size_t index) {
+    for (size_t k = resolved + 1; k < key_count; k++) {
+        if (found[k] != LRU_NOT_FOUND && found[k] >= index) found[k] = LRU_NOT_FOUND;
+    }
+}
+
+// a miss just filled entry 0, later duplicates of the same key hit it instead of missing again
+static void lru_batch_adopt(const jfs_lru_t *lru, const void *const *keys, const uint64_t *hashes, size_t *found, size_t key_count, size_t resolved) {
+    void *const slot_ptr = lru_entry_slot(lru, lru_index(lru, 0));
+
+    for (size_t k = resolved + 1; k < key_count; k++) {
+        if (found[k] != LRU_NOT_FOUND || hashes[k] != hashes[resolved]) continue;
+        if (lru->fn.cmp(keys[k], slot_ptr) == 0) found[k] = 0;
+    }
 }
 
 static void lru_promote(jfs_lru_t *lru, size_t index) {
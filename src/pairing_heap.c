@@ -0,0 +1,180 @@
+#include "pairing_heap.h"
+#include "memory_layout_generator.h"
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static void             *pheap_value(const jfs_pheap_t *heap, const jfs_pheap_node_t *node) WUR;
+static jfs_pheap_node_t *pheap_meld(const jfs_pheap_t *heap, jfs_pheap_node_t *a, jfs_pheap_node_t *b);
+static jfs_pheap_node_t *pheap_merge_pairs(const jfs_pheap_t *heap, jfs_pheap_node_t *first);
+static void              pheap_cut(jfs_pheap_node_t *node);
+static jfs_pheap_node_t *pheap_detach_children(const jfs_pheap_t *heap, jfs_pheap_node_t *node);
+
+jfs_mlg_desc_t jfs_pheap_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    jfs_mlg_desc_t node_desc = {.align = alignof(jfs_pheap_node_t), .size = sizeof(jfs_pheap_node_t), .count = 1};
+    assert(jfs_mlg_valid_desc(&node_desc));
+
+    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = 1};
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc) || obj_count == 0, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    jfs_mlg_append(&node_desc, &obj_desc);
+    node_desc.size = jfs_mlg_align_size(node_desc.size, node_desc.align);
+    node_desc.count = obj_count;
+    return node_desc;
+}
+
+void jfs_pheap_init(jfs_pheap_t *heap_init, const jfs_pheap_conf_t *conf, jfs_err_t *err) {
+    assert(conf != NULL);
+
+    jfs_fl_init(&heap_init->free_list, conf->component, err);
+    VOID_CHECK_ERR;
+
+    heap_init->root = NULL;
+    heap_init->count = 0;
+
+    heap_init->value_offset = jfs_mlg_align_size(sizeof(jfs_pheap_node_t), conf->component->desc.align);
+    VOID_FAIL_IF(heap_init->value_offset >= conf->component->desc.size, JFS_ERR_BAD_CONF);
+    heap_init->value_size = conf->component->desc.size - heap_init->value_offset;
+    if (conf->value_size != 0) {
+        VOID_FAIL_IF(conf->value_size > heap_init->value_size, JFS_ERR_BAD_CONF);
+        heap_init->value_size = conf->value_size;
+    }
+
+    heap_init->cmp = conf->cmp;
+    VOID_FAIL_IF(heap_init->cmp == NULL, JFS_ERR_BAD_CONF);
+}
+
+jfs_pheap_node_t *jfs_pheap_push(jfs_pheap_t *heap, const void *value, jfs_err_t *err) {
+    jfs_pheap_node_t *const node = jfs_fl_alloc(&heap->free_list);
+    NULL_FAIL_IF(node == NULL, JFS_ERR_FULL);
+
+    node->child = NULL;
+    node->next = NULL;
+    node->prev = NULL;
+    memcpy(pheap_value(heap, node), value, heap->value_size);
+
+    heap->root = pheap_meld(heap, heap->root, node);
+    heap->count += 1;
+    return node;
+}
+
+void jfs_pheap_pop(jfs_pheap_t *heap, void *value_out, jfs_err_t *err) {
+    VOID_FAIL_IF(heap->root == NULL, JFS_ERR_EMPTY);
+    jfs_pheap_remove(heap, heap->root, value_out);
+}
+
+void *jfs_pheap_peek(const jfs_pheap_t *heap) {
+    return heap->root != NULL ? pheap_value(heap, heap->root) : NULL;
+}
+
+void *jfs_pheap_value(const jfs_pheap_t *heap, const jfs_pheap_node_t *node) {
+    return pheap_value(heap, node);
+}
+
+void jfs_pheap_update(jfs_pheap_t *heap, jfs_pheap_node_t *node, const void *value) {
+    const bool increased = heap->cmp(value, pheap_value(heap, node)) > 0;
+    memcpy(pheap_value(heap, node), value, heap->value_size);
+
+    // an increased value can now be out of order with its children, they go back in as their own heap
+    jfs_pheap_node_t *const children = increased ? pheap_detach_children(heap, node) : NULL;
+
+    if (node != heap->root) {
+        pheap_cut(node);
+        heap->root = pheap_meld(heap, heap->root, node);
+    }
+    heap->root = pheap_meld(heap, heap->root, children);
+}
+
+void jfs_pheap_remove(jfs_pheap_t *heap, jfs_pheap_node_t *node_move, void *value_out) {
+    memcpy(value_out, pheap_value(heap, node_move), heap->value_size);
+
+    jfs_pheap_node_t *const children = pheap_detach_children(heap, node_move);
+    if (node_move == heap->root) {
+        heap->root = children;
+    } else {
+        pheap_cut(node_move);
+        heap->root = pheap_meld(heap, heap->root, children);
+    }
+
+    jfs_fl_free(&heap->free_list, node_move);
+    heap->count -= 1;
+}
+
+static void *pheap_value(const jfs_pheap_t *heap, const jfs_pheap_node_t *node) {
+    return jfs_mlg_apply_offset((uint8_t *) node, heap->value_offset);
+}
+
+// both sides are roots with no siblings, the loser becomes the leftmost child of the winner
+static jfs_pheap_node_t *pheap_meld(const jfs_pheap_t *heap, jfs_pheap_node_t *a, jfs_pheap_node_t *b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    assert(a->next == NULL && a->prev == NULL && b->next == NULL && b->prev == NULL);
+
+    if (heap->cmp(pheap_value(heap, b), pheap_value(heap, a)) < 0) {
+        jfs_pheap_node_t *const swap = a;
+        a = b;
+        b = swap;
+    }
+
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL) a->child->prev = b;
+    a->child = b;
+    return a;
+}
+
+// standard two pass: meld neighbours left to right, then fold the pairs right to left into one root,
+// the pairs are chained backwards through prev so neither pass needs a stack
+static jfs_pheap_node_t *pheap_merge_pairs(const jfs_pheap_t *heap, jfs_pheap_node_t *first) {
+    jfs_pheap_node_t *pairs = NULL;
+
+    while (first != NULL) {
+        jfs_pheap_node_t *const a = first;
+        jfs_pheap_node_t *const b = a->next;
+        first = b != NULL ? b->next : NULL;
+
+        a->next = NULL;
+        a->prev = NULL;
+        if (b != NULL) {
+            b->next = NULL;
+            b->prev = NULL;
+        }
+
+        jfs_pheap_node_t *const pair = pheap_meld(heap, a, b);
+        pair->prev = pairs;
+        pairs = pair;
+    }
+
+    jfs_pheap_node_t *root = NULL;
+    while (pairs != NULL) {
+        jfs_pheap_node_t *const pair = pairs;
+        pairs = pair->prev;
+        pair->prev = NULL;
+        root = pheap_meld(heap, root, pair);
+    }
+
+    return root;
+}
+
+// unlinks a non root node from its parent's child list, its own subtree comes with it
+static void pheap_cut(jfs_pheap_node_t *node) {
+    assert(node->prev != NULL);
+
+    if (node->prev->child == node) {
+        node->prev->child = node->next;
+    } else {
+        node->prev->next = node->next;
+    }
+    if (node->next != NULL) node->next->prev = node->prev;
+
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+static jfs_pheap_node_t *pheap_detach_children(const jfs_pheap_t *heap, jfs_pheap_node_t *node) {
+    jfs_pheap_node_t *const first = node->child;
+    node->child = NULL;
+    return pheap_merge_pairs(heap, first);
+}
@@ -0,0 +1,312 @@
+#include "persistent_search_tree.h"
+#include "memory_layout_generator.h"
+#include <assert.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PST_COPIES_PER_LEVEL 3 // the node on the path plus the two a double rotation can touch
+
+static size_t pst_max_height(size_t count);
+static size_t pst_spare_nodes(size_t height);
+
+static void           *pst_value(const jfs_pst_t *tree, const jfs_pst_node_t *node) WUR;
+static jfs_pst_node_t *pst_alloc(jfs_pst_t *tree);
+static jfs_pst_node_t *pst_own(jfs_pst_t *tree, jfs_pst_node_t *node);
+static void            pst_release(jfs_pst_t *tree, jfs_pst_node_t *node);
+
+static jfs_pst_node_t *pst_insert(jfs_pst_t *tree, jfs_pst_node_t *node, const void *value, const void *key);
+static jfs_pst_node_t *pst_delete(jfs_pst_t *tree, jfs_pst_node_t *node, void *value_out, const void *key);
+static jfs_pst_node_t *pst_delete_min(jfs_pst_t *tree, jfs_pst_node_t *node, void *value_out);
+static jfs_pst_node_t *pst_find(const jfs_pst_t *tree, const void *key);
+
+static uint32_t        pst_height(const jfs_pst_node_t *node);
+static void            pst_update_height(jfs_pst_node_t *node);
+static jfs_pst_node_t *pst_balance(jfs_pst_t *tree, jfs_pst_node_t *node);
+static jfs_pst_node_t *pst_rotate_left(jfs_pst_t *tree, jfs_pst_node_t *x);
+static jfs_pst_node_t *pst_rotate_right(jfs_pst_t *tree, jfs_pst_node_t *x);
+
+static void pst_iter_push_left(jfs_pst_iter_t *iter, jfs_pst_node_t *node);
+
+jfs_mlg_desc_t jfs_pst_make_desc(size_t obj_size, size_t obj_align, size_t obj_count, jfs_err_t *err) {
+    jfs_mlg_desc_t node_desc = {.align = alignof(jfs_pst_node_t), .size = sizeof(jfs_pst_node_t), .count = 1};
+    assert(jfs_mlg_valid_desc(&node_desc));
+
+    const jfs_mlg_desc_t obj_desc = {.align = obj_align, .size = obj_size, .count = 1};
+    VAL_FAIL_IF(!jfs_mlg_valid_desc(&obj_desc) || obj_count == 0, JFS_ERR_ARG, (jfs_mlg_desc_t) {0});
+
+    jfs_mlg_append(&node_desc, &obj_desc);
+    node_desc.size = jfs_mlg_align_size(node_desc.size, node_desc.align);
+    node_desc.count = obj_count + pst_spare_nodes(pst_max_height(obj_count) + 1); // room for the copies of a write on a full tree
+    return node_desc;
+}
+
+void jfs_pst_init(jfs_pst_t *tree_init, const jfs_pst_conf_t *conf, jfs_err_t *err) {
+    assert(conf != NULL);
+
+    jfs_fl_init(&tree_init->free_list, conf->component, err);
+    VOID_CHECK_ERR;
+
+    tree_init->root = NULL;
+    tree_init->count = 0;
+
+    tree_init->value_offset = jfs_mlg_align_size(sizeof(jfs_pst_node_t), conf->component->desc.align);
+    VOID_FAIL_IF(tree_init->value_offset >= conf->component->desc.size, JFS_ERR_BAD_CONF);
+    tree_init->value_size = conf->component->desc.size - tree_init->value_offset;
+    if (conf->value_size != 0) {
+        VOID_FAIL_IF(conf->value_size > tree_init->value_size, JFS_ERR_BAD_CONF);
+        tree_init->value_size = conf->value_size;
+    }
+
+    tree_init->cmp = conf->cmp;
+    VOID_FAIL_IF(tree_init->cmp == NULL, JFS_ERR_BAD_CONF);
+}
+
+void jfs_pst_puts(jfs_pst_t *tree, const void *value, const void *key, jfs_err_t *err) {
+    // the new node plus every copy a shared path can need, checked up front so a write never stops halfway
+    VOID_FAIL_IF(tree->free_list.count < pst_spare_nodes(pst_height(tree->root) + 1), JFS_ERR_FULL);
+
+    tree->root = pst_insert(tree, tree->root, value, key);
+    tree->count += 1;
+}
+
+void jfs_pst_takes(jfs_pst_t *tree, void *value_out, const void *key, jfs_err_t *err) {
+    VOID_FAIL_IF(tree->root == NULL, JFS_ERR_EMPTY);
+    VOID_FAIL_IF(pst_find(tree, key) == NULL, JFS_ERR_PST_BAD_KEY);
+    VOID_FAIL_IF(tree->free_list.count < pst_spare_nodes(pst_height(tree->root)), JFS_ERR_FULL);
+
+    tree->root = pst_delete(tree, tree->root, value_out, key);
+    tree->count -= 1;
+}
+
+void *jfs_pst_lookup(const jfs_pst_t *tree, const void *key) {
+    const jfs_pst_node_t *const node = pst_find(tree, key);
+    return node != NULL ? pst_value(tree, node) : NULL;
+}
+
+void jfs_pst_snapshot(jfs_pst_t *tree, jfs_pst_snapshot_t *snapshot_init) {
+    if (tree->root != NULL) tree->root->refs += 1;
+    snapshot_init->root = tree->root;
+    snapshot_init->count = tree->count;
+}
+
+void jfs_pst_snapshot_release(jfs_pst_t *tree, jfs_pst_snapshot_t *snapshot_move) {
+    pst_release(tree, snapshot_move->root);
+    snapshot_move->root = NULL;
+    snapshot_move->count = 0;
+}
+
+void jfs_pst_iter_init(jfs_pst_iter_t *iter_init, const jfs_pst_t *tree, const jfs_pst_snapshot_t *snapshot) {
+    iter_init->tree = tree;
+    iter_init->depth = 0;
+    pst_iter_push_left(iter_init, snapshot != NULL ? snapshot->root : tree->root);
+}
+
+void *jfs_pst_iter_next(jfs_pst_iter_t *iter) {
+    if (iter->depth == 0) return NULL;
+
+    jfs_pst_node_t *const node = iter->stack[--iter->depth];
+    pst_iter_push_left(iter, node->right);
+    return pst_value(iter->tree, node);
+}
+
+// tallest AVL tree that count nodes can build, the sparsest tree of height h has fib like N(h) = N(h - 1) + N(h - 2) + 1 nodes
+static size_t pst_max_height(size_t count) {
+    size_t height = 0;
+    size_t smaller = 0; // N(height - 1)
+    size_t sparsest = 0; // N(height)
+
+    while (sparsest <= count) {
+        const size_t next = sparsest + smaller + 1;
+        smaller = sparsest;
+        sparsest = next;
+        height += 1;
+    }
+
+    return height - 1;
+}
+
+static size_t pst_spare_nodes(size_t height) {
+    return (PST_COPIES_PER_LEVEL * height) + 1;
+}
+
+static void *pst_value(const jfs_pst_t *tree, const jfs_pst_node_t *node) {
+    return jfs_mlg_apply_offset((uint8_t *) node, tree->value_offset);
+}
+
+static jfs_pst_node_t *pst_alloc(jfs_pst_t *tree) {
+    jfs_pst_node_t *const node = jfs_fl_alloc(&tree->free_list);
+    assert(node != NULL); // writes reserve their nodes up front
+    node->refs = 1;
+    return node;
+}
+
+// hands back a node only the caller's slot points at, copying it out of any snapshot that shares it
+static jfs_pst_node_t *pst_own(jfs_pst_t *tree, jfs_pst_node_t *node) {
+    assert(node != NULL);
+    if (node->refs == 1) return node;
+
+    jfs_pst_node_t *const copy = pst_alloc(tree);
+    copy->left = node->left;
+    copy->right = node->right;
+    copy->height = node->height;
+    memcpy(pst_value(tree, copy), pst_value(tree, node), tree->value_size);
+
+    if (copy->left != NULL) copy->left->refs += 1;
+    if (copy->right != NULL) copy->right->refs += 1;
+    node->refs -= 1; // the caller's slot moves to the copy
+    return copy;
+}
+
+static void pst_release(jfs_pst_t *tree, jfs_pst_node_t *node) {
+    if (node == NULL) return;
+
+    assert(node->refs > 0);
+    node->refs -= 1;
+    if (node->refs > 0) return;
+
+    jfs_pst_node_t *const left = node->left;
+    jfs_pst_node_t *const right = node->right;
+    jfs_fl_free(&tree->free_list, node);
+    pst_release(tree, left);
+    pst_release(tree, right);
+}
+
+static jfs_pst_node_t *pst_insert(jfs_pst_t *tree, jfs_pst_node_t *node, const void *value, const void *key) {
+    if (node == NULL) {
+        jfs_pst_node_t *const leaf = pst_alloc(tree);
+        leaf->left = NULL;
+        leaf->right = NULL;
+        leaf->height = 1;
+        memcpy(pst_value(tree, leaf), value, tree->value_size);
+        return leaf;
+    }
+
+    node = pst_own(tree, node);
+    if (tree->cmp(key, pst_value(tree, node)) < 0) {
+        node->left = pst_insert(tree, node->left, value, key);
+    } else {
+        node->right = pst_insert(tree, node->right, value, key);
+    }
+
+    return pst_balance(tree, node);
+}
+
+// key must be in the tree, checked by the caller so a miss never copies the path
+static jfs_pst_node_t *pst_delete(jfs_pst_t *tree, jfs_pst_node_t *node, void *value_out, const void *key) {
+    assert(node != NULL);
+    const int cmp_result = tree->cmp(key, pst_value(tree, node));
+
+    if (cmp_result == 0 && (node->left == NULL || node->right == NULL)) {
+        memcpy(value_out, pst_value(tree, node), tree->value_size);
+
+        // the child moves up into our parent's slot, the release drops our hold on it again if we go
+        jfs_pst_node_t *const child = node->left != NULL ? node->left : node->right;
+        if (child != NULL) child->refs += 1;
+        pst_release(tree, node);
+        return child;
+    }
+
+    node = pst_own(tree, node);
+    if (cmp_result < 0) {
+        node->left = pst_delete(tree, node->left, value_out, key);
+    } else if (cmp_result > 0) {
+        node->right = pst_delete(tree, node->right, value_out, key);
+    } else { // the successor's value replaces ours
+        memcpy(value_out, pst_value(tree, node), tree->value_size);
+        node->right = pst_delete_min(tree, node->right, pst_value(tree, node));
+    }
+
+    return pst_balance(tree, node);
+}
+
+static jfs_pst_node_t *pst_delete_min(jfs_pst_t *tree, jfs_pst_node_t *node, void *value_out) {
+    if (node->left == NULL) {
+        memcpy(value_out, pst_value(tree, node), tree->value_size);
+
+        jfs_pst_node_t *const right = node->right;
+        if (right != NULL) right->refs += 1;
+        pst_release(tree, node);
+        return right;
+    }
+
+    node = pst_own(tree, node);
+    node->left = pst_delete_min(tree, node->left, value_out);
+    return pst_balance(tree, node);
+}
+
+static jfs_pst_node_t *pst_find(const jfs_pst_t *tree, const void *key) {
+    jfs_pst_node_t *node = tree->root;
+
+    while (node != NULL) {
+        const int cmp_result = tree->cmp(key, pst_value(tree, node));
+        if (cmp_result == 0) return node;
+        node = cmp_result < 0 ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+static uint32_t pst_height(const jfs_pst_node_t *node) {
+    return node != NULL ? node->height : 0;
+}
+
+static void pst_update_height(jfs_pst_node_t *node) {
+    const uint32_t left = pst_height(node->left);
+    const uint32_t right = pst_height(node->right);
+    node->height = (left > right ? left : right) + 1;
+}
+
+// node must already be owned, the children a rotation changes are owned inside the rotation
+static jfs_pst_node_t *pst_balance(jfs_pst_t *tree, jfs_pst_node_t *node) {
+    pst_update_height(node);
+    const uint32_t left = pst_height(node->left);
+    const uint32_t right = pst_height(node->right);
+
+    if (left > right + 1) {
+        if (pst_height(node->left->left) < pst_height(node->left->right)) {
+            node->left = pst_rotate_left(tree, pst_own(tree, node->left));
+        }
+        return pst_rotate_right(tree, node);
+    }
+
+    if (right > left + 1) {
+        if (pst_height(node->right->right) < pst_height(node->right->left)) {
+            node->right = pst_rotate_right(tree, pst_own(tree, node->right));
+        }
+        return pst_rotate_left(tree, node);
+    }
+
+    return node;
+}
+
+static jfs_pst_node_t *pst_rotate_left(jfs_pst_t *tree, jfs_pst_node_t *x) {
+    jfs_pst_node_t *const y = pst_own(tree, x->right);
+
+    x->right = y->left;
+    y->left = x;
+
+    pst_update_height(x);
+    pst_update_height(y);
+    return y;
+}
+
+static jfs_pst_node_t *pst_rotate_right(jfs_pst_t *tree, jfs_pst_node_t *x) {
+    jfs_pst_node_t *const y = pst_own(tree, x->left);
+
+    x->left = y->right;
+    y->right = x;
+
+    pst_update_height(x);
+    pst_update_height(y);
+    return y;
+}
+
+static void pst_iter_push_left(jfs_pst_iter_t *iter, jfs_pst_node_t *node) {
+    while (node != NULL) {
+        assert(iter->depth < JFS_PST_MAX_HEIGHT);
+        iter->stack[iter->depth++] = node;
+        node = node->left;
+    }
+}